@@ -0,0 +1,79 @@
+#include "db.h"
+
+#include <chrono>
+#include <string>
+
+/*
+ * Measures writing back a buffer full of dirty pages, one page and one sync
+ * at a time in LRU order, and with the coalescing flusher of buf_checkpoint.
+ */
+
+char log_path[] = "bench_log.data";
+char logmsg_path[] = "bench_logmsg.txt";
+
+const int num_tables = 4;
+const int num_pages = 25000;  // per table
+
+void make_dirty_pages(int64_t* table_ids) {
+  for (int i = 0; i < num_tables; i++) {
+    std::string pathname = "DATA" + std::to_string(i + 1);
+    table_ids[i] = open_table(pathname.c_str());
+  }
+
+  for (int j = 0; j < num_pages; j++) {
+    for (int i = 0; i < num_tables; i++) {
+      pagenum_t page_num = buf_alloc_page(table_ids[i]);
+      control_block_t* block = buf_read_page(table_ids[i], page_num);
+      memset(block->frame->data + 64, j & 0xff, PAGE_SIZE - 64);
+      buf_unpin_block(block, 1);
+    }
+  }
+}
+
+double run(int coalesce) {
+  init_db(num_tables * num_pages + 64, 0, 0, log_path, logmsg_path);
+
+  int64_t table_ids[num_tables];
+  make_dirty_pages(table_ids);
+
+  auto begin = std::chrono::steady_clock::now();
+
+  if (coalesce) {
+    buf_checkpoint();
+  } else {
+    file_sync_mode = SYNC_ON_WRITE;
+    for (int p = 0; p < buf_num_partitions; p++) {
+      for (control_block_t* block : buf_partitions[p].blocks) {
+        if (block->is_dirty) {
+          file_write_page(block->table_id, block->page_num, block->frame);
+        }
+      }
+    }
+    file_sync_mode = SYNC_ON_CHECKPOINT;
+    buf_checkpoint();
+  }
+
+  auto end = std::chrono::steady_clock::now();
+
+  shutdown_db();
+  for (int i = 0; i < num_tables; i++) {
+    remove(("DATA" + std::to_string(i + 1)).c_str());
+  }
+  remove(log_path);
+  remove(logmsg_path);
+
+  return std::chrono::duration<double>(end - begin).count();
+}
+
+int main() {
+  double one_by_one = run(0);
+  double coalesced = run(1);
+
+  printf("%-20s %10s %14s\n", "write-back", "seconds", "pages/sec");
+  printf("%-20s %10.3f %14.0f\n", "page by page", one_by_one,
+         num_tables * num_pages / one_by_one);
+  printf("%-20s %10.3f %14.0f\n", "coalesced", coalesced,
+         num_tables * num_pages / coalesced);
+
+  return 0;
+}
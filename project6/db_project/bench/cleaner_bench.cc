@@ -0,0 +1,85 @@
+#include "db.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+
+/*
+ * Runs random updates mixed with lookups over a table four times larger than
+ * the buffer, without cleaners and with one or two, and reports the time, the
+ * dirty victims the readers had to write back themselves and the log syncs.
+ */
+
+const char* pathname = "DATA1";
+char log_path[] = "bench_log.data";
+char logmsg_path[] = "bench_logmsg.txt";
+
+const int64_t num_records = 100000;
+const int num_ops = 200000;
+const int num_buf = 512;
+
+void run(int num_cleaners) {
+  buf_num_cleaners = num_cleaners;
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+
+  std::mt19937 gen(2022);
+  std::uniform_int_distribution<int64_t> dist(0, num_records - 1);
+  std::uniform_int_distribution<int> coin(0, 3);
+  std::string value(MIN_VAL_SIZE, 'b');
+  uint16_t old_val_size;
+
+  buf_stats_t begin_stats;
+  buf_get_stats(&begin_stats);
+  uint64_t num_syncs = log_num_syncs;
+
+  auto begin = std::chrono::steady_clock::now();
+
+  // One in four operations is an update
+  for (int i = 0; i < num_ops; i++) {
+    if (coin(gen) == 0) {
+      int trx_id = trx_begin();
+      db_update(table_id, dist(gen), (char*)value.c_str(), MIN_VAL_SIZE,
+                &old_val_size, trx_id);
+      trx_commit(trx_id);
+    } else {
+      db_find(table_id, dist(gen), NULL, NULL);
+    }
+  }
+
+  auto end = std::chrono::steady_clock::now();
+
+  buf_stats_t stats;
+  buf_get_stats(&stats);
+
+  double seconds = std::chrono::duration<double>(end - begin).count();
+  printf("%-10d %10.3f %16lu %12lu %10lu\n", num_cleaners, seconds,
+         stats.num_dirty_evictions - begin_stats.num_dirty_evictions,
+         stats.num_cleaned - begin_stats.num_cleaned,
+         log_num_syncs - num_syncs);
+
+  shutdown_db();
+}
+
+int main() {
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < num_records; i++) {
+    db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE);
+  }
+  shutdown_db();
+
+  printf("%-10s %10s %16s %12s %10s\n", "cleaners", "seconds",
+         "dirty evictions", "cleaned", "log syncs");
+  run(0);
+  run(1);
+  run(2);
+
+  buf_num_cleaners = DEFAULT_NUM_CLEANERS;
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+
+  return 0;
+}
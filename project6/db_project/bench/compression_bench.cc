@@ -0,0 +1,104 @@
+#include "db.h"
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <string>
+
+/*
+ * Measures the footprint of a table of archive-like records in the raw and
+ * the compressed page format, the compression ratio of its pages, decode
+ * throughput, and a full scan from a cold buffer.
+ */
+
+const char* pathname = "DATA1";
+char log_path[] = "bench_log.data";
+char logmsg_path[] = "bench_logmsg.txt";
+
+const int64_t num_records = 200000;
+const int num_buf = 4096;
+
+std::string make_value(int64_t i) {
+  std::string value = "status=archived;region=ap-northeast-2;owner=" +
+                      std::to_string(i % 1000) + ";seq=" + std::to_string(i);
+  value.resize(MAX_VAL_SIZE, ' ');
+  return value;
+}
+
+double elapsed(std::chrono::steady_clock::time_point begin) {
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - begin).count();
+}
+
+void run(const char* name, int page_format) {
+  file_page_format = page_format;
+
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+  for (int64_t i = 0; i < num_records; i++) {
+    std::string value = make_value(i);
+    db_insert(table_id, i, value.c_str(), MAX_VAL_SIZE);
+  }
+  shutdown_db();
+
+  struct stat st;
+  stat(pathname, &st);
+  double footprint = (double)st.st_blocks * 512 / (1 << 20);
+
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  table_id = open_table(pathname);
+
+  std::vector<int64_t> keys;
+  std::vector<char*> values;
+  std::vector<uint16_t> val_sizes;
+  auto begin = std::chrono::steady_clock::now();
+  db_scan(table_id, 0, num_records - 1, &keys, &values, &val_sizes);
+  double scan = elapsed(begin);
+  for (char* value : values) {
+    delete[] value;
+  }
+
+  // Compress and decode every page in use, to measure the codec alone
+  uint64_t num_pages = 0;
+  uint64_t compressed_size = 0;
+  double decode = 0;
+  page_t page;
+  page_t decoded;
+  uint8_t compressed[PAGE_SIZE];
+  pagenum_t high_water_mark = file_read_high_water_mark(file_find_fd(table_id));
+  for (pagenum_t i = 1; i < high_water_mark; i++) {
+    file_read_page(table_id, i, &page);
+    int size = compress_block(page.data, PAGE_SIZE, compressed, PAGE_SIZE);
+    if (size < 0) {
+      size = PAGE_SIZE;
+    }
+    compressed_size += size;
+    num_pages++;
+
+    begin = std::chrono::steady_clock::now();
+    for (int j = 0; j < 16; j++) {
+      decompress_block(compressed, size, decoded.data, PAGE_SIZE);
+    }
+    decode += elapsed(begin);
+  }
+
+  shutdown_db();
+  remove(pathname);
+  remove((std::string(pathname) + PAGE_MAP_SUFFIX).c_str());
+  remove(log_path);
+  remove(logmsg_path);
+
+  printf("%-12s %14.1f %10.2f %14.0f %10.3f %10lu\n", name, footprint,
+         (double)num_pages * PAGE_SIZE / compressed_size,
+         16.0 * num_pages * PAGE_SIZE / decode / (1 << 20), scan, keys.size());
+}
+
+int main() {
+  printf("%-12s %14s %10s %14s %10s %10s\n", "format", "footprint MiB",
+         "ratio", "decode MiB/s", "scan sec", "records");
+  run("raw", PAGE_FORMAT_RAW);
+  run("compressed", PAGE_FORMAT_COMPRESSED);
+  file_page_format = PAGE_FORMAT_RAW;
+
+  return 0;
+}
@@ -0,0 +1,99 @@
+#include "db.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+
+/*
+ * Runs the same random lookups with buffered and O_DIRECT table files, and
+ * reports the buffer pool hit ratio, the process RSS and how much of the table
+ * file is also held in the OS page cache.
+ */
+
+const char* pathname = "DATA1";
+char log_path[] = "bench_log.data";
+char logmsg_path[] = "bench_logmsg.txt";
+
+const int64_t num_records = 40000;
+const int num_finds = 100000;
+const int num_buf = 256;
+
+uint64_t rss_kib() {
+  long pages = 0;
+  FILE* fp = fopen("/proc/self/statm", "r");
+  if (fp != NULL) {
+    fscanf(fp, "%*s %ld", &pages);
+    fclose(fp);
+  }
+  return pages * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+// Count the pages of the file that are resident in the OS page cache
+uint64_t page_cache_kib(const char* path) {
+  int fd = open(path, O_RDONLY);
+  off_t size = lseek(fd, 0, SEEK_END);
+  void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+  long os_page_size = sysconf(_SC_PAGESIZE);
+  std::vector<unsigned char> vec((size + os_page_size - 1) / os_page_size);
+  mincore(map, size, vec.data());
+
+  uint64_t resident = 0;
+  for (unsigned char c : vec) {
+    resident += c & 1;
+  }
+
+  munmap(map, size);
+  close(fd);
+  return resident * os_page_size / 1024;
+}
+
+void run(const char* name, int direct_io) {
+  std::string value(MIN_VAL_SIZE, 'a');
+
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+  for (int64_t i = 0; i < num_records; i++) {
+    db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE);
+  }
+  shutdown_db();
+
+  // Start from a cold OS page cache
+  int fd = open(pathname, O_RDONLY);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+
+  file_direct_io = direct_io;
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  table_id = open_table(pathname);
+
+  std::mt19937 gen(2022);
+  std::uniform_int_distribution<int64_t> dist(0, num_records - 1);
+
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_finds; i++) {
+    db_find(table_id, dist(gen), NULL, NULL);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  double seconds = std::chrono::duration<double>(end - begin).count();
+  uint64_t num_hits = buf_count_hits();
+  double hit_ratio = (double)num_hits / (num_hits + buf_count_misses()) * 100;
+  printf("%-10s %10.3f %10.2f %10lu %14lu\n", name, seconds, hit_ratio,
+         rss_kib(), page_cache_kib(pathname));
+
+  shutdown_db();
+  file_direct_io = 0;
+
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+int main() {
+  printf("%-10s %10s %10s %10s %14s\n", "mode", "seconds", "hit %", "RSS KiB",
+         "OS cache KiB");
+  run("buffered", 0);
+  run("O_DIRECT", 1);
+  return 0;
+}
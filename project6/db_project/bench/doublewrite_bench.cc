@@ -0,0 +1,80 @@
+#include "db.h"
+
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <string>
+
+/*
+ * Measures writing back dirty pages scattered over a table: in place with a
+ * sync per page, as torn-page safety required before, and in batches through
+ * the doublewrite file, against the unprotected coalesced checkpoint.
+ */
+
+const char* pathname = "DATA1";
+char log_path[] = "bench_log.data";
+char logmsg_path[] = "bench_logmsg.txt";
+
+const int num_pages = 40000;
+const int num_writes = 10000;
+
+void make_dirty_pages(int64_t table_id) {
+  std::vector<pagenum_t> page_nums;
+  for (int i = 0; i < num_pages; i++) {
+    page_nums.push_back(buf_alloc_page(table_id));
+  }
+  buf_checkpoint();
+
+  std::mt19937 gen(2022);
+  std::shuffle(page_nums.begin(), page_nums.end(), gen);
+  for (int i = 0; i < num_writes; i++) {
+    control_block_t* block = buf_read_page(table_id, page_nums[i]);
+    memset(block->frame->data + 64, i & 0xff, PAGE_SIZE - 64);
+    buf_unpin_block(block, 1);
+  }
+}
+
+double run(const char* name, int mode) {
+  init_db(num_pages + 64, 0, 0, log_path, logmsg_path);
+
+  int64_t table_id = open_table(pathname);
+  make_dirty_pages(table_id);
+
+  auto begin = std::chrono::steady_clock::now();
+
+  if (mode == 0) {
+    file_sync_mode = SYNC_ON_WRITE;
+    for (int p = 0; p < buf_num_partitions; p++) {
+      for (control_block_t* block : buf_partitions[p].blocks) {
+        if (block->is_dirty) {
+          file_write_page(block->table_id, block->page_num, block->frame);
+        }
+      }
+    }
+    file_sync_mode = SYNC_ON_CHECKPOINT;
+  }
+  file_doublewrite = mode == 1;
+  buf_checkpoint();
+
+  auto end = std::chrono::steady_clock::now();
+
+  shutdown_db();
+  file_doublewrite = 0;
+  remove(pathname);
+  remove(DOUBLEWRITE_PATH);
+  remove(log_path);
+  remove(logmsg_path);
+
+  double seconds = std::chrono::duration<double>(end - begin).count();
+  printf("%-24s %10.3f %14.0f\n", name, seconds, num_writes / seconds);
+  return seconds;
+}
+
+int main() {
+  printf("%-24s %10s %14s\n", "write-back", "seconds", "pages/sec");
+  run("synced page by page", 0);
+  run("doublewrite batches", 1);
+  run("unprotected checkpoint", 2);
+
+  return 0;
+}
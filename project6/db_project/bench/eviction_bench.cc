@@ -0,0 +1,65 @@
+#include "db.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+
+/*
+ * Measures update throughput when almost every buf_read_page evicts a dirty
+ * page, once with a sync per written page and once with checkpoint syncs.
+ */
+
+const char* pathname = "DATA1";
+char log_path[] = "bench_log.data";
+char logmsg_path[] = "bench_logmsg.txt";
+
+const int64_t num_records = 20000;
+const int num_updates = 20000;
+const int num_buf = 16;
+
+double run(int sync_mode) {
+  file_sync_mode = sync_mode;
+
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < num_records; i++) {
+    db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE);
+  }
+
+  std::mt19937 gen(2022);
+  std::uniform_int_distribution<int64_t> dist(0, num_records - 1);
+
+  auto begin = std::chrono::steady_clock::now();
+
+  int trx_id = trx_begin();
+  std::string new_value(MIN_VAL_SIZE, 'b');
+  for (int i = 0; i < num_updates; i++) {
+    db_update(table_id, dist(gen), (char*)new_value.c_str(), MIN_VAL_SIZE,
+              NULL, trx_id);
+  }
+  trx_commit(trx_id);
+
+  auto end = std::chrono::steady_clock::now();
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+
+  return std::chrono::duration<double>(end - begin).count();
+}
+
+int main() {
+  double on_write = run(SYNC_ON_WRITE);
+  double on_checkpoint = run(SYNC_ON_CHECKPOINT);
+
+  printf("%-20s %10s %14s\n", "mode", "seconds", "updates/sec");
+  printf("%-20s %10.3f %14.0f\n", "SYNC_ON_WRITE", on_write,
+         num_updates / on_write);
+  printf("%-20s %10.3f %14.0f\n", "SYNC_ON_CHECKPOINT", on_checkpoint,
+         num_updates / on_checkpoint);
+
+  return 0;
+}
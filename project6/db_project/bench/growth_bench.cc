@@ -0,0 +1,57 @@
+#include "db.h"
+
+#include <chrono>
+
+/*
+ * Measures table creation and growth to a target size (in GiB, 2 by default)
+ * with each growth policy.
+ */
+
+const char* pathname = "DATA1";
+char log_path[] = "bench_log.data";
+char logmsg_path[] = "bench_logmsg.txt";
+
+double elapsed_ms(std::chrono::steady_clock::time_point begin) {
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+void run(const char* name, int policy, uint64_t target_pages) {
+  file_growth_policy = policy;
+
+  init_db(64, 0, 0, log_path, logmsg_path);
+
+  auto begin = std::chrono::steady_clock::now();
+  int64_t table_id = open_table(pathname);
+  double create_ms = elapsed_ms(begin);
+
+  begin = std::chrono::steady_clock::now();
+  for (uint64_t i = 1; i < target_pages; i++) {
+    buf_alloc_page(table_id);
+  }
+  buf_checkpoint();
+  double grow_ms = elapsed_ms(begin);
+
+  uint64_t num_pages = file_read_number_of_pages(file_find_fd(table_id));
+  printf("%-20s %12.3f %12.3f %12lu\n", name, create_ms, grow_ms,
+         num_pages * PAGE_SIZE >> 20);
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+int main(int argc, char** argv) {
+  uint64_t target_gib = argc > 1 ? atoi(argv[1]) : 2;
+  uint64_t target_pages = (target_gib << 30) / PAGE_SIZE;
+
+  printf("%-20s %12s %12s %12s\n", "policy", "create ms", "grow ms",
+         "file MiB");
+  run("GROWTH_DOUBLING", GROWTH_DOUBLING, target_pages);
+
+  file_extent_size = (256 << 20) / PAGE_SIZE;
+  run("GROWTH_FIXED_EXTENT", GROWTH_FIXED_EXTENT, target_pages);
+
+  return 0;
+}
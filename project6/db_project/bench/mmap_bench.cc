@@ -0,0 +1,65 @@
+#include "db.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+
+/*
+ * Measures point lookups on a clean table, read through the buffer pool and
+ * read through the mapped table file.
+ */
+
+const char* pathname = "DATA1";
+char log_path[] = "bench_log.data";
+char logmsg_path[] = "bench_logmsg.txt";
+
+const int64_t num_records = 100000;
+const int num_finds = 1000000;
+const int num_buf = 4096;
+
+double run(int mmap_reads) {
+  file_mmap_reads = mmap_reads;
+
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < num_records; i++) {
+    db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE);
+  }
+  buf_checkpoint();
+
+  std::mt19937 gen(2022);
+  std::uniform_int_distribution<int64_t> dist(0, num_records - 1);
+
+  char ret_val[MAX_VAL_SIZE];
+  uint16_t val_size;
+
+  auto begin = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < num_finds; i++) {
+    db_find(table_id, dist(gen), ret_val, &val_size);
+  }
+
+  auto end = std::chrono::steady_clock::now();
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+
+  return std::chrono::duration<double>(end - begin).count();
+}
+
+int main() {
+  double buffered = run(0);
+  double mapped = run(1);
+  file_mmap_reads = 0;
+
+  printf("%-20s %10s %14s\n", "read path", "seconds", "finds/sec");
+  printf("%-20s %10.3f %14.0f\n", "buffer pool", buffered,
+         num_finds / buffered);
+  printf("%-20s %10.3f %14.0f\n", "mapping", mapped, num_finds / mapped);
+
+  return 0;
+}
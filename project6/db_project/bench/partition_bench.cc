@@ -0,0 +1,82 @@
+#include "db.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Runs read-only random lookups over a table that fits in the buffer, from 1
+ * to 64 threads, once with a single buffer partition and once with the
+ * default number of them.
+ */
+
+const char* pathname = "DATA1";
+char log_path[] = "bench_log.data";
+char logmsg_path[] = "bench_logmsg.txt";
+
+const int64_t num_records = 100000;
+const int num_finds = 200000;  // per thread
+const int num_buf = 8192;
+
+void find_records(int64_t table_id, int seed) {
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int64_t> dist(0, num_records - 1);
+  for (int i = 0; i < num_finds; i++) {
+    db_find(table_id, dist(gen), NULL, NULL);
+  }
+}
+
+double run(int num_partitions, int num_threads) {
+  buf_max_partitions = num_partitions;
+
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+
+  // Every page is read into the buffer before the clock starts
+  for (int64_t i = 0; i < num_records; i++) {
+    db_find(table_id, i, NULL, NULL);
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back(find_records, table_id, i);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  auto end = std::chrono::steady_clock::now();
+
+  shutdown_db();
+
+  double seconds = std::chrono::duration<double>(end - begin).count();
+  return (double)num_threads * num_finds / seconds;
+}
+
+int main() {
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < num_records; i++) {
+    db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE);
+  }
+  shutdown_db();
+
+  printf("%-10s %16s %16s\n", "threads", "1 partition", "partitioned");
+  for (int num_threads = 1; num_threads <= 64; num_threads *= 2) {
+    double single = run(1, num_threads);
+    double partitioned = run(DEFAULT_NUM_PARTITIONS, num_threads);
+    printf("%-10d %16.0f %16.0f\n", num_threads, single, partitioned);
+  }
+
+  buf_max_partitions = DEFAULT_NUM_PARTITIONS;
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+
+  return 0;
+}
@@ -0,0 +1,68 @@
+#include "db.h"
+
+#include <chrono>
+#include <string>
+
+/*
+ * Measures a full range scan from a cold buffer, with table files opened with
+ * O_DIRECT so that every leaf is read from the device, for a few read-ahead
+ * windows.
+ */
+
+const char* pathname = "DATA1";
+char log_path[] = "bench_log.data";
+char logmsg_path[] = "bench_logmsg.txt";
+
+const int64_t num_records = 200000;
+const int num_buf = 8192;
+
+double run(int window) {
+  buf_read_ahead_window = window;
+
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+
+  std::vector<int64_t> keys;
+  std::vector<char*> values;
+  std::vector<uint16_t> val_sizes;
+
+  auto begin = std::chrono::steady_clock::now();
+
+  db_scan(table_id, 0, num_records - 1, &keys, &values, &val_sizes);
+
+  auto end = std::chrono::steady_clock::now();
+
+  for (char* value : values) {
+    delete[] value;
+  }
+
+  shutdown_db();
+
+  return std::chrono::duration<double>(end - begin).count();
+}
+
+int main() {
+  file_direct_io = 1;
+
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < num_records; i++) {
+    db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE);
+  }
+
+  shutdown_db();
+
+  printf("%-20s %10s %14s\n", "window", "seconds", "records/sec");
+  for (int window : {0, 8, 32, 128}) {
+    double seconds = run(window);
+    printf("%-20d %10.3f %14.0f\n", window, seconds, num_records / seconds);
+  }
+
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+
+  return 0;
+}
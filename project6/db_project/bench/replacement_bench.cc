@@ -0,0 +1,83 @@
+#include "db.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+
+/*
+ * Runs skewed random lookups, with a scan of the whole table now and then,
+ * over a table four times larger than the buffer, and reports the time and
+ * hit ratio of each replacement policy.
+ */
+
+const char* pathname = "DATA1";
+char log_path[] = "bench_log.data";
+char logmsg_path[] = "bench_logmsg.txt";
+
+const int64_t num_records = 100000;
+const int num_finds = 400000;
+const int scan_interval = 100000;
+const int num_buf = 512;
+
+void run(int policy) {
+  buf_replacement_policy = policy;
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+
+  // Nine in ten lookups go to a tenth of the keys
+  std::mt19937 gen(2022);
+  std::uniform_int_distribution<int64_t> hot(0, num_records / 10 - 1);
+  std::uniform_int_distribution<int64_t> all(0, num_records - 1);
+  std::uniform_int_distribution<int> coin(0, 9);
+
+  uint64_t num_hits = buf_count_hits();
+  uint64_t num_misses = buf_count_misses();
+
+  auto begin = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < num_finds; i++) {
+    if (i % scan_interval == scan_interval - 1) {
+      std::vector<int64_t> keys;
+      std::vector<char*> values;
+      std::vector<uint16_t> val_sizes;
+      db_scan(table_id, 0, num_records - 1, &keys, &values, &val_sizes);
+      for (char* value : values) {
+        delete[] value;
+      }
+    }
+    db_find(table_id, coin(gen) == 0 ? all(gen) : hot(gen), NULL, NULL);
+  }
+
+  auto end = std::chrono::steady_clock::now();
+
+  num_hits = buf_count_hits() - num_hits;
+  num_misses = buf_count_misses() - num_misses;
+
+  double seconds = std::chrono::duration<double>(end - begin).count();
+  printf("%-10s %10.3f %10.2f\n", policies[policy].name, seconds,
+         (double)num_hits / (num_hits + num_misses) * 100);
+
+  shutdown_db();
+}
+
+int main() {
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < num_records; i++) {
+    db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE);
+  }
+  shutdown_db();
+
+  printf("%-10s %10s %10s\n", "policy", "seconds", "hit ratio");
+  for (int policy = 0; policy < NUM_POLICIES; policy++) {
+    run(policy);
+  }
+
+  buf_replacement_policy = POLICY_LRU;
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+
+  return 0;
+}
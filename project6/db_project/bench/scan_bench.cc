@@ -0,0 +1,108 @@
+#include "db.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+
+/*
+ * Runs random lookups and updates over a tenth of a table four times larger
+ * than the buffer, with a scan of the whole table now and then, and reports
+ * the time and the hit ratio of the lookups and updates alone, with and
+ * without access hints, for each replacement policy.
+ */
+
+const char* pathname = "DATA1";
+char log_path[] = "bench_log.data";
+char logmsg_path[] = "bench_logmsg.txt";
+
+const int64_t num_records = 100000;
+const int num_ops = 400000;
+const int scan_interval = 10000;
+const int num_buf = 512;
+
+void run(int policy, int use_hints) {
+  buf_replacement_policy = policy;
+  buf_use_access_hints = use_hints;
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+
+  // One in ten operations is an update, which keeps the table read through
+  // the buffer
+  std::mt19937 gen(2022);
+  std::uniform_int_distribution<int64_t> hot(0, num_records / 10 - 1);
+  std::uniform_int_distribution<int> coin(0, 9);
+  std::string value(MIN_VAL_SIZE, 'b');
+  uint16_t old_val_size;
+
+  uint64_t num_hits = 0;
+  uint64_t num_misses = 0;
+  uint64_t hits = buf_count_hits();
+  uint64_t misses = buf_count_misses();
+
+  auto begin = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < num_ops; i++) {
+    // Scans are left out of the hit ratio
+    if (i % scan_interval == scan_interval - 1) {
+      num_hits += buf_count_hits() - hits;
+      num_misses += buf_count_misses() - misses;
+
+      std::vector<int64_t> keys;
+      std::vector<char*> values;
+      std::vector<uint16_t> val_sizes;
+      db_scan(table_id, 0, num_records - 1, &keys, &values, &val_sizes);
+      for (char* scanned : values) {
+        delete[] scanned;
+      }
+
+      hits = buf_count_hits();
+      misses = buf_count_misses();
+    }
+
+    int64_t key = hot(gen);
+    if (coin(gen) == 0) {
+      int trx_id = trx_begin();
+      db_update(table_id, key, (char*)value.c_str(), MIN_VAL_SIZE,
+                &old_val_size, trx_id);
+      trx_commit(trx_id);
+    } else {
+      db_find(table_id, key, NULL, NULL);
+    }
+  }
+
+  auto end = std::chrono::steady_clock::now();
+
+  num_hits += buf_count_hits() - hits;
+  num_misses += buf_count_misses() - misses;
+
+  double seconds = std::chrono::duration<double>(end - begin).count();
+  printf("%-10s %-6s %10.3f %10.2f\n", policies[policy].name,
+         use_hints ? "on" : "off", seconds,
+         (double)num_hits / (num_hits + num_misses) * 100);
+
+  shutdown_db();
+}
+
+int main() {
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < num_records; i++) {
+    db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE);
+  }
+  shutdown_db();
+
+  printf("%-10s %-6s %10s %10s\n", "policy", "hints", "seconds", "hit ratio");
+  for (int policy = 0; policy < NUM_POLICIES; policy++) {
+    run(policy, 0);
+    run(policy, 1);
+  }
+
+  buf_replacement_policy = POLICY_LRU;
+  buf_use_access_hints = 1;
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+
+  return 0;
+}
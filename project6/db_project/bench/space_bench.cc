@@ -0,0 +1,84 @@
+#include "db.h"
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <string>
+
+/*
+ * Measures many small tables (1000 by default) kept as a file each and as
+ * segments of one tablespace: creating them with a few records each, the
+ * checkpoint syncing them, and their disk footprint.
+ */
+
+const char* space_path = "bench_space.data";
+char log_path[] = "bench_log.data";
+char logmsg_path[] = "bench_logmsg.txt";
+
+const int num_records = 16;  // per table
+
+double elapsed(std::chrono::steady_clock::time_point begin) {
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - begin).count();
+}
+
+uint64_t disk_usage(const char* pathname) {
+  struct stat st;
+  if (stat(pathname, &st) < 0) {
+    return 0;
+  }
+  return st.st_blocks * 512;
+}
+
+void run(const char* name, const char* tablespace, int num_tables) {
+  space_pathname = tablespace;
+
+  init_db(4096, 0, 0, log_path, logmsg_path);
+
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_tables; i++) {
+    std::string pathname = "DATA" + std::to_string(i + 1);
+    int64_t table_id = open_table(pathname.c_str());
+    for (int64_t key = 0; key < num_records; key++) {
+      db_insert(table_id, key, "small table record", 18);
+    }
+  }
+  double create_seconds = elapsed(begin);
+
+  begin = std::chrono::steady_clock::now();
+  buf_checkpoint();
+  double checkpoint_seconds = elapsed(begin);
+
+  shutdown_db();
+
+  uint64_t footprint = 0;
+  if (tablespace != NULL) {
+    footprint = disk_usage(tablespace);
+    remove(tablespace);
+  }
+  for (int i = 0; i < num_tables; i++) {
+    std::string pathname = "DATA" + std::to_string(i + 1);
+    footprint += disk_usage(pathname.c_str());
+    remove(pathname.c_str());
+  }
+  remove(log_path);
+  remove(logmsg_path);
+
+  printf("%-20s %12.3f %14.3f %12lu\n", name, create_seconds,
+         checkpoint_seconds, footprint >> 20);
+}
+
+int main(int argc, char** argv) {
+  int num_tables = argc > 1 ? atoi(argv[1]) : 1000;
+  if (num_tables > MAX_NUM_TABLE - 1) {
+    num_tables = MAX_NUM_TABLE - 1;
+  }
+
+  printf("%-20s %12s %14s %12s\n", "layout", "create sec", "checkpoint sec",
+         "disk MiB");
+  run("file per table", NULL, num_tables);
+  run("tablespace", space_path, num_tables);
+
+  space_pathname = NULL;
+  return 0;
+}
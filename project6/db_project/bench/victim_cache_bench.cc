@@ -0,0 +1,88 @@
+#include "db.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+
+/*
+ * Runs random lookups and updates over a third of a table four times larger
+ * than the buffer, and reports the time, the hit ratio and the misses read
+ * from the victim cache, without one, with one and with a buffer taking the
+ * memory of the cache instead.
+ */
+
+const char* pathname = "DATA1";
+char log_path[] = "bench_log.data";
+char logmsg_path[] = "bench_logmsg.txt";
+
+const int64_t num_records = 100000;
+const int num_ops = 400000;
+const int num_buf = 512;
+const size_t cache_size = 1024 * 1024;
+
+void run(const char* name, int num_frames, size_t victim_cache_size) {
+  buf_victim_cache_size = victim_cache_size;
+  init_db(num_frames, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+
+  // One in ten operations is an update, which keeps the table read through
+  // the buffer
+  std::mt19937 gen(2022);
+  std::uniform_int_distribution<int64_t> dist(0, num_records / 3 - 1);
+  std::uniform_int_distribution<int> coin(0, 9);
+  std::string value(MIN_VAL_SIZE, 'b');
+  uint16_t old_val_size;
+
+  buf_stats_t begin_stats;
+  buf_get_stats(&begin_stats);
+
+  auto begin = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < num_ops; i++) {
+    if (coin(gen) == 0) {
+      int trx_id = trx_begin();
+      db_update(table_id, dist(gen), (char*)value.c_str(), MIN_VAL_SIZE,
+                &old_val_size, trx_id);
+      trx_commit(trx_id);
+    } else {
+      db_find(table_id, dist(gen), NULL, NULL);
+    }
+  }
+
+  auto end = std::chrono::steady_clock::now();
+
+  buf_stats_t stats;
+  buf_get_stats(&stats);
+  uint64_t num_hits = stats.num_hits - begin_stats.num_hits;
+  uint64_t num_misses = stats.num_misses - begin_stats.num_misses;
+
+  double seconds = std::chrono::duration<double>(end - begin).count();
+  printf("%-14s %10.3f %10.2f %12lu\n", name, seconds,
+         (double)num_hits / (num_hits + num_misses) * 100,
+         stats.num_victim_hits - begin_stats.num_victim_hits);
+
+  shutdown_db();
+}
+
+int main() {
+  init_db(num_buf, 0, 0, log_path, logmsg_path);
+  int64_t table_id = open_table(pathname);
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < num_records; i++) {
+    db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE);
+  }
+  shutdown_db();
+
+  printf("%-14s %10s %10s %12s\n", "buffer", "seconds", "hit ratio",
+         "victim hits");
+  run("plain", num_buf, 0);
+  run("victim cache", num_buf, cache_size);
+  run("larger", num_buf + cache_size / PAGE_SIZE, 0);
+
+  buf_victim_cache_size = 0;
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+
+  return 0;
+}
@@ -0,0 +1,94 @@
+#ifndef DB_AIO_H_
+#define DB_AIO_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// REQUEST TYPES.
+
+#define AIO_READ (0)
+#define AIO_WRITE (1)
+#define AIO_TASK (2)
+// A write of buf, an array of length iovecs, at offset
+#define AIO_WRITEV (3)
+
+// BACKENDS.
+
+#define AIO_THREAD_POOL (0)
+#define AIO_IO_URING (1)
+
+#define DEFAULT_AIO_QUEUE_DEPTH (128)
+#define DEFAULT_AIO_NUM_THREADS (4)
+
+// How long the reaper sleeps between polls of the ring once waiting on it
+// has failed
+#define AIO_POLL_INTERVAL_US (100)
+
+// TYPES.
+
+// Called with the number of bytes transferred, or a negative errno
+typedef void (*aio_callback_t)(void* arg, int result);
+
+struct aio_request_t {
+  int type;
+  int fd;
+  void* buf;
+  uint32_t length;
+  off_t offset;
+  aio_callback_t callback;
+  void* arg;
+  aio_request_t* next;
+};
+
+struct aio_future_t {
+  pthread_mutex_t latch;
+  pthread_cond_t cond;
+  int done;
+  int result;
+};
+
+// GLOBALS.
+
+// The backend preferred at aio_init() and the one actually running
+extern int aio_backend;
+extern int aio_active_backend;
+
+extern int aio_queue_depth;
+extern int aio_num_threads;
+
+// APIs.
+
+// Fails only if no worker thread could be started
+int aio_init();
+int aio_shutdown();
+
+// Queue a read or write, or run a task(AIO_TASK) on a worker thread
+int aio_submit(int type,
+               int fd,
+               void* buf,
+               uint32_t length,
+               off_t offset,
+               aio_callback_t callback,
+               void* arg);
+int aio_submit_task(aio_callback_t task, void* arg);
+
+// Wait until every request submitted so far has completed
+void aio_drain();
+
+void aio_future_init(aio_future_t* future);
+void aio_future_complete(void* future, int result);
+int aio_future_wait(aio_future_t* future);
+
+// Utilities.
+
+void aio_execute(aio_request_t* request);
+void aio_complete(aio_request_t* request, int result);
+void* aio_worker(void* arg);
+int aio_uring_init();
+int aio_uring_submit(aio_request_t* request);
+void* aio_uring_reaper(void* arg);
+void aio_uring_shutdown();
+void aio_uring_unmap();
+
+#endif  // DB_AIO_H_
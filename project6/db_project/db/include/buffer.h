@@ -3,37 +3,145 @@
 
 #include <pthread.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <unordered_set>
+#include <vector>
 
 #include "file.h"
 #include "log.h"
+#include "policy.h"
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)  // 2 MiB
+
+#define DEFAULT_READ_AHEAD_WINDOW (32)  // in pages
+
+// The buffer is split into at most this many partitions, of at least
+// MIN_PARTITION_SIZE frames each
+#define DEFAULT_NUM_PARTITIONS (16)
+#define MIN_PARTITION_SIZE (64)
+
+#define CACHE_LINE_SIZE (64)
+
+// Blocks a partition takes beyond its size at most, for readers holding pins
+#define MAX_OVERFLOW_BLOCKS (16)
+
+// Background cleaners keep the blocks a reader would look at for a clean
+// victim clean, and look again this often while there is nothing to write
+#define DEFAULT_NUM_CLEANERS (1)
+#define DEFAULT_CLEAN_TARGET (CLEAN_SEARCH_DEPTH)
+#define CLEANER_INTERVAL_MS (10)
+
+// With warm-up on, the resident pages are dumped to this file at shutdown, and
+// by the first cleaner this often, hottest first. The next init_db reads the
+// dump back, and the pages of each table are reloaded once it is opened.
+#define BUFDUMP_PATH ("BUFDUMP")
+#define DEFAULT_DUMP_INTERVAL_MS (60 * 1000)
+
+// Pages a checkpoint copies before writing them at most
+#define CHECKPOINT_BATCH_PAGES (DOUBLEWRITE_PAGES)
+
+// Children of an internal page at most, after its 128-byte header and
+// leftmost child
+#define MAX_SWIZZLED_CHILDREN ((PAGE_SIZE - 136) / 16 + 1)
+
+// LATCH MODES.
+
+#define LATCH_SHARED (0)
+#define LATCH_EXCLUSIVE (1)
+// A block is only taken for a page not in the buffer yet
+#define LATCH_NONE (2)
+
+// ACCESS HINTS.
+
+// How a thread reads pages. A page read sequentially is loaded as read once,
+// and a sequential reference doesn't make a page any hotter.
+#define ACCESS_RANDOM (0)
+#define ACCESS_SEQUENTIAL (1)
 
 // TYPES.
 
+struct buf_partition_t;
+
 struct control_block_t {
   page_t* frame;
+  buf_partition_t* partition;
   int64_t table_id;
   pagenum_t page_num;
   int is_dirty;
-  pthread_mutex_t page_latch;
+  // Set while a checkpoint writes a copy of the page, which cleaners leave to
+  // it meanwhile. Kept under the partition latch.
+  int is_flushing;
+  // Shared by readers of the page, and held exclusively to change it or to
+  // read it in. Waiting writers go before new readers.
+  pthread_rwlock_t page_latch;
+  // Odd while the page latch is held exclusively. An optimistic reader reads
+  // the frame without the latch, and trusts what it read only if the version
+  // is the same even number before and after.
+  std::atomic<uint64_t> version;
+  // The blocks last found holding the children of an internal page, by child
+  // index. Set by optimistic readers and allocated by the first of them, an
+  // entry is trusted only while the block still holds the child's page.
+  std::atomic<std::atomic<control_block_t*>*> children;
+  // Readers holding or waiting for the page latch. Only a block without any
+  // is replaced.
+  std::atomic<int> pin_count;
+
+  // Replacement state, kept by the policy
+  int referenced;
+  int list;
+  uint64_t history[LRU_K];
   control_block_t* next;
   control_block_t* prev;
 };
 
-struct page_hash_t {
+// A recency list of blocks, most recently used first
+struct buf_list_t {
+  control_block_t* head;
+  control_block_t* tail;
+  size_t size;
+};
+
+// The dirty blocks of a table, in page order, for a flusher task to write
+struct flush_batch_t {
   int64_t table_id;
-  pagenum_t page_num;
+  std::vector<control_block_t*> blocks;
+  // The pages to write, which are the frames or their doublewrite copies
+  std::vector<const page_t*> pages;
+  aio_future_t done;
 };
 
-// GLOBALS.
+// Pages to read into the buffer ahead of their use
+struct prefetch_t {
+  int64_t table_id;
+  std::vector<pagenum_t> pages;
+};
 
-extern std::unordered_map<page_hash_t, control_block_t*> control_block_table;
-extern pthread_mutex_t buffer_manager_latch;
+// Dumped pages of a table, in page order, for a warm-up task to read in
+struct warm_up_t {
+  int64_t table_id;
+  std::vector<pagenum_t> pages;
+};
 
-extern control_block_t* head_block;
-extern control_block_t* tail_block;
+struct page_hash_t {
+  int64_t table_id;
+  pagenum_t page_num;
+};
+
+// A compressed page in a partition's victim cache
+struct victim_entry_t {
+  page_hash_t page;
+  size_t offset;
+  int size;
+};
 
 // OPERATORS.
 
+// Declared ahead of the partitions, whose page tables hash page_hash_t
 bool operator==(const page_hash_t& p1, const page_hash_t& p2);
 
 template <>
@@ -41,6 +149,133 @@ struct std::hash<page_hash_t> {
   std::size_t operator()(page_hash_t const& p) const noexcept;
 };
 
+// The pages hashed to a partition are only ever held by its blocks, which
+// are found, replaced and counted under its latch alone
+struct alignas(CACHE_LINE_SIZE) buf_partition_t {
+  std::unordered_map<page_hash_t, control_block_t*> control_block_table;
+  pthread_mutex_t latch;
+
+  // Pages evicted from a frame whose write-back has not finished yet
+  std::unordered_set<page_hash_t> write_back_table;
+  pthread_cond_t write_back_cond;
+
+  // Every block of the partition, in the order the clock hand sweeps them
+  std::vector<control_block_t*> blocks;
+  size_t clock_hand;
+
+  // Blocks the partition is sized to. It holds more only while readers that
+  // already hold pins need further blocks, and retires them afterwards.
+  size_t num_frames;
+  // Retired blocks and their frames, for the partition to grow into again.
+  // Optimistic readers may still look at them, so they are never freed
+  // before shutdown, but the memory of the frames is given back. A retired
+  // block points at a shared frame of zeros meanwhile.
+  std::vector<control_block_t*> retired_blocks;
+  std::vector<page_t*> spare_frames;
+
+  // Readers wait here while every block is pinned
+  pthread_cond_t free_cond;
+  std::atomic<int> num_waiters;
+
+  // LRU keeps every block in the first list. 2Q keeps the blocks referenced
+  // once there, and the others in the second.
+  buf_list_t lists[2];
+
+  // Counts references, as the time of LRU-K
+  uint64_t clock;
+
+  // Clean pages evicted from the partition, compressed into a ring of bytes.
+  // An image is appended at the head, and dropped once the head wraps over
+  // it. A page is never cached here while it is resident.
+  uint8_t* victim_arena;
+  size_t victim_arena_size;
+  size_t victim_head;
+  std::unordered_map<page_hash_t, victim_entry_t> victim_table;
+  // The images in the order they were appended, some of them dropped already
+  std::deque<victim_entry_t> victim_queue;
+  // Clean victims being compressed without the latch, by the ticket each was
+  // reserved under. Reading the page in again or freeing it cancels its
+  // reservation, so an image older than the page is never cached.
+  std::unordered_map<page_hash_t, uint64_t> victim_reservations;
+  uint64_t victim_ticket;
+
+  uint64_t num_hits;
+  uint64_t num_misses;
+  uint64_t num_waits;
+  uint64_t wait_time_ns;
+  uint64_t num_overflows;
+  uint64_t num_cleaned;
+  uint64_t num_dirty_evictions;
+  uint64_t num_victim_hits;
+};
+
+struct buf_stats_t {
+  uint64_t num_frames;     // blocks in the buffer now
+  uint64_t target_frames;  // blocks the buffer is sized to
+  uint64_t num_hits;
+  uint64_t num_misses;
+  uint64_t num_waits;  // reads that waited for a block to be unpinned
+  uint64_t wait_time_ns;
+  uint64_t num_overflows;  // blocks taken beyond the size
+  uint64_t num_cleaned;    // pages written back by the cleaners
+  uint64_t num_dirty_evictions;  // dirty victims written back by readers
+  uint64_t num_victim_hits;      // misses read from the victim cache
+};
+
+// GLOBALS.
+
+extern buf_partition_t* buf_partitions;
+extern int buf_num_partitions;
+extern int buf_max_partitions;
+
+// The replacement policy to use from the next init_db on, and whether it
+// looks for a clean victim before writing a dirty one back
+extern int buf_replacement_policy;
+extern int buf_prefer_clean;
+extern const policy_t* buf_policy;
+
+// Cleaners started by the next init_db, the blocks at the replacement end of
+// each partition they keep clean, and the pages each of them writes per
+// second at most, if not 0
+extern int buf_num_cleaners;
+extern int buf_clean_target;
+extern int buf_cleaner_max_rate;
+
+// Bytes of compressed clean victims kept in memory, split over the
+// partitions, or 0 for none, from the next init_db on
+extern size_t buf_victim_cache_size;
+
+// Whether access hints are followed, so that scans don't replace the pages
+// of other readers
+extern int buf_use_access_hints;
+
+// The block each page was last found in, by page hash, for optimistic readers
+// to find pages without the partition latch
+extern std::atomic<control_block_t*>* buf_block_hints;
+extern size_t buf_num_block_hints;
+
+extern std::unordered_map<int64_t, std::vector<pagenum_t>> free_page_cache;
+extern pthread_mutex_t free_page_cache_latch;
+
+// Number of buffered pages of each table that are newer than the table file
+extern std::unordered_map<int64_t, std::atomic<int64_t>> num_dirty_pages;
+
+extern page_t* frame_arena;
+extern size_t frame_arena_size;
+extern int buf_use_huge_pages;
+
+// Pages read ahead of a sequential scan at most, and read so far
+extern int buf_read_ahead_window;
+extern std::atomic<uint64_t> buf_num_prefetches;
+
+// Whether the hot pages are dumped and reloaded across restarts, how often
+// they are dumped meanwhile, if not 0, and the pages queued for reloading and
+// read in so far
+extern int buf_warm_up;
+extern int buf_dump_interval_ms;
+extern std::atomic<uint64_t> buf_num_warm_up_pages;
+extern std::atomic<uint64_t> buf_num_warmed_pages;
+
 // FUNCTION PROTOTYPES.
 
 // APIs.
@@ -51,13 +286,92 @@ int buf_shutdown_db();
 pagenum_t buf_alloc_page(int64_t table_id);
 void buf_free_page(int64_t table_id, pagenum_t page_num);
 control_block_t* buf_read_page(int64_t table_id, pagenum_t page_num);
+control_block_t* buf_read_page_shared(int64_t table_id, pagenum_t page_num);
+control_block_t* buf_try_read_page(int64_t table_id, pagenum_t page_num);
+control_block_t* buf_read_page_optimistic(int64_t table_id,
+                                          pagenum_t page_num,
+                                          uint64_t* version);
+bool buf_validate_block(const control_block_t* block, uint64_t version);
+control_block_t* buf_read_child_optimistic(control_block_t* parent,
+                                           int32_t index,
+                                           int64_t table_id,
+                                           pagenum_t page_num,
+                                           uint64_t* version);
 void buf_unpin_block(control_block_t* block, int is_dirty);
+int buf_checkpoint();
+void buf_prefetch_pages(int64_t table_id, const std::vector<pagenum_t>& pages);
+int64_t buf_count_dirty_pages(int64_t table_id);
+uint64_t buf_count_hits();
+uint64_t buf_count_misses();
+void buf_get_stats(buf_stats_t* stats);
+int buf_resize(int num_buf);
+void buf_wake_cleaners();
+int buf_dump_pages();
+int buf_set_access_hint(int hint);
 
 // Utilities.
 
-control_block_t* buf_find_victim();
-void buf_refer_block(control_block_t* block);
+control_block_t* buf_fix_page(int64_t table_id,
+                              pagenum_t page_num,
+                              int mode,
+                              int can_wait);
+void buf_drop_unread_block(control_block_t* block);
+void buf_restore_victim(buf_partition_t* partition,
+                        control_block_t* block,
+                        page_hash_t victim);
+void buf_latch_block(control_block_t* block, int mode);
+void buf_begin_change(control_block_t* block);
+void buf_unlatch_block(control_block_t* block);
+control_block_t* buf_add_block(buf_partition_t* partition);
+uint64_t buf_hash_page(int64_t table_id, pagenum_t page_num);
+void buf_set_block_hint(control_block_t* block);
+bool buf_holds_page(const control_block_t* block,
+                    int64_t table_id,
+                    pagenum_t page_num,
+                    uint64_t* version);
+void buf_drop_pin(control_block_t* block);
+void buf_shrink_partition(buf_partition_t* partition);
+page_t* buf_alloc_frame(buf_partition_t* partition);
+void buf_free_frame(buf_partition_t* partition, page_t* frame);
+buf_partition_t* buf_get_partition(int64_t table_id, pagenum_t page_num);
+void buf_lock_partitions();
+void buf_unlock_partitions();
+control_block_t* buf_find_victim(buf_partition_t* partition);
 void buf_make_block_empty(control_block_t* block);
-control_block_t* buf_make_new_block();
+control_block_t* buf_make_new_block(page_t* frame, buf_partition_t* partition);
+page_t* buf_make_frame_arena(int num_buf);
+bool buf_is_arena_frame(const page_t* frame);
+void buf_release_free_pages();
+int buf_start_cleaners();
+void buf_stop_cleaners();
+void* buf_cleaner(void* arg);
+size_t buf_clean_partition(buf_partition_t* partition);
+bool buf_precedes(const control_block_t* b1, const control_block_t* b2);
+int buf_flush_dirty_blocks(std::vector<page_hash_t> pages);
+control_block_t* buf_pin_dirty_block(page_hash_t page);
+control_block_t* buf_claim_page(int64_t table_id,
+                                pagenum_t page_num,
+                                int mode,
+                                int can_wait,
+                                int* is_miss);
+int buf_flush_blocks(control_block_t* const* blocks,
+                     const page_t* const* pages,
+                     size_t count,
+                     std::vector<control_block_t*>* failed);
+int buf_write_back(int64_t table_id, pagenum_t page_num, const page_t* frame);
+uint64_t buf_reserve_victim(buf_partition_t* partition, page_hash_t victim);
+void buf_cache_victim(buf_partition_t* partition,
+                      page_hash_t victim,
+                      uint64_t ticket,
+                      const page_t* frame);
+int buf_read_cached_victim(buf_partition_t* partition,
+                           int64_t table_id,
+                           pagenum_t page_num,
+                           page_t* frame);
+void buf_flush_batch(void* arg, int result);
+void buf_read_ahead(void* arg, int result);
+void buf_load_dump(size_t max_pages);
+void buf_warm_up_table(int64_t table_id, std::vector<pagenum_t>* pages);
+void buf_reload_pages(void* arg, int result);
 
 #endif  // BUFFER_H_
@@ -0,0 +1,33 @@
+#ifndef DB_CHECKSUM_H_
+#define DB_CHECKSUM_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// CRC32C (Castagnoli), computed with the SSE4.2 crc32 instruction where the
+// CPU has it and with slice-by-8 tables elsewhere.
+
+#define CRC32C_POLY (0x82f63b78)  // reflected
+
+// The instruction takes 3 cycles but issues every cycle, so three strides
+// are checksummed at once and combined. Three of them cover a page but for
+// its checksum and a few bytes.
+#define CHECKSUM_STRIDE (1344)
+
+// APIs.
+
+// Continue the checksum crc of earlier data with size bytes of data. The
+// checksum of no data is 0.
+uint32_t checksum_crc32c(uint32_t crc, const void* data, size_t size);
+
+// Utilities.
+
+void checksum_init();
+uint32_t checksum_shift(uint32_t crc);
+uint32_t checksum_update_sw(uint32_t crc, const uint8_t* p, size_t size);
+uint32_t checksum_update_hw(uint32_t crc, const uint8_t* p, size_t size);
+int checksum_has_hw();
+
+#endif  // DB_CHECKSUM_H_
@@ -0,0 +1,34 @@
+#ifndef DB_COMPRESS_H_
+#define DB_COMPRESS_H_
+
+#include <stdint.h>
+#include <string.h>
+
+// A byte-oriented LZ77 codec in the LZ4 block format. Matches are at least
+// MIN_MATCH bytes long and at most 64 KiB back.
+
+#define MIN_MATCH (4)
+#define LAST_LITERALS (5)
+#define MATCH_FIND_LIMIT (12)
+#define MAX_DISTANCE (65535)
+
+#define HASH_LOG (12)
+#define HASH_SIZE (1 << HASH_LOG)
+
+// APIs.
+
+// Compress size bytes of src into dst. Return the compressed size, or -1 if
+// it would not fit in capacity bytes.
+int compress_block(const uint8_t* src, int size, uint8_t* dst, int capacity);
+
+// Decompress size bytes of src into dst, which holds capacity bytes. Return
+// the decompressed size, or -1 if src is malformed.
+int decompress_block(const uint8_t* src, int size, uint8_t* dst, int capacity);
+
+// Utilities.
+
+uint32_t compress_read32(const uint8_t* p);
+uint32_t compress_hash(uint32_t sequence);
+int compress_write_length(uint8_t** op, const uint8_t* end, int length);
+
+#endif  // DB_COMPRESS_H_
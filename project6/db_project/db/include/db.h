@@ -9,6 +9,15 @@
 #define MIDDLE_OF_PAGE (1984)
 #define THRESHOLD (2500)
 
+// Returned by a read through the mapping that has to use the buffer instead
+#define MAPPED_READ_UNAVAILABLE (1)
+
+// Marks a table whose root has not been read from its header page
+#define ROOT_NOT_CACHED (~(pagenum_t)0)
+
+// Descents without latches tried before the pages are latched on the way
+#define MAX_OPTIMISTIC_RESTARTS (8)
+
 // TYPES.
 
 typedef struct slot_t {
@@ -17,10 +26,23 @@ typedef struct slot_t {
   uint16_t offset;
 } slot_t;
 
+// The leaves read ahead of a scan, and the next one it is expected to visit
+typedef struct read_ahead_t {
+  std::vector<pagenum_t> leaves;
+  size_t next;
+} read_ahead_t;
+
 // GLOBALS.
 
 extern int32_t order;
 
+// The root page number of each table, read from its header page once and
+// kept up to date with every change of the root
+extern std::atomic<pagenum_t> db_roots[MAX_NUM_TABLE];
+
+// Descents restarted since a page on the way changed under them
+extern std::atomic<uint64_t> db_num_descent_restarts;
+
 // FUNCTION PROTOTYPES.
 
 // APIs.
@@ -147,8 +169,35 @@ void db_set_children(page_t* internal,
 
 // Output and utility.
 
+int db_init_roots();
+pagenum_t db_get_root(int64_t table_id);
+void db_set_root(int64_t table_id, page_t* header, pagenum_t root);
 pagenum_t db_find_leaf(int64_t table_id, pagenum_t root, int64_t key);
+int db_find_leaf_optimistic(int64_t table_id,
+                            pagenum_t root,
+                            int64_t key,
+                            pagenum_t* leaf);
+pagenum_t db_find_leaf_latched(int64_t table_id, pagenum_t root, int64_t key);
 int32_t cut(int32_t length);
+void db_read_ahead(int64_t table_id,
+                   pagenum_t parent,
+                   pagenum_t leaf,
+                   read_ahead_t* read_ahead);
+
+// Reads through the mapping.
+
+int db_find_mapped_leaf(int64_t table_id, int64_t key, const page_t** leaf);
+int db_get_mapped_slot(const page_t* leaf, int32_t index, slot_t* slot);
+int db_find_mapped(int64_t table_id,
+                   int64_t key,
+                   char* ret_val,
+                   uint16_t* val_size);
+int db_scan_mapped(int64_t table_id,
+                   int64_t begin_key,
+                   int64_t end_key,
+                   std::vector<int64_t>* keys,
+                   std::vector<char*>* values,
+                   std::vector<uint16_t>* val_sizes);
 
 // Insertion.
 
@@ -156,6 +205,11 @@ slot_t db_make_slot(int64_t key, uint16_t val_size, uint16_t offset);
 pagenum_t db_make_page(int64_t table_id);
 pagenum_t db_make_leaf(int64_t table_id);
 int32_t db_get_left_index(int64_t table_id, pagenum_t parent, pagenum_t left);
+int db_set_parents(int64_t table_id,
+                   const pagenum_t* children,
+                   int32_t num_children,
+                   pagenum_t parent,
+                   pagenum_t old_parent);
 int db_insert_into_leaf(int64_t table_id,
                         pagenum_t leaf,
                         int64_t key,
@@ -191,11 +245,11 @@ int db_start_new_tree(int64_t table_id,
 
 // Deletion.
 
-int32_t db_get_neighbor_index(int64_t table_id, pagenum_t page_num);
-void db_remove_entry_from_leaf(int64_t table_id, pagenum_t leaf, int64_t key);
-void db_remove_entry_from_internal(int64_t table_id,
-                                   pagenum_t internal,
-                                   int64_t key);
+int32_t db_get_neighbor_index(const page_t* parent, pagenum_t page_num);
+int db_remove_entry_from_leaf(int64_t table_id, pagenum_t leaf, int64_t key);
+int db_remove_entry_from_internal(int64_t table_id,
+                                  pagenum_t internal,
+                                  int64_t key);
 int db_adjust_root(int64_t table_id, pagenum_t root);
 int db_coalesce_leafs(int64_t table_id,
                       pagenum_t root,
@@ -1,11 +1,26 @@
 #ifndef DB_FILE_H_
 #define DB_FILE_H_
 
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <unordered_map>
+#include <vector>
+
+#include "aio.h"
+#include "checksum.h"
+#include "compress.h"
+#include "space.h"
 
 // These definitions are not requirements.
 // You may build your own way to handle the constants.
@@ -13,18 +28,203 @@
 #define PAGE_SIZE (4 * 1024)                     // 4 KiB
 
 #define FILE_PREFIX ("DATA")
-#define MAX_NUM_TABLE (20)
+// The ids of the tables not named by FILE_PREFIX, a line "<id> <path>" each
+#define CATALOG_PATH ("CATALOG")
+#define MAX_NUM_TABLE (4096)
+#define DEFAULT_MAX_OPEN_FILES (256)
 #define DEFAULT_FILE_MODE (00644)
 #define MAGIC_NUM (2022)
 
+// SYNC MODES.
+
+#define SYNC_ON_WRITE (0)
+#define SYNC_ON_CHECKPOINT (1)
+
+// GROWTH POLICIES.
+
+#define GROWTH_DOUBLING (0)
+#define GROWTH_FIXED_EXTENT (1)
+
+#define DEFAULT_EXTENT_SIZE (INITIAL_DB_FILE_SIZE / PAGE_SIZE)  // in pages
+
+#define FILE_MAP_RESERVE (16ULL * 1024 * 1024 * 1024)  // 16 GiB
+
+// PAGE FORMATS.
+
+#define PAGE_FORMAT_RAW (0)
+#define PAGE_FORMAT_COMPRESSED (1)
+
+// Pages of a compressed table are packed into slots of whole sectors
+#define SECTOR_SIZE (512)
+#define SECTORS_PER_PAGE (PAGE_SIZE / SECTOR_SIZE)
+#define PAGE_MAP_SUFFIX (".pmap")
+
+// CHECKSUM MODES.
+
+#define CHECKSUM_OFF (0)
+#define CHECKSUM_ON_READ (1)
+#define CHECKSUM_LAZY (2)
+
+// Every page keeps the CRC32C of the rest of it next to its page LSN, and
+// flags after it. Any checksum is a valid one, so a stamped page is told by
+// its flag, and a page never stamped is not verified.
+#define PAGE_CHECKSUM_OFFSET (40)
+#define PAGE_FLAGS_OFFSET (44)
+#define PAGE_FLAG_STAMPED (1)
+
+// DOUBLEWRITE.
+
+// Written-back pages are first copied to the doublewrite file in batches.
+// Its first page holds the batch size and the next ones the page of each
+// copy, which follow them.
+#define DOUBLEWRITE_PATH ("DBLWR")
+#define DOUBLEWRITE_MAGIC_NUM (2023)
+#define DOUBLEWRITE_PAGES (1024)  // copies in a batch at most
+#define DOUBLEWRITE_ENTRY_SIZE (16)
+#define DOUBLEWRITE_HEADER_PAGES \
+  (1 + DOUBLEWRITE_PAGES * DOUBLEWRITE_ENTRY_SIZE / (4 * 1024))
+
 typedef uint64_t pagenum_t;
 
-struct page_t {
+// Aligned to its size so that any page can be the buffer of an O_DIRECT I/O
+struct alignas(PAGE_SIZE) page_t {
   // in-memory page structure
   uint8_t data[PAGE_SIZE];
 };
 
-extern std::unordered_map<int64_t, int> fd_table;
+// A shared, read-only mapping of a table file. Its address range is reserved
+// up front, so the mapping grows in place as the file grows.
+struct file_map_t {
+  uint8_t* addr;
+  std::atomic<uint64_t> number_of_pages;
+  pthread_mutex_t latch;
+  // Page writes to the file started and finished so far
+  std::atomic<uint64_t> num_writes_started;
+  std::atomic<uint64_t> num_writes_finished;
+};
+
+// Where the pages of a compressed table live. An entry packs the first
+// sector of the page's slot, the number of sectors and whether the page is
+// stored uncompressed; 0 means the page was never written. A slot given up
+// by a rewrite is only reused once a checkpoint has persisted the entries
+// without it, so the table file always holds the pages of the last one.
+struct page_map_t {
+  std::vector<uint64_t> entries;
+  std::vector<uint64_t> free_slots[SECTORS_PER_PAGE + 1];
+  std::vector<uint64_t> released_slots;
+  uint64_t end_sector;
+  pthread_mutex_t latch;
+};
+
+// A table registered in this process. Its id indexes table_descs, and its
+// file may be closed and reopened under it at any time.
+struct table_desc_t {
+  std::string pathname;
+  // -1 while the file is closed
+  std::atomic<int> fd{-1};
+  // Threads between file_acquire_fd() and file_release_fd()
+  std::atomic<int> num_users{0};
+  std::atomic<uint64_t> last_used{0};
+  file_map_t* map = NULL;
+  // NULL unless the table is compressed
+  page_map_t* page_map = NULL;
+  // NULL unless the table is kept in the tablespace, whose descriptor it
+  // shares
+  segment_t* segment = NULL;
+};
+
+// An asynchronous page I/O, which holds the table's descriptor until it ends
+struct file_aio_t {
+  int64_t table_id;
+  aio_callback_t callback;
+  void* arg;
+  // AIO_READ or AIO_WRITE, for a compressed table, whose pages are read on
+  // the spot and written by a task
+  int type;
+  pagenum_t pagenum;
+  page_t* page;
+  // The stamped copy of the page being written, if it is stamped
+  page_t* stamped;
+};
+
+struct file_aio_batch_t;
+
+// A run of the pages of a batch that is consecutive in the file as well,
+// written with one request
+struct file_aio_run_t {
+  file_aio_batch_t* batch;
+  int first;
+  int count;
+  off_t offset;
+};
+
+// Asynchronous writes of consecutive pages, which holds the table's
+// descriptor until the last run of them is written
+struct file_aio_batch_t {
+  int64_t table_id;
+  aio_callback_t callback;
+  void* arg;
+  int fd;
+  pagenum_t pagenum;
+  std::vector<page_t> stamped;
+  std::vector<const page_t*> pages;
+  std::vector<struct iovec> iov;
+  std::vector<file_aio_run_t> runs;
+  // Runs not written yet, and one more while they are being submitted
+  std::atomic<int> num_runs;
+  std::atomic<int> result;
+};
+
+extern table_desc_t table_descs[MAX_NUM_TABLE];
+extern std::unordered_map<std::string, int64_t> table_ids;
+extern pthread_mutex_t table_desc_latch;
+
+// Table files kept open at most, closing the least recently used ones, and
+// the tables whose own file is open, in no order
+extern int num_open_files;
+extern int file_max_open_files;
+extern std::vector<int64_t> file_open_tables;
+
+// Ticks of file_acquire_fd(), ordering the table files by their last use
+extern std::atomic<uint64_t> file_clock;
+
+// Whether file_write_page syncs every page or leaves it to checkpoints
+extern int file_sync_mode;
+
+// Syncs of table files, by writes and by file_sync_table_files()
+extern std::atomic<uint64_t> file_num_syncs;
+
+// How a full table file grows: doubling, or by file_extent_size pages
+extern int file_growth_policy;
+extern uint64_t file_extent_size;
+
+// Whether table files are opened with O_DIRECT, bypassing the OS page cache
+extern int file_direct_io;
+
+// Whether table files are also mapped, for reads that skip the buffer pool
+extern int file_mmap_reads;
+
+// The page format of newly created table files
+extern int file_page_format;
+
+// Whether written pages are stamped with a checksum, and which reads verify
+// it: every read, or only the reads of recovery, after which a crash may
+// have left torn pages behind
+extern int file_checksum_mode;
+extern int file_in_recovery;
+
+// Pages read whose checksum did not match
+extern std::atomic<uint64_t> file_num_checksum_failures;
+
+// Whether written-back pages go through the doublewrite file first, which
+// recovery repairs torn pages from
+extern int file_doublewrite;
+extern int file_doublewrite_fd;
+extern pthread_mutex_t file_doublewrite_latch;
+
+// Tables written in place since the copies of their pages were written. The
+// copies are only overwritten once those writes are durable.
+extern std::vector<int64_t> file_doublewrite_tables;
 
 // Open existing database file or create one if it doesn't exist
 int64_t file_open_table_file(const char* pathname);
@@ -35,18 +235,84 @@ pagenum_t file_alloc_page(int64_t table_id);
 // Free an on-disk page to the free page list
 void file_free_page(int64_t table_id, pagenum_t pagenum);
 
-// Read an on-disk page into the in-memory page structure(dest)
-void file_read_page(int64_t table_id, pagenum_t pagenum, struct page_t* dest);
+// Read an on-disk page into the in-memory page structure(dest). Fails if it
+// can not be read or its checksum does not match.
+int file_read_page(int64_t table_id, pagenum_t pagenum, struct page_t* dest);
 
 // Write an in-memory page(src) to the on-disk page
-void file_write_page(int64_t table_id,
+int file_write_page(int64_t table_id,
+                    pagenum_t pagenum,
+                    const struct page_t* src);
+
+// Write count in-memory pages(pages) to consecutive on-disk pages from
+// pagenum on, with as few system calls as possible
+int file_write_pages(int64_t table_id,
                      pagenum_t pagenum,
-                     const struct page_t* src);
+                     const page_t* const* pages,
+                     int count);
+
+// Read an on-disk page into dest without waiting, calling back on completion
+int file_read_page_async(int64_t table_id,
+                         pagenum_t pagenum,
+                         struct page_t* dest,
+                         aio_callback_t callback,
+                         void* arg);
+
+// Write src to the on-disk page without waiting, calling back on completion.
+// The page is made durable by the next file_sync_table_files().
+int file_write_page_async(int64_t table_id,
+                          pagenum_t pagenum,
+                          const struct page_t* src,
+                          aio_callback_t callback,
+                          void* arg);
+
+// Write count in-memory pages(pages) to consecutive on-disk pages from
+// pagenum on without waiting, calling back with 0 once all of them are
+// written or -1 if any failed. The pages are not to change until then.
+int file_write_pages_async(int64_t table_id,
+                           pagenum_t pagenum,
+                           const page_t* const* pages,
+                           int count,
+                           aio_callback_t callback,
+                           void* arg);
 
 // Close the database file
 void file_close_table_files();
 
+// Flush the written pages of every open table file to the disk
+int file_sync_table_files();
+
+// Return the mapped on-disk page, or NULL if it is not mapped
+const page_t* file_get_mapped_page(int64_t table_id, pagenum_t pagenum);
+
+// Take a snapshot of the page writes to the table file, to validate a read
+// through its mapping against. Fails while a page write is in progress.
+int file_begin_mapped_read(int64_t table_id, uint64_t* snapshot);
+
+// Check that no page of the table file was written since the snapshot
+int file_end_mapped_read(int64_t table_id, uint64_t snapshot);
+
+// Return the offset of the on-disk page in the file of the table
+off_t file_page_offset(int64_t table_id, pagenum_t pagenum);
+
+int file_acquire_fd(int64_t table_id);
+void file_release_fd(int64_t table_id);
 int file_find_fd(int64_t table_id);
+int file_open(const char* pathname, int flags);
+
+int64_t file_register_table(const char* pathname);
+int file_load_catalog();
+int file_add_to_catalog(int64_t table_id, const char* pathname);
+int file_open_table_desc(int64_t table_id);
+int file_open_table_path(const char* pathname, int can_create);
+int file_open_segment(int64_t table_id);
+void file_close_lru_file();
+void file_complete_async(void* arg, int result);
+void file_complete_run(void* arg, int result);
+void file_end_batch(file_aio_batch_t* batch);
+
+// Header page fields of a table file, which a table of the tablespace has
+// none of. Its fields are read and written as part of its page 0 instead.
 
 int64_t file_read_magic_number(int fd);
 void file_write_magic_number(int fd, const int64_t magic_number);
@@ -62,6 +328,86 @@ void file_write_next_free_page_number(int fd,
                                       const pagenum_t next,
                                       pagenum_t page_num);
 
-void file_extend_to_end(int fd, pagenum_t last);
+pagenum_t file_read_high_water_mark(int fd);
+void file_write_high_water_mark(int fd, const pagenum_t high_water_mark);
+
+int file_map_table_file(int64_t table_id, int fd);
+void file_unmap_table_files();
+
+int file_allocate_pages(int fd, pagenum_t first, pagenum_t last);
+uint64_t file_get_grown_size(uint64_t number_of_pages);
+uint64_t file_grow_table_file(int fd, uint64_t number_of_pages);
+uint64_t file_grow_table(int64_t table_id, uint64_t number_of_pages);
+
+// Compressed tables.
+
+std::string file_get_page_map_path(int64_t table_id);
+int file_load_page_map(int64_t table_id);
+int file_save_page_map(int64_t table_id, int fd);
+void file_free_page_maps();
+int file_read_compressed_page(page_map_t* page_map,
+                              int fd,
+                              pagenum_t pagenum,
+                              page_t* dest);
+int file_write_compressed_page(page_map_t* page_map,
+                               int fd,
+                               pagenum_t pagenum,
+                               const page_t* src);
+void file_run_compressed_aio(void* arg, int result);
+void file_run_compressed_batch(void* arg, int result);
+uint64_t file_alloc_slot(page_map_t* page_map, int num_sectors);
+
+int file_read_page_format(int fd);
+
+// Page checksums.
+
+uint32_t file_compute_checksum(const page_t* page);
+void file_stamp_checksum(page_t* page);
+int file_verify_checksum(const page_t* page);
+int file_should_verify_checksum();
+const page_t* file_stamp_copy(const page_t* src, page_t* copy);
+
+// Doublewrite.
+
+// Write stamped copies of the pages to the doublewrite file in one write and
+// sync it. The caller then writes the same pages in place and calls
+// file_end_doublewrite(), which lets the next batch begin.
+int file_begin_doublewrite(const int64_t* table_ids,
+                           const pagenum_t* pagenums,
+                           const page_t* const* pages,
+                           int count);
+void file_end_doublewrite();
+
+// Rewrite the pages whose in-place write was torn from their copies
+int file_repair_torn_pages();
+
+int file_open_doublewrite();
+void file_close_doublewrite();
+
+// Header page fields of an in-memory page.
+
+int64_t file_get_magic_number(const page_t* header);
+void file_set_magic_number(page_t* header, const int64_t magic_number);
+
+pagenum_t file_get_first_free_page_number(const page_t* header);
+void file_set_first_free_page_number(page_t* header, const pagenum_t first);
+
+uint64_t file_get_number_of_pages(const page_t* header);
+void file_set_number_of_pages(page_t* header, const uint64_t number_of_pages);
+
+pagenum_t file_get_high_water_mark(const page_t* header);
+void file_set_high_water_mark(page_t* header, const pagenum_t high_water_mark);
+
+int32_t file_get_page_format(const page_t* header);
+void file_set_page_format(page_t* header, const int32_t page_format);
+
+pagenum_t file_get_next_free_page_number(const page_t* page);
+void file_set_next_free_page_number(page_t* page, const pagenum_t next);
+
+uint32_t file_get_checksum(const page_t* page);
+void file_set_checksum(page_t* page, const uint32_t checksum);
+
+uint32_t file_get_page_flags(const page_t* page);
+void file_set_page_flags(page_t* page, const uint32_t flags);
 
 #endif  // DB_FILE_H_
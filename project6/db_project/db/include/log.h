@@ -2,6 +2,7 @@
 #define __LOG_H__
 
 #include <algorithm>
+#include <atomic>
 #include <vector>
 
 #include "trx.h"
@@ -33,6 +34,10 @@ extern int64_t g_lsn;
 extern std::vector<log_t*> log_buffer;
 extern pthread_mutex_t log_buffer_latch;
 
+// Every record that starts before this LSN is durable
+extern std::atomic<int64_t> log_flushed_lsn;
+extern std::atomic<uint64_t> log_num_syncs;
+
 // Getters and setters.
 
 // Default.
@@ -100,9 +105,10 @@ log_t* log_make_update_log(int32_t trx_id,
 log_t* log_make_compensate_log(log_t* update_log);
 
 static void _add(log_t* log);
-void log_add(log_t* log);
+int64_t log_add(log_t* log);
 static void _flush();
 void log_flush();
+void log_flush_until(int64_t lsn);
 void log_add_and_flush(log_t* log);
 
 int log_init_db(char* log_path);
@@ -116,7 +122,7 @@ void log_get_losers(std::set<int32_t>& winners,
                     std::vector<log_t*>& redo_logs,
                     std::vector<log_t*>& undo_logs);
 int log_redo(log_t* log);
-void log_undo(log_t* update_log);
+int log_undo(log_t* update_log);
 std::vector<log_t*> log_trace(int64_t last_lsn);
 int log_recover(int flag, int log_num, char* logmsg_path);
 
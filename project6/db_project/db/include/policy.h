@@ -0,0 +1,117 @@
+#ifndef DB_POLICY_H_
+#define DB_POLICY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Replacement policies of the buffer. Each partition replaces its own blocks,
+// and every policy function is called with the partition latch held.
+
+// REPLACEMENT POLICIES.
+
+#define POLICY_LRU (0)
+#define POLICY_CLOCK (1)
+#define POLICY_2Q (2)
+#define POLICY_LRU_K (3)
+#define NUM_POLICIES (4)
+
+// Blocks looked at for a clean victim before a dirty one is taken
+#define CLEAN_SEARCH_DEPTH (32)
+
+// LRU-K replaces the block whose K-th most recent reference is the oldest
+// among a sample of unpinned blocks
+#define LRU_K (2)
+#define LRU_K_SAMPLE_SIZE (8)
+
+// 2Q keeps one in this many blocks for pages referenced only once
+#define A1_SHARE (4)
+
+// LRU keeps the pages read by scans in a list of their own, which is
+// replaced first once it holds more than one in this many blocks
+#define SCAN_SHARE (8)
+
+// TYPES.
+
+struct control_block_t;
+struct buf_partition_t;
+
+struct policy_t {
+  const char* name;
+  // A page was read into the block
+  void (*load)(control_block_t* block);
+  // A page was read into the block by a scan, which reads it only once
+  void (*load_once)(control_block_t* block);
+  // The block's page was found in the buffer
+  void (*refer)(control_block_t* block);
+  // The block's page was freed, so the block is replaced next
+  void (*empty)(control_block_t* block);
+  // Return an unpinned block with its latch held, or NULL. With clean_only,
+  // only a few clean blocks are looked at.
+  control_block_t* (*find_victim)(buf_partition_t* partition, int clean_only);
+  // Append the next unpinned blocks to be replaced, up to count, in the order
+  // they would be, without latching them
+  void (*list_victims)(buf_partition_t* partition,
+                       size_t count,
+                       std::vector<control_block_t*>* blocks);
+};
+
+// GLOBALS.
+
+extern const policy_t policies[NUM_POLICIES];
+
+// APIs.
+
+void policy_lru_load(control_block_t* block);
+void policy_lru_load_once(control_block_t* block);
+void policy_lru_refer(control_block_t* block);
+void policy_lru_empty(control_block_t* block);
+control_block_t* policy_lru_find_victim(buf_partition_t* partition,
+                                        int clean_only);
+void policy_lru_list_victims(buf_partition_t* partition,
+                             size_t count,
+                             std::vector<control_block_t*>* blocks);
+
+void policy_clock_load(control_block_t* block);
+void policy_clock_load_once(control_block_t* block);
+void policy_clock_refer(control_block_t* block);
+void policy_clock_empty(control_block_t* block);
+control_block_t* policy_clock_find_victim(buf_partition_t* partition,
+                                          int clean_only);
+void policy_clock_list_victims(buf_partition_t* partition,
+                               size_t count,
+                               std::vector<control_block_t*>* blocks);
+
+void policy_2q_load(control_block_t* block);
+void policy_2q_refer(control_block_t* block);
+void policy_2q_empty(control_block_t* block);
+control_block_t* policy_2q_find_victim(buf_partition_t* partition,
+                                       int clean_only);
+void policy_2q_list_victims(buf_partition_t* partition,
+                            size_t count,
+                            std::vector<control_block_t*>* blocks);
+
+void policy_lru_k_load(control_block_t* block);
+void policy_lru_k_refer(control_block_t* block);
+void policy_lru_k_empty(control_block_t* block);
+control_block_t* policy_lru_k_find_victim(buf_partition_t* partition,
+                                          int clean_only);
+void policy_lru_k_list_victims(buf_partition_t* partition,
+                               size_t count,
+                               std::vector<control_block_t*>* blocks);
+
+// Utilities.
+
+int policy_try_take(control_block_t* block, int clean_only);
+control_block_t* policy_scan_list(buf_partition_t* partition,
+                                  int list,
+                                  int clean_only);
+void policy_remove(control_block_t* block);
+void policy_push_front(control_block_t* block, int list);
+void policy_push_back(control_block_t* block, int list);
+void policy_list_from_tail(buf_partition_t* partition,
+                           int list,
+                           size_t count,
+                           std::vector<control_block_t*>* blocks);
+
+#endif  // DB_POLICY_H_
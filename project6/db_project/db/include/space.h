@@ -0,0 +1,82 @@
+#ifndef DB_SPACE_H_
+#define DB_SPACE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+#include <vector>
+
+// A tablespace is one file holding the tables as segments of extents. Its
+// header page is followed by the first segment directory page, and the rest
+// of the first extent holds further directory and segment inode pages.
+
+#define SPACE_MAGIC_NUM (2038)
+#define INITIAL_SPACE_SIZE (64 * 1024 * 1024)  // 64 MiB
+#define EXTENT_SIZE (64)                       // in pages
+
+// A directory entry is the name of a table and its first inode page
+#define DIRECTORY_ENTRY_SIZE (64)
+#define MAX_TABLE_NAME_LENGTH (DIRECTORY_ENTRY_SIZE - 8 - 1)
+#define MAX_DIRECTORY_ENTRIES ((4096 - 64) / DIRECTORY_ENTRY_SIZE)
+
+// An inode page lists the first pages of the extents of a segment
+#define MAX_INODE_EXTENTS ((4096 - 16) / 8)
+
+// HEADER FIELDS.
+
+#define SPACE_NUMBER_OF_PAGES (8)
+#define SPACE_NEXT_EXTENT (16)
+#define SPACE_FIRST_DIRECTORY (24)
+#define SPACE_NEXT_METADATA_PAGE (32)
+#define SPACE_METADATA_END (40)
+
+// TYPES.
+
+// The extents of a table, in the order of its page numbers. A grown list
+// replaces the old one, which is kept for readers until the segment is freed.
+struct segment_t {
+  uint64_t first_inode;
+  uint64_t last_inode;
+  std::atomic<const std::vector<uint64_t>*> extents;
+  std::vector<const std::vector<uint64_t>*> retired_extents;
+};
+
+// GLOBALS.
+
+// The tablespace file tables are kept in, or NULL for a file per table
+extern const char* space_pathname;
+extern int space_fd;
+extern pthread_mutex_t space_latch;
+
+// APIs.
+
+// Open the tablespace file, creating it if it doesn't exist
+int space_open();
+void space_close();
+
+// Find the segment of the table, or create it with its header page
+int space_open_segment(const char* name, segment_t** segment);
+void space_free_segment(segment_t* segment);
+
+// Add extents to the segment until it holds new_size pages, and return the
+// number of pages it holds
+uint64_t space_grow_segment(segment_t* segment, uint64_t new_size);
+
+// Return the offset of a page of the segment in the tablespace file
+off_t space_page_offset(const segment_t* segment, uint64_t pagenum);
+
+int space_sync();
+
+// Utilities.
+
+int space_read_page(uint64_t pagenum, void* dest);
+int space_write_page(uint64_t pagenum, const void* src);
+uint64_t space_alloc_extent();
+uint64_t space_alloc_metadata_page();
+segment_t* space_load_segment(uint64_t first_inode);
+segment_t* space_create_segment(const char* name);
+int space_add_directory_entry(const char* name, uint64_t first_inode);
+int space_add_extent(segment_t* segment, uint64_t extent);
+
+#endif  // DB_SPACE_H_
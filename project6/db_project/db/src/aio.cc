@@ -0,0 +1,449 @@
+#include "aio.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// GLOBALS.
+
+int aio_backend = AIO_IO_URING;
+int aio_active_backend = AIO_THREAD_POOL;
+
+int aio_queue_depth = DEFAULT_AIO_QUEUE_DEPTH;
+int aio_num_threads = DEFAULT_AIO_NUM_THREADS;
+
+// Thread pool. It also runs the tasks when io_uring does the I/O.
+
+static pthread_mutex_t aio_queue_latch = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t aio_queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t aio_idle_cond = PTHREAD_COND_INITIALIZER;
+static aio_request_t* aio_queue_head;
+static aio_request_t* aio_queue_tail;
+static int aio_num_pending;
+static int aio_running;
+static pthread_t* aio_workers;
+static int aio_num_workers;
+
+// io_uring, driven through the raw system calls.
+
+static pthread_mutex_t aio_uring_latch = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t aio_uring_cond = PTHREAD_COND_INITIALIZER;
+static int aio_uring_fd = -1;
+static unsigned aio_uring_entries;
+static unsigned aio_uring_inflight;
+static pthread_t aio_uring_thread;
+
+static void* aio_sq_ring;
+static size_t aio_sq_ring_size;
+static void* aio_cq_ring;
+static size_t aio_cq_ring_size;
+static io_uring_sqe* aio_sqes;
+static size_t aio_sqes_size;
+
+static unsigned* aio_sq_head;
+static unsigned* aio_sq_tail;
+static unsigned* aio_sq_mask;
+static unsigned* aio_sq_array;
+static unsigned* aio_cq_head;
+static unsigned* aio_cq_tail;
+static unsigned* aio_cq_mask;
+static io_uring_cqe* aio_cqes;
+
+// APIs.
+
+int aio_init() {
+  if (aio_running) {
+    return 0;
+  }
+
+  aio_running = 1;
+  aio_num_pending = 0;
+  aio_queue_head = NULL;
+  aio_queue_tail = NULL;
+
+  // The pool runs with the workers that could be started
+  aio_workers = new pthread_t[aio_num_threads];
+  aio_num_workers = 0;
+  while (aio_num_workers < aio_num_threads &&
+         pthread_create(&aio_workers[aio_num_workers], NULL, aio_worker,
+                        NULL) == 0) {
+    aio_num_workers++;
+  }
+  if (aio_num_workers == 0) {
+    delete[] aio_workers;
+    aio_workers = NULL;
+    aio_running = 0;
+    return -1;
+  }
+
+  aio_active_backend = AIO_THREAD_POOL;
+  if (aio_backend == AIO_IO_URING && aio_uring_init() == 0) {
+    aio_active_backend = AIO_IO_URING;
+  }
+
+  return 0;
+}
+
+int aio_shutdown() {
+  if (!aio_running) {
+    return 0;
+  }
+
+  aio_drain();
+
+  // The ring is up even if the reaper has turned new requests away from it
+  if (aio_uring_fd >= 0) {
+    aio_uring_shutdown();
+  }
+
+  pthread_mutex_lock(&aio_queue_latch);
+  aio_running = 0;
+  pthread_cond_broadcast(&aio_queue_cond);
+  pthread_mutex_unlock(&aio_queue_latch);
+
+  for (int i = 0; i < aio_num_workers; i++) {
+    pthread_join(aio_workers[i], NULL);
+  }
+  delete[] aio_workers;
+  aio_workers = NULL;
+
+  return 0;
+}
+
+int aio_submit(int type,
+               int fd,
+               void* buf,
+               uint32_t length,
+               off_t offset,
+               aio_callback_t callback,
+               void* arg) {
+  if (!aio_running) {
+    return -1;
+  }
+
+  aio_request_t* request = new aio_request_t;
+  request->type = type;
+  request->fd = fd;
+  request->buf = buf;
+  request->length = length;
+  request->offset = offset;
+  request->callback = callback;
+  request->arg = arg;
+  request->next = NULL;
+
+  pthread_mutex_lock(&aio_queue_latch);
+  aio_num_pending++;
+  pthread_mutex_unlock(&aio_queue_latch);
+
+  // A request the ring refuses, or any once the reaper has given up waiting
+  // on the ring, is done on the spot. Queued behind the tasks, it could wait
+  // on a worker that is waiting for it.
+  if (type != AIO_TASK && aio_uring_fd >= 0) {
+    if (aio_active_backend != AIO_IO_URING || aio_uring_submit(request) != 0) {
+      aio_execute(request);
+    }
+    return 0;
+  }
+
+  pthread_mutex_lock(&aio_queue_latch);
+
+  if (aio_queue_tail == NULL) {
+    aio_queue_head = request;
+  } else {
+    aio_queue_tail->next = request;
+  }
+  aio_queue_tail = request;
+
+  pthread_cond_signal(&aio_queue_cond);
+
+  pthread_mutex_unlock(&aio_queue_latch);
+  return 0;
+}
+
+int aio_submit_task(aio_callback_t task, void* arg) {
+  return aio_submit(AIO_TASK, -1, NULL, 0, 0, task, arg);
+}
+
+void aio_drain() {
+  pthread_mutex_lock(&aio_queue_latch);
+
+  while (aio_num_pending > 0) {
+    pthread_cond_wait(&aio_idle_cond, &aio_queue_latch);
+  }
+
+  pthread_mutex_unlock(&aio_queue_latch);
+}
+
+void aio_future_init(aio_future_t* future) {
+  future->latch = PTHREAD_MUTEX_INITIALIZER;
+  future->cond = PTHREAD_COND_INITIALIZER;
+  future->done = 0;
+  future->result = 0;
+}
+
+void aio_future_complete(void* future, int result) {
+  aio_future_t* f = (aio_future_t*)future;
+  pthread_mutex_lock(&f->latch);
+
+  f->result = result;
+  f->done = 1;
+  pthread_cond_signal(&f->cond);
+
+  pthread_mutex_unlock(&f->latch);
+}
+
+int aio_future_wait(aio_future_t* future) {
+  pthread_mutex_lock(&future->latch);
+
+  while (!future->done) {
+    pthread_cond_wait(&future->cond, &future->latch);
+  }
+  int result = future->result;
+
+  pthread_mutex_unlock(&future->latch);
+  return result;
+}
+
+// Utilities.
+
+void aio_execute(aio_request_t* request) {
+  ssize_t result = 0;
+  if (request->type == AIO_READ) {
+    result = pread(request->fd, request->buf, request->length, request->offset);
+  } else if (request->type == AIO_WRITE) {
+    result =
+        pwrite(request->fd, request->buf, request->length, request->offset);
+  } else if (request->type == AIO_WRITEV) {
+    result = pwritev(request->fd, (const iovec*)request->buf, request->length,
+                     request->offset);
+  }
+  aio_complete(request, result < 0 ? -errno : result);
+}
+
+void aio_complete(aio_request_t* request, int result) {
+  if (request->callback != NULL) {
+    request->callback(request->arg, result);
+  }
+  delete request;
+
+  pthread_mutex_lock(&aio_queue_latch);
+
+  if (--aio_num_pending == 0) {
+    pthread_cond_broadcast(&aio_idle_cond);
+  }
+
+  pthread_mutex_unlock(&aio_queue_latch);
+}
+
+void* aio_worker(void* /* arg */) {
+  while (1) {
+    pthread_mutex_lock(&aio_queue_latch);
+
+    while (aio_queue_head == NULL && aio_running) {
+      pthread_cond_wait(&aio_queue_cond, &aio_queue_latch);
+    }
+    if (aio_queue_head == NULL) {
+      pthread_mutex_unlock(&aio_queue_latch);
+      break;
+    }
+
+    aio_request_t* request = aio_queue_head;
+    aio_queue_head = request->next;
+    if (aio_queue_head == NULL) {
+      aio_queue_tail = NULL;
+    }
+
+    pthread_mutex_unlock(&aio_queue_latch);
+
+    aio_execute(request);
+  }
+  return NULL;
+}
+
+// Set up a ring of aio_queue_depth entries, or fail where io_uring is missing
+// or not permitted so that the thread pool does the I/O instead
+int aio_uring_init() {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  int fd = syscall(__NR_io_uring_setup, aio_queue_depth, &params);
+  if (fd < 0) {
+    return -1;
+  }
+
+  aio_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  aio_cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (aio_cq_ring_size > aio_sq_ring_size) {
+      aio_sq_ring_size = aio_cq_ring_size;
+    }
+    aio_cq_ring_size = aio_sq_ring_size;
+  }
+
+  int prot = PROT_READ | PROT_WRITE;
+  int flags = MAP_SHARED | MAP_POPULATE;
+  aio_sq_ring = mmap(NULL, aio_sq_ring_size, prot, flags, fd, IORING_OFF_SQ_RING);
+  if (aio_sq_ring == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+
+  aio_cq_ring = aio_sq_ring;
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    aio_cq_ring =
+        mmap(NULL, aio_cq_ring_size, prot, flags, fd, IORING_OFF_CQ_RING);
+    if (aio_cq_ring == MAP_FAILED) {
+      munmap(aio_sq_ring, aio_sq_ring_size);
+      close(fd);
+      return -1;
+    }
+  }
+
+  aio_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  aio_sqes =
+      (io_uring_sqe*)mmap(NULL, aio_sqes_size, prot, flags, fd, IORING_OFF_SQES);
+  if (aio_sqes == MAP_FAILED) {
+    if (aio_cq_ring != aio_sq_ring) {
+      munmap(aio_cq_ring, aio_cq_ring_size);
+    }
+    munmap(aio_sq_ring, aio_sq_ring_size);
+    close(fd);
+    return -1;
+  }
+
+  uint8_t* sq = (uint8_t*)aio_sq_ring;
+  aio_sq_head = (unsigned*)(sq + params.sq_off.head);
+  aio_sq_tail = (unsigned*)(sq + params.sq_off.tail);
+  aio_sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+  aio_sq_array = (unsigned*)(sq + params.sq_off.array);
+
+  uint8_t* cq = (uint8_t*)aio_cq_ring;
+  aio_cq_head = (unsigned*)(cq + params.cq_off.head);
+  aio_cq_tail = (unsigned*)(cq + params.cq_off.tail);
+  aio_cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+  aio_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+  aio_uring_fd = fd;
+  aio_uring_entries = params.sq_entries;
+  aio_uring_inflight = 0;
+
+  if (pthread_create(&aio_uring_thread, NULL, aio_uring_reaper, NULL) != 0) {
+    aio_uring_unmap();
+    return -1;
+  }
+
+  return 0;
+}
+
+// Queue one SQE, waiting while the ring is full. A NULL request is a no-op
+// that tells the reaper to exit. Fails if the kernel did not take the SQE,
+// which is then taken back off the ring.
+int aio_uring_submit(aio_request_t* request) {
+  pthread_mutex_lock(&aio_uring_latch);
+
+  while (aio_uring_inflight >= aio_uring_entries) {
+    pthread_cond_wait(&aio_uring_cond, &aio_uring_latch);
+  }
+
+  unsigned tail = *aio_sq_tail;
+  unsigned index = tail & *aio_sq_mask;
+
+  io_uring_sqe* sqe = &aio_sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  if (request == NULL) {
+    sqe->opcode = IORING_OP_NOP;
+  } else {
+    if (request->type == AIO_READ) {
+      sqe->opcode = IORING_OP_READ;
+    } else if (request->type == AIO_WRITE) {
+      sqe->opcode = IORING_OP_WRITE;
+    } else {
+      sqe->opcode = IORING_OP_WRITEV;
+    }
+    sqe->fd = request->fd;
+    sqe->addr = (uint64_t)request->buf;
+    sqe->len = request->length;
+    sqe->off = request->offset;
+  }
+  sqe->user_data = (uint64_t)request;
+
+  aio_sq_array[index] = index;
+  __atomic_store_n(aio_sq_tail, tail + 1, __ATOMIC_RELEASE);
+  aio_uring_inflight++;
+
+  int result;
+  do {
+    result = syscall(__NR_io_uring_enter, aio_uring_fd, 1, 0, 0, NULL, 0);
+  } while (result < 0 && errno == EINTR);
+
+  // The kernel only takes SQEs within io_uring_enter, which is called under
+  // the latch, so the one left over is this one
+  if (__atomic_load_n(aio_sq_head, __ATOMIC_ACQUIRE) != tail + 1) {
+    __atomic_store_n(aio_sq_tail, tail, __ATOMIC_RELEASE);
+    aio_uring_inflight--;
+    pthread_cond_signal(&aio_uring_cond);
+    pthread_mutex_unlock(&aio_uring_latch);
+    return -1;
+  }
+
+  pthread_mutex_unlock(&aio_uring_latch);
+  return 0;
+}
+
+// Complete the requests as their CQEs come. If waiting for them fails, new
+// requests are done on the spot, and the ones in flight are still reaped by
+// polling the ring.
+void* aio_uring_reaper(void* /* arg */) {
+  while (1) {
+    unsigned head = *aio_cq_head;
+    if (head == __atomic_load_n(aio_cq_tail, __ATOMIC_ACQUIRE)) {
+      if (syscall(__NR_io_uring_enter, aio_uring_fd, 0, 1,
+                  IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+          errno != EINTR) {
+        aio_active_backend = AIO_THREAD_POOL;
+        usleep(AIO_POLL_INTERVAL_US);
+      }
+      continue;
+    }
+
+    io_uring_cqe* cqe = &aio_cqes[head & *aio_cq_mask];
+    aio_request_t* request = (aio_request_t*)cqe->user_data;
+    int result = cqe->res;
+    __atomic_store_n(aio_cq_head, head + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&aio_uring_latch);
+    aio_uring_inflight--;
+    pthread_cond_signal(&aio_uring_cond);
+    pthread_mutex_unlock(&aio_uring_latch);
+
+    if (request == NULL) {
+      break;
+    }
+    aio_complete(request, result);
+  }
+  return NULL;
+}
+
+void aio_uring_shutdown() {
+  // Without the no-op, the reaper would not see the ring was drained
+  while (aio_uring_submit(NULL) != 0) {
+    usleep(AIO_POLL_INTERVAL_US);
+  }
+  pthread_join(aio_uring_thread, NULL);
+  aio_uring_unmap();
+}
+
+void aio_uring_unmap() {
+  munmap(aio_sqes, aio_sqes_size);
+  if (aio_cq_ring != aio_sq_ring) {
+    munmap(aio_cq_ring, aio_cq_ring_size);
+  }
+  munmap(aio_sq_ring, aio_sq_ring_size);
+  close(aio_uring_fd);
+  aio_uring_fd = -1;
+}
@@ -2,11 +2,69 @@
 
 // GLOBALS.
 
-std::unordered_map<page_hash_t, control_block_t*> control_block_table;
-pthread_mutex_t buffer_manager_latch;
+buf_partition_t* buf_partitions;
+int buf_num_partitions;
+int buf_max_partitions = DEFAULT_NUM_PARTITIONS;
 
-control_block_t* head_block;
-control_block_t* tail_block;
+int buf_replacement_policy = POLICY_LRU;
+int buf_prefer_clean = 1;
+const policy_t* buf_policy = &policies[POLICY_LRU];
+
+int buf_use_access_hints = 1;
+
+size_t buf_victim_cache_size = 0;
+
+std::atomic<control_block_t*>* buf_block_hints;
+size_t buf_num_block_hints;
+
+std::unordered_map<int64_t, std::vector<pagenum_t>> free_page_cache;
+pthread_mutex_t free_page_cache_latch;
+
+std::unordered_map<int64_t, std::atomic<int64_t>> num_dirty_pages;
+
+page_t* frame_arena;
+size_t frame_arena_size;
+int buf_use_huge_pages = 0;
+
+int buf_read_ahead_window = DEFAULT_READ_AHEAD_WINDOW;
+std::atomic<uint64_t> buf_num_prefetches;
+
+int buf_num_cleaners = DEFAULT_NUM_CLEANERS;
+int buf_clean_target = DEFAULT_CLEAN_TARGET;
+int buf_cleaner_max_rate = 0;
+
+int buf_warm_up = 0;
+int buf_dump_interval_ms = DEFAULT_DUMP_INTERVAL_MS;
+std::atomic<uint64_t> buf_num_warm_up_pages;
+std::atomic<uint64_t> buf_num_warmed_pages;
+
+// Cleaners, woken early by readers that had to write a dirty victim back
+
+static pthread_mutex_t buf_cleaner_latch = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t buf_cleaner_cond = PTHREAD_COND_INITIALIZER;
+static int buf_cleaners_running;
+static int buf_num_running_cleaners;
+static pthread_t* buf_cleaners;
+
+// Held by a checkpoint while it writes the dirty pages back
+static pthread_mutex_t buf_checkpoint_latch = PTHREAD_MUTEX_INITIALIZER;
+
+// The frame of every retired block. An optimistic reader that found the block
+// before it was retired reads zeros here, which never validate, instead of a
+// frame given to another block or to no one.
+static page_t buf_retired_frame;
+
+// Pages read back from the dump by init_db, by table path, until the table is
+// opened. Kept under every partition latch.
+static std::unordered_map<std::string, std::vector<pagenum_t>>
+    buf_dumped_pages;
+
+// Pins held by this thread. A reader holding none can wait for a block
+// without waiting on itself.
+static thread_local int buf_num_pins = 0;
+
+// The access hint of this thread's reads
+static thread_local int buf_access_hint = ACCESS_RANDOM;
 
 // OPERATORS.
 
@@ -26,218 +84,1722 @@ std::size_t std::hash<page_hash_t>::operator()(
 // APIs.
 
 int64_t buf_open_table_file(const char* pathname) {
-  return file_open_table_file(pathname);
+  int64_t table_id = file_open_table_file(pathname);
+  if (table_id < 0) {
+    return table_id;
+  }
+
+  // The counter is created here, so that it is never inserted concurrently
+  std::vector<pagenum_t> pages;
+  buf_lock_partitions();
+  num_dirty_pages[table_id];
+  auto it = buf_dumped_pages.find(pathname);
+  if (it != buf_dumped_pages.end()) {
+    pages.swap(it->second);
+    buf_dumped_pages.erase(it);
+  }
+  buf_unlock_partitions();
+
+  if (!pages.empty()) {
+    buf_warm_up_table(table_id, &pages);
+  }
+  return table_id;
 }
 
 int buf_init_db(int num_buf) {
-  if (num_buf <= 0) {
+  if (num_buf <= 0 || buf_replacement_policy < 0 ||
+      buf_replacement_policy >= NUM_POLICIES) {
     return -1;
   }
+  buf_policy = &policies[buf_replacement_policy];
 
-  buffer_manager_latch = PTHREAD_MUTEX_INITIALIZER;
+  free_page_cache_latch = PTHREAD_MUTEX_INITIALIZER;
 
-  head_block = buf_make_new_block();
+  frame_arena = buf_make_frame_arena(num_buf);
+  if (frame_arena == NULL) {
+    return -1;
+  }
+
+  buf_num_partitions =
+      std::max(1, std::min(buf_max_partitions, num_buf / MIN_PARTITION_SIZE));
+  buf_partitions = new buf_partition_t[buf_num_partitions];
+
+  buf_num_block_hints = 2 * (size_t)num_buf;
+  buf_block_hints = new std::atomic<control_block_t*>[buf_num_block_hints]();
 
-  control_block_t* temp = head_block;
-  for (int i = 1; i < num_buf; i++) {
-    control_block_t* block = buf_make_new_block();
-    temp->next = block;
-    block->prev = temp;
-    temp = block;
+  buf_num_prefetches = 0;
+  buf_num_warm_up_pages = 0;
+  buf_num_warmed_pages = 0;
+
+  buf_dumped_pages.clear();
+  if (buf_warm_up) {
+    buf_load_dump(num_buf);
   }
 
-  tail_block = temp;
+  aio_init();
 
-  return 0;
+  // Each partition takes its share of the arena's frames
+  for (int p = 0; p < buf_num_partitions; p++) {
+    buf_partition_t* partition = &buf_partitions[p];
+    partition->latch = PTHREAD_MUTEX_INITIALIZER;
+    partition->write_back_cond = PTHREAD_COND_INITIALIZER;
+    partition->free_cond = PTHREAD_COND_INITIALIZER;
+    partition->num_waiters = 0;
+    partition->num_hits = 0;
+    partition->num_misses = 0;
+    partition->num_waits = 0;
+    partition->wait_time_ns = 0;
+    partition->num_overflows = 0;
+    partition->num_cleaned = 0;
+    partition->num_dirty_evictions = 0;
+    partition->num_victim_hits = 0;
+    partition->clock_hand = 0;
+    partition->lists[0] = {};
+    partition->lists[1] = {};
+    partition->clock = 0;
+
+    partition->victim_arena_size = buf_victim_cache_size / buf_num_partitions;
+    partition->victim_arena = partition->victim_arena_size > 0
+                                  ? new uint8_t[partition->victim_arena_size]
+                                  : NULL;
+    partition->victim_head = 0;
+    partition->victim_ticket = 0;
+
+    int first = (int64_t)num_buf * p / buf_num_partitions;
+    int last = (int64_t)num_buf * (p + 1) / buf_num_partitions;
+    partition->num_frames = last - first;
+    for (int i = first; i < last; i++) {
+      control_block_t* block = buf_make_new_block(&frame_arena[i], partition);
+      partition->blocks.push_back(block);
+      policy_push_back(block, 0);
+    }
+  }
+
+  return buf_start_cleaners();
 }
 
 int buf_shutdown_db() {
-  control_block_table.clear();
+  buf_stop_cleaners();
 
-  log_flush();
+  // Let the pages still being read ahead land before the frames go away
+  aio_drain();
+  // init_db shuts down first, which must not leave an empty dump behind
+  if (buf_warm_up && buf_partitions != NULL) {
+    buf_dump_pages();
+  }
+  buf_checkpoint();
+
+  num_dirty_pages.clear();
 
-  control_block_t* temp = head_block;
-  while (temp != NULL) {
-    if (temp->is_dirty) {
-      file_write_page(temp->table_id, temp->page_num, temp->frame);
+  for (int p = 0; p < buf_num_partitions; p++) {
+    buf_partition_t* partition = &buf_partitions[p];
+    for (control_block_t* block : partition->blocks) {
+      if (!buf_is_arena_frame(block->frame)) {
+        delete block->frame;
+      }
+      delete[] block->children.load();
+      delete block;
+    }
+    for (control_block_t* block : partition->retired_blocks) {
+      delete[] block->children.load();
+      delete block;
     }
+    for (page_t* frame : partition->spare_frames) {
+      if (!buf_is_arena_frame(frame)) {
+        delete frame;
+      }
+    }
+    delete[] partition->victim_arena;
+  }
+  delete[] buf_partitions;
+  delete[] buf_block_hints;
+  buf_block_hints = NULL;
+  buf_partitions = NULL;
+  buf_num_partitions = 0;
 
-    control_block_t* next = temp->next;
-    delete temp->frame;
-    delete temp;
-    temp = next;
+  if (frame_arena != NULL) {
+    munmap(frame_arena, frame_arena_size);
+    frame_arena = NULL;
   }
-  head_block = NULL;
-  tail_block = NULL;
 
+  aio_shutdown();
   file_close_table_files();
 
   return 0;
 }
 
+// Pages freed since the last checkpoint are handed out again from memory.
+// Otherwise the head of the free page list, or else the page at the
+// high-water mark, is taken through the buffered header page, so allocation
+// never waits on a synchronous write. Returns 0, the header page, if a page
+// on the way can't be read.
 pagenum_t buf_alloc_page(int64_t table_id) {
-  pthread_mutex_lock(&buffer_manager_latch);
+  pthread_mutex_lock(&free_page_cache_latch);
 
-  pagenum_t first;
+  std::vector<pagenum_t>& cache = free_page_cache[table_id];
+  if (!cache.empty()) {
+    pagenum_t page_num = cache.back();
+    cache.pop_back();
+
+    pthread_mutex_unlock(&free_page_cache_latch);
+    return page_num;
+  }
 
-  control_block_t* header_block = control_block_table[{table_id, 0}];
+  pthread_mutex_unlock(&free_page_cache_latch);
+
+  control_block_t* header_block = buf_read_page(table_id, 0);
   if (header_block == NULL) {
-    first = file_alloc_page(table_id);
-  } else {
-    pthread_mutex_lock(&header_block->page_latch);
+    return 0;
+  }
 
-    if (header_block->is_dirty) {
-      log_flush();
-      file_write_page(table_id, 0, header_block->frame);
-      header_block->is_dirty = 0;
+  pagenum_t first = file_get_first_free_page_number(header_block->frame);
+  if (first != 0) {
+    control_block_t* block = buf_read_page(table_id, first);
+    if (block == NULL) {
+      buf_unpin_block(header_block, 0);
+      return 0;
     }
+    pagenum_t next = file_get_next_free_page_number(block->frame);
+    buf_unpin_block(block, 0);
 
-    first = file_alloc_page(table_id);
-    file_read_page(table_id, 0, header_block->frame);
+    file_set_first_free_page_number(header_block->frame, next);
 
-    buf_refer_block(header_block);
+    buf_unpin_block(header_block, 1);
+    return first;
+  }
 
-    pthread_mutex_unlock(&header_block->page_latch);
+  pagenum_t high_water_mark = file_get_high_water_mark(header_block->frame);
+  uint64_t number_of_pages = file_get_number_of_pages(header_block->frame);
+  if (high_water_mark == number_of_pages) {
+    number_of_pages = file_grow_table(table_id, number_of_pages);
+    file_set_number_of_pages(header_block->frame, number_of_pages);
   }
+  file_set_high_water_mark(header_block->frame, high_water_mark + 1);
 
-  pthread_mutex_unlock(&buffer_manager_latch);
-  return first;
+  buf_unpin_block(header_block, 1);
+  return high_water_mark;
 }
 
+// The freed page is dropped from the buffer and kept in memory until the next
+// checkpoint links it into the on-disk free page list.
 void buf_free_page(int64_t table_id, pagenum_t page_num) {
-  pthread_mutex_lock(&buffer_manager_latch);
+  buf_partition_t* partition = buf_get_partition(table_id, page_num);
+  pthread_mutex_lock(&partition->latch);
 
-  control_block_t* block = control_block_table[{table_id, page_num}];
-  if (block != NULL) {
-    control_block_table.erase({table_id, page_num});
+  auto it = partition->control_block_table.find({table_id, page_num});
+  if (it != partition->control_block_table.end()) {
+    control_block_t* block = it->second;
+    partition->control_block_table.erase(it);
     buf_make_block_empty(block);
   }
+  partition->victim_table.erase({table_id, page_num});
+  partition->victim_reservations.erase({table_id, page_num});
 
-  control_block_t* header_block = control_block_table[{table_id, 0}];
-  if (header_block == NULL) {
-    file_free_page(table_id, page_num);
+  pthread_mutex_unlock(&partition->latch);
+
+  pthread_mutex_lock(&free_page_cache_latch);
+
+  free_page_cache[table_id].push_back(page_num);
+
+  pthread_mutex_unlock(&free_page_cache_latch);
+}
+
+// Read the page into the buffer if needed, and return its block pinned and
+// latched. While every block of the partition is pinned by other readers, it
+// waits for one to be unpinned.
+control_block_t* buf_read_page(int64_t table_id, pagenum_t page_num) {
+  return buf_fix_page(table_id, page_num, LATCH_EXCLUSIVE, 1);
+}
+
+// Like buf_read_page, but latch the page in shared mode, for readers that
+// don't change it. The block is unpinned as clean.
+control_block_t* buf_read_page_shared(int64_t table_id, pagenum_t page_num) {
+  return buf_fix_page(table_id, page_num, LATCH_SHARED, 1);
+}
+
+// Like buf_read_page, but return NULL instead of waiting for a block
+control_block_t* buf_try_read_page(int64_t table_id, pagenum_t page_num) {
+  return buf_fix_page(table_id, page_num, LATCH_EXCLUSIVE, 0);
+}
+
+// Return the block holding the page and its version, for reading the frame
+// without latching it. The block is found through the hints, or else the page
+// is read in and latched for a moment. Either way, what is read is only good
+// if buf_validate_block passes afterwards.
+control_block_t* buf_read_page_optimistic(int64_t table_id,
+                                          pagenum_t page_num,
+                                          uint64_t* version) {
+  uint64_t h = buf_hash_page(table_id, page_num);
+  control_block_t* block =
+      buf_block_hints[h % buf_num_block_hints].load(std::memory_order_acquire);
+  if (block != NULL && buf_holds_page(block, table_id, page_num, version)) {
+    return block;
+  }
+
+  block = buf_read_page_shared(table_id, page_num);
+  if (block == NULL) {
+    return NULL;
+  }
+  *version = block->version.load(std::memory_order_relaxed);
+  buf_unpin_block(block, 0);
+  return block;
+}
+
+bool buf_validate_block(const control_block_t* block, uint64_t version) {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return block->version.load(std::memory_order_relaxed) == version;
+}
+
+// Read a child of an internal page read optimistically, going straight to
+// the block the child was last found in. That block is swizzled into the
+// parent's children once found some other way. An entry whose block was
+// replaced since is not trusted, and is overwritten on the next read.
+control_block_t* buf_read_child_optimistic(control_block_t* parent,
+                                           int32_t index,
+                                           int64_t table_id,
+                                           pagenum_t page_num,
+                                           uint64_t* version) {
+  std::atomic<control_block_t*>* children =
+      parent->children.load(std::memory_order_acquire);
+  if (children == NULL) {
+    std::atomic<control_block_t*>* new_children =
+        new std::atomic<control_block_t*>[MAX_SWIZZLED_CHILDREN]();
+    if (parent->children.compare_exchange_strong(children, new_children)) {
+      children = new_children;
+    } else {
+      delete[] new_children;
+    }
+  }
+
+  control_block_t* block = children[index].load(std::memory_order_acquire);
+  if (block != NULL && buf_holds_page(block, table_id, page_num, version)) {
+    return block;
+  }
+
+  block = buf_read_page_optimistic(table_id, page_num, version);
+  if (block != NULL) {
+    children[index].store(block, std::memory_order_release);
+  }
+  return block;
+}
+
+void buf_unpin_block(control_block_t* block, int is_dirty) {
+  if (is_dirty && !block->is_dirty) {
+    block->is_dirty = 1;
+    num_dirty_pages[block->table_id]++;
+  }
+  buf_unlatch_block(block);
+  buf_drop_pin(block);
+}
+
+// Write every dirty page back and sync the table files once each. The dirty
+// pages are listed under every partition latch, once the pending write-backs
+// are done, and written without them.
+int buf_checkpoint() {
+  buf_release_free_pages();
+
+  // A page is written by one checkpoint at a time
+  pthread_mutex_lock(&buf_checkpoint_latch);
+
+  // Evictions only wait on the latch of their own partition, so the pending
+  // write-backs of a partition finish while the earlier ones are held
+  for (int p = 0; p < buf_num_partitions; p++) {
+    buf_partition_t* partition = &buf_partitions[p];
+    pthread_mutex_lock(&partition->latch);
+    while (!partition->write_back_table.empty()) {
+      pthread_cond_wait(&partition->write_back_cond, &partition->latch);
+    }
+  }
+
+  std::vector<page_hash_t> pages;
+  for (int p = 0; p < buf_num_partitions; p++) {
+    for (control_block_t* block : buf_partitions[p].blocks) {
+      if (block->is_dirty) {
+        pages.push_back({block->table_id, block->page_num});
+      }
+    }
+  }
+
+  buf_unlock_partitions();
+
+  int result = buf_flush_dirty_blocks(pages);
+  if (file_sync_table_files() != 0) {
+    result = -1;
+  }
+
+  pthread_mutex_unlock(&buf_checkpoint_latch);
+  return result;
+}
+
+// Write the pages back if they are still dirty, in page order and merged into
+// runs of consecutive pages, a batch of copies at a time. A page is copied
+// with its latch held shared and is clean from then on, unless the write
+// fails. Its block stays pinned until the copy is written, so that it is
+// neither replaced nor written by a cleaner meanwhile. A page latched
+// exclusively is left for a later round, so that the checkpoint waits for a
+// latch only while it holds no other pin.
+int buf_flush_dirty_blocks(std::vector<page_hash_t> pages) {
+  std::sort(pages.begin(), pages.end(),
+            [](const page_hash_t& p1, const page_hash_t& p2) {
+              if (p1.table_id != p2.table_id) {
+                return p1.table_id < p2.table_id;
+              }
+              return p1.page_num < p2.page_num;
+            });
+
+  std::vector<page_t> copies(
+      std::min(pages.size(), (size_t)CHECKPOINT_BATCH_PAGES));
+  int result = 0;
+  while (!pages.empty()) {
+    std::vector<page_hash_t> later;
+    size_t next = 0;
+    while (next < pages.size()) {
+      std::vector<control_block_t*> blocks;
+      std::vector<const page_t*> frames;
+      int64_t page_lsn = 0;
+      for (; next < pages.size() && blocks.size() < copies.size(); next++) {
+        control_block_t* block = buf_pin_dirty_block(pages[next]);
+        if (block == NULL) {
+          continue;
+        }
+        if (blocks.empty()) {
+          pthread_rwlock_rdlock(&block->page_latch);
+        } else if (pthread_rwlock_tryrdlock(&block->page_latch) != 0) {
+          buf_drop_pin(block);
+          later.push_back(pages[next]);
+          continue;
+        }
+
+        page_t* copy = &copies[blocks.size()];
+        memcpy(copy, block->frame, PAGE_SIZE);
+
+        buf_partition_t* partition = block->partition;
+        pthread_mutex_lock(&partition->latch);
+        int is_dirty = block->is_dirty;
+        if (is_dirty) {
+          block->is_dirty = 0;
+          block->is_flushing = 1;
+          num_dirty_pages[block->table_id]--;
+        }
+        pthread_mutex_unlock(&partition->latch);
+        buf_unlatch_block(block);
+
+        if (!is_dirty) {
+          buf_drop_pin(block);
+          continue;
+        }
+        page_lsn = std::max(page_lsn, log_get_page_lsn(copy));
+        blocks.push_back(block);
+        frames.push_back(copy);
+      }
+      if (blocks.empty()) {
+        continue;
+      }
+
+      // The log goes first, as for a victim
+      log_flush_until(page_lsn);
+
+      std::vector<control_block_t*> failed;
+      if (buf_flush_blocks(blocks.data(), frames.data(), blocks.size(),
+                           &failed) != 0) {
+        result = -1;
+      }
+
+      for (control_block_t* block : blocks) {
+        buf_partition_t* partition = block->partition;
+        pthread_mutex_lock(&partition->latch);
+        block->is_flushing = 0;
+        pthread_mutex_unlock(&partition->latch);
+        if (std::find(failed.begin(), failed.end(), block) == failed.end()) {
+          buf_drop_pin(block);
+        }
+      }
+
+      // The pages not written are dirty again, unless a writer has marked
+      // them so already
+      for (control_block_t* block : failed) {
+        pthread_rwlock_rdlock(&block->page_latch);
+        buf_partition_t* partition = block->partition;
+        pthread_mutex_lock(&partition->latch);
+        if (!block->is_dirty) {
+          block->is_dirty = 1;
+          num_dirty_pages[block->table_id]++;
+        }
+        pthread_mutex_unlock(&partition->latch);
+        buf_unlatch_block(block);
+        buf_drop_pin(block);
+      }
+    }
+    pages.swap(later);
+  }
+
+  return result;
+}
+
+// Pin the block holding the page if it is dirty, or return NULL
+control_block_t* buf_pin_dirty_block(page_hash_t page) {
+  buf_partition_t* partition = buf_get_partition(page.table_id, page.page_num);
+  pthread_mutex_lock(&partition->latch);
+
+  control_block_t* block = NULL;
+  auto it = partition->control_block_table.find(page);
+  if (it != partition->control_block_table.end() && it->second->is_dirty) {
+    block = it->second;
+    block->pin_count++;
+    buf_num_pins++;
+  }
+
+  pthread_mutex_unlock(&partition->latch);
+  return block;
+}
+
+// Write the pages of the blocks back through the aio backend, with a task per
+// table file running on the workers unless io_uring does the writes. The
+// pages must not change until they are written. The blocks of the pages not
+// written are added to failed.
+int buf_flush_blocks(control_block_t* const* blocks,
+                     const page_t* const* pages,
+                     size_t count,
+                     std::vector<control_block_t*>* failed) {
+  int doublewrite = file_doublewrite;
+  int result = 0;
+
+  // The copies are stamped, and written in place as they are, so that the
+  // page and its copy match
+  std::vector<page_t> copies;
+  std::vector<const page_t*> sources;
+  if (doublewrite) {
+    copies.resize(count);
+    std::vector<int64_t> table_ids;
+    std::vector<pagenum_t> page_nums;
+    for (size_t i = 0; i < count; i++) {
+      memcpy(&copies[i], pages[i], PAGE_SIZE);
+      file_stamp_checksum(&copies[i]);
+      sources.push_back(&copies[i]);
+      table_ids.push_back(blocks[i]->table_id);
+      page_nums.push_back(blocks[i]->page_num);
+    }
+    // A page without its copy is not written in place, where a torn write
+    // could not be repaired, but left dirty for a later flush
+    if (file_begin_doublewrite(table_ids.data(), page_nums.data(),
+                               sources.data(), count) != 0) {
+      file_end_doublewrite();
+      failed->insert(failed->end(), blocks, blocks + count);
+      return -1;
+    }
+    pages = sources.data();
+  }
+
+  // Through io_uring, every run of consecutive pages is a batch of its own,
+  // and all of them are written at once
+  int by_run = aio_active_backend == AIO_IO_URING;
+  std::vector<flush_batch_t*> batches;
+  for (size_t i = 0; i < count; i++) {
+    control_block_t* block = blocks[i];
+    if (batches.empty() || batches.back()->table_id != block->table_id ||
+        (by_run &&
+         batches.back()->blocks.back()->page_num + 1 != block->page_num)) {
+      flush_batch_t* batch = new flush_batch_t;
+      batch->table_id = block->table_id;
+      aio_future_init(&batch->done);
+      batches.push_back(batch);
+    }
+    batches.back()->blocks.push_back(block);
+    batches.back()->pages.push_back(pages[i]);
+  }
+
+  if (by_run) {
+    for (flush_batch_t* batch : batches) {
+      if (file_write_pages_async(batch->table_id, batch->blocks[0]->page_num,
+                                 batch->pages.data(), batch->pages.size(),
+                                 aio_future_complete, &batch->done) != 0) {
+        buf_flush_batch(batch, 0);
+      }
+    }
   } else {
-    pthread_mutex_lock(&header_block->page_latch);
+    // This thread writes the last batch while the workers write the others
+    for (size_t i = 0; i + 1 < batches.size(); i++) {
+      if (aio_submit_task(buf_flush_batch, batches[i]) != 0) {
+        buf_flush_batch(batches[i], 0);
+      }
+    }
+    buf_flush_batch(batches.back(), 0);
+  }
 
-    if (header_block->is_dirty) {
-      log_flush();
-      file_write_page(table_id, 0, header_block->frame);
-      header_block->is_dirty = 0;
+  for (flush_batch_t* batch : batches) {
+    if (aio_future_wait(&batch->done) != 0) {
+      failed->insert(failed->end(), batch->blocks.begin(),
+                     batch->blocks.end());
+      result = -1;
     }
+    delete batch;
+  }
+
+  if (doublewrite) {
+    file_end_doublewrite();
+  }
 
-    file_free_page(table_id, page_num);
-    file_read_page(table_id, 0, header_block->frame);
+  return result;
+}
 
-    buf_refer_block(header_block);
+void buf_flush_batch(void* arg, int result) {
+  flush_batch_t* batch = (flush_batch_t*)arg;
 
-    pthread_mutex_unlock(&header_block->page_latch);
+  size_t first = 0;
+  while (first < batch->blocks.size()) {
+    size_t last = first + 1;
+    while (last < batch->blocks.size() &&
+           batch->blocks[last]->page_num ==
+               batch->blocks[last - 1]->page_num + 1) {
+      last++;
+    }
+
+    if (file_write_pages(batch->table_id, batch->blocks[first]->page_num,
+                         &batch->pages[first], last - first) != 0) {
+      result = -1;
+    }
+    first = last;
   }
 
-  pthread_mutex_unlock(&buffer_manager_latch);
+  aio_future_complete(&batch->done, result);
 }
 
-control_block_t* buf_read_page(int64_t table_id, pagenum_t page_num) {
-  pthread_mutex_lock(&buffer_manager_latch);
+// Read the pages into the buffer on an aio worker, but those that are there
+// already
+void buf_prefetch_pages(int64_t table_id, const std::vector<pagenum_t>& pages) {
+  prefetch_t* prefetch = new prefetch_t{table_id, {}};
+  for (pagenum_t page_num : pages) {
+    buf_partition_t* partition = buf_get_partition(table_id, page_num);
+    pthread_mutex_lock(&partition->latch);
 
-  control_block_t* block = control_block_table[{table_id, page_num}];
-  if (block == NULL) {
-    block = buf_find_victim();
-    if (block == NULL) {
-      block = buf_make_new_block();
-      head_block->prev = block;
-      block->next = head_block;
-      head_block = block;
+    if (partition->control_block_table.count({table_id, page_num}) == 0 &&
+        partition->write_back_table.count({table_id, page_num}) == 0) {
+      prefetch->pages.push_back(page_num);
+      buf_num_prefetches++;
     }
 
-    if (block->is_dirty) {
-      log_flush();
-      file_write_page(block->table_id, block->page_num, block->frame);
-      block->is_dirty = 0;
+    pthread_mutex_unlock(&partition->latch);
+  }
+
+  if (prefetch->pages.empty() ||
+      aio_submit_task(buf_read_ahead, prefetch) != 0) {
+    delete prefetch;
+  }
+}
+
+// A table with no dirty page in the buffer is up to date in its file
+int64_t buf_count_dirty_pages(int64_t table_id) {
+  auto it = num_dirty_pages.find(table_id);
+  if (it == num_dirty_pages.end()) {
+    return 0;
+  }
+  return it->second;
+}
+
+uint64_t buf_count_hits() {
+  uint64_t num_hits = 0;
+  for (int p = 0; p < buf_num_partitions; p++) {
+    pthread_mutex_lock(&buf_partitions[p].latch);
+    num_hits += buf_partitions[p].num_hits;
+    pthread_mutex_unlock(&buf_partitions[p].latch);
+  }
+  return num_hits;
+}
+
+uint64_t buf_count_misses() {
+  uint64_t num_misses = 0;
+  for (int p = 0; p < buf_num_partitions; p++) {
+    pthread_mutex_lock(&buf_partitions[p].latch);
+    num_misses += buf_partitions[p].num_misses;
+    pthread_mutex_unlock(&buf_partitions[p].latch);
+  }
+  return num_misses;
+}
+
+void buf_get_stats(buf_stats_t* stats) {
+  *stats = {};
+  for (int p = 0; p < buf_num_partitions; p++) {
+    buf_partition_t* partition = &buf_partitions[p];
+    pthread_mutex_lock(&partition->latch);
+    stats->num_frames += partition->blocks.size();
+    stats->target_frames += partition->num_frames;
+    stats->num_hits += partition->num_hits;
+    stats->num_misses += partition->num_misses;
+    stats->num_waits += partition->num_waits;
+    stats->wait_time_ns += partition->wait_time_ns;
+    stats->num_overflows += partition->num_overflows;
+    stats->num_cleaned += partition->num_cleaned;
+    stats->num_dirty_evictions += partition->num_dirty_evictions;
+    stats->num_victim_hits += partition->num_victim_hits;
+    pthread_mutex_unlock(&partition->latch);
+  }
+}
+
+// Grow or shrink the buffer to num_buf blocks, keeping the partitions. Blocks
+// that are pinned now are retired once they are replaceable.
+int buf_resize(int num_buf) {
+  if (num_buf < buf_num_partitions) {
+    return -1;
+  }
+
+  for (int p = 0; p < buf_num_partitions; p++) {
+    buf_partition_t* partition = &buf_partitions[p];
+    int first = (int64_t)num_buf * p / buf_num_partitions;
+    int last = (int64_t)num_buf * (p + 1) / buf_num_partitions;
+
+    pthread_mutex_lock(&partition->latch);
+
+    partition->num_frames = last - first;
+    while (partition->blocks.size() < partition->num_frames) {
+      policy_push_back(buf_add_block(partition), 0);
     }
+    pthread_cond_broadcast(&partition->free_cond);
+
+    pthread_mutex_unlock(&partition->latch);
 
-    control_block_table.erase({block->table_id, block->page_num});
-    file_read_page(table_id, page_num, block->frame);
-    block->table_id = table_id;
-    block->page_num = page_num;
-    control_block_table[{table_id, page_num}] = block;
+    buf_shrink_partition(partition);
   }
 
-  buf_refer_block(block);
+  return 0;
+}
 
-  pthread_mutex_lock(&block->page_latch);
+void buf_wake_cleaners() {
+  pthread_cond_signal(&buf_cleaner_cond);
+}
 
-  pthread_mutex_unlock(&buffer_manager_latch);
-  return block;
+// Set the access hint of the calling thread's reads, and return the one it
+// replaces
+int buf_set_access_hint(int hint) {
+  int old_hint = buf_access_hint;
+  buf_access_hint = hint;
+  return old_hint;
 }
 
-void buf_unpin_block(control_block_t* block, int is_dirty) {
-  block->is_dirty |= is_dirty;
-  pthread_mutex_unlock(&block->page_latch);
+// Write the resident pages to the dump, hottest first: the pinned ones, then
+// the others in the reverse of the order the policy replaces them, taking a
+// page from each partition in turn. The dump is replaced only once written
+// whole.
+int buf_dump_pages() {
+  std::vector<std::vector<page_hash_t>> ranks(buf_num_partitions);
+  size_t num_pages = 0;
+  for (int p = 0; p < buf_num_partitions; p++) {
+    buf_partition_t* partition = &buf_partitions[p];
+    std::vector<control_block_t*> blocks;
+
+    pthread_mutex_lock(&partition->latch);
+    buf_policy->list_victims(partition, partition->blocks.size(), &blocks);
+    for (control_block_t* block : partition->blocks) {
+      if (block->pin_count != 0) {
+        blocks.push_back(block);
+      }
+    }
+    for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+      if ((*it)->table_id >= 0) {
+        ranks[p].push_back({(*it)->table_id, (*it)->page_num});
+      }
+    }
+    pthread_mutex_unlock(&partition->latch);
+
+    num_pages += ranks[p].size();
+  }
+
+  std::string temp_path = std::string(BUFDUMP_PATH) + ".tmp";
+  FILE* fp = fopen(temp_path.c_str(), "w");
+  if (fp == NULL) {
+    return -1;
+  }
+  for (size_t rank = 0, num_written = 0; num_written < num_pages; rank++) {
+    for (int p = 0; p < buf_num_partitions; p++) {
+      if (rank < ranks[p].size()) {
+        page_hash_t page = ranks[p][rank];
+        fprintf(fp, "%lu %s\n", page.page_num,
+                table_descs[page.table_id].pathname.c_str());
+        num_written++;
+      }
+    }
+  }
+  if (fclose(fp) != 0) {
+    remove(temp_path.c_str());
+    return -1;
+  }
+
+  return rename(temp_path.c_str(), BUFDUMP_PATH) == 0 ? 0 : -1;
 }
 
 // Utility.
 
-control_block_t* buf_find_victim() {
-  control_block_t* temp = tail_block;
-  while (temp != NULL) {
-    if (pthread_mutex_trylock(&temp->page_latch) == 0) {
-      pthread_mutex_unlock(&temp->page_latch);
-      return temp;
+// The partition latch is not held while a missed page is read in, nor while
+// a dirty victim is written back. The new page's latch is held instead, so
+// readers of that page wait on it, and readers of the evicted page wait until
+// its write-back is done. The victim is taken from the page's own partition,
+// so the evicted page belongs to it as well. A reader pins the block before
+// it lets go of the partition latch, so the block is not replaced while it
+// waits for the page latch.
+control_block_t* buf_fix_page(int64_t table_id,
+                              pagenum_t page_num,
+                              int mode,
+                              int can_wait) {
+  int is_miss;
+  control_block_t* block =
+      buf_claim_page(table_id, page_num, mode, can_wait, &is_miss);
+  if (block == NULL || !is_miss) {
+    return block;
+  }
+
+  buf_partition_t* partition = block->partition;
+  if ((partition->victim_arena == NULL ||
+       buf_read_cached_victim(partition, table_id, page_num, block->frame) !=
+           0) &&
+      file_read_page(table_id, page_num, block->frame) != 0) {
+    buf_drop_unread_block(block);
+    return NULL;
+  }
+
+  // A shared latch can't be taken over from the exclusive one, but the pin
+  // keeps the page in the block meanwhile
+  if (mode == LATCH_SHARED) {
+    buf_unlatch_block(block);
+    buf_latch_block(block, LATCH_SHARED);
+  }
+
+  return block;
+}
+
+// Give up the block a page could not be read into. Readers waiting for its
+// latch find it empty, and look the page up again.
+void buf_drop_unread_block(control_block_t* block) {
+  buf_partition_t* partition = block->partition;
+  pthread_mutex_lock(&partition->latch);
+  partition->control_block_table.erase({block->table_id, block->page_num});
+  buf_make_block_empty(block);
+  pthread_mutex_unlock(&partition->latch);
+}
+
+// Put the dirty page whose write-back failed back into the block claimed for
+// another page, to be written by a later flush. Readers waiting for the block
+// find it holding another page, and look theirs up again. Called with the
+// partition latch held.
+void buf_restore_victim(buf_partition_t* partition,
+                        control_block_t* block,
+                        page_hash_t victim) {
+  auto it = partition->control_block_table.find(
+      {block->table_id, block->page_num});
+  if (it != partition->control_block_table.end() && it->second == block) {
+    partition->control_block_table.erase(it);
+  }
+  block->table_id = victim.table_id;
+  block->page_num = victim.page_num;
+  block->is_dirty = 1;
+  partition->control_block_table[victim] = block;
+}
+
+// Return the block of the page pinned and latched, or NULL if there is no
+// block for it and it can't wait, or the dirty page it held can't be written
+// back. On a miss, the block is latched exclusively
+// and its frame is left for the caller to read the page into. With
+// LATCH_NONE, a page already in the buffer is left alone and NULL returned.
+control_block_t* buf_claim_page(int64_t table_id,
+                                pagenum_t page_num,
+                                int mode,
+                                int can_wait,
+                                int* is_miss) {
+  buf_partition_t* partition = buf_get_partition(table_id, page_num);
+  pthread_mutex_lock(&partition->latch);
+
+  control_block_t* block = NULL;
+  while (1) {
+    while (partition->write_back_table.count({table_id, page_num}) > 0) {
+      pthread_cond_wait(&partition->write_back_cond, &partition->latch);
     }
-    temp = temp->prev;
+
+    auto it = partition->control_block_table.find({table_id, page_num});
+    if (it != partition->control_block_table.end() && mode == LATCH_NONE) {
+      pthread_mutex_unlock(&partition->latch);
+      return NULL;
+    }
+    if (it != partition->control_block_table.end()) {
+      block = it->second;
+      partition->num_hits++;
+      block->pin_count++;
+      buf_num_pins++;
+      if (buf_access_hint != ACCESS_SEQUENTIAL || !buf_use_access_hints) {
+        buf_policy->refer(block);
+      }
+      buf_set_block_hint(block);
+
+      pthread_mutex_unlock(&partition->latch);
+
+      buf_latch_block(block, mode);
+
+      // Only a freed page leaves a pinned block
+      if (block->table_id == table_id && block->page_num == page_num) {
+        *is_miss = 0;
+        return block;
+      }
+      buf_unlatch_block(block);
+      buf_drop_pin(block);
+
+      pthread_mutex_lock(&partition->latch);
+      continue;
+    }
+
+    block = buf_find_victim(partition);
+    if (block != NULL) {
+      break;
+    }
+
+    // A reader holding pins could be waiting for its own blocks, so it takes
+    // one more, which the partition retires once it is replaceable. A page
+    // read ahead is not worth one. Past MAX_OVERFLOW_BLOCKS, it waits for an
+    // unpin as any other reader.
+    if (buf_num_pins > 0 && mode != LATCH_NONE &&
+        partition->blocks.size() <
+            partition->num_frames + MAX_OVERFLOW_BLOCKS) {
+      block = buf_add_block(partition);
+      buf_latch_block(block, LATCH_EXCLUSIVE);
+      policy_push_front(block, 0);
+      partition->num_overflows++;
+      break;
+    }
+
+    if (!can_wait) {
+      pthread_mutex_unlock(&partition->latch);
+      return NULL;
+    }
+
+    // Unpins don't take the partition latch, so the reader counts itself as
+    // waiting before it looks for a victim once more. An unpin that comes
+    // after the search sees the count and wakes it, and one that came before
+    // it left a victim to find.
+    partition->num_waiters++;
+    block = buf_find_victim(partition);
+    if (block != NULL) {
+      partition->num_waiters--;
+      break;
+    }
+
+    // The page may be read in by another reader meanwhile, so it is looked
+    // up again after the wait
+    auto begin = std::chrono::steady_clock::now();
+    pthread_cond_wait(&partition->free_cond, &partition->latch);
+    partition->num_waiters--;
+    partition->num_waits++;
+    auto end = std::chrono::steady_clock::now();
+    partition->wait_time_ns +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+            .count();
   }
-  return temp;
+
+  partition->num_misses++;
+  block->pin_count++;
+  buf_num_pins++;
+
+  page_hash_t victim = {block->table_id, block->page_num};
+  int is_dirty = block->is_dirty;
+  block->is_dirty = 0;
+
+  partition->control_block_table.erase(victim);
+  if (is_dirty) {
+    partition->write_back_table.insert(victim);
+    partition->num_dirty_evictions++;
+  }
+
+  block->table_id = table_id;
+  block->page_num = page_num;
+  partition->control_block_table[{table_id, page_num}] = block;
+  partition->victim_reservations.erase({table_id, page_num});
+
+  int is_cached = !is_dirty && partition->victim_arena != NULL &&
+                  victim.table_id >= 0;
+  uint64_t ticket = is_cached ? buf_reserve_victim(partition, victim) : 0;
+
+  if (buf_access_hint == ACCESS_SEQUENTIAL && buf_use_access_hints) {
+    buf_policy->load_once(block);
+  } else {
+    buf_policy->load(block);
+  }
+  buf_set_block_hint(block);
+
+  int is_oversized = partition->blocks.size() > partition->num_frames;
+
+  pthread_mutex_unlock(&partition->latch);
+
+  if (is_dirty) {
+    buf_wake_cleaners();
+    log_flush_until(log_get_page_lsn(block->frame));
+    int result = buf_write_back(victim.table_id, victim.page_num, block->frame);
+    if (result == 0) {
+      num_dirty_pages[victim.table_id]--;
+    }
+
+    pthread_mutex_lock(&partition->latch);
+    if (result != 0) {
+      buf_restore_victim(partition, block, victim);
+    }
+    partition->write_back_table.erase(victim);
+    pthread_cond_broadcast(&partition->write_back_cond);
+    pthread_mutex_unlock(&partition->latch);
+
+    if (result != 0) {
+      buf_unlatch_block(block);
+      buf_drop_pin(block);
+      return NULL;
+    }
+  } else if (is_cached) {
+    buf_cache_victim(partition, victim, ticket, block->frame);
+  }
+
+  if (is_oversized) {
+    buf_shrink_partition(partition);
+  }
+
+  *is_miss = 1;
+  return block;
 }
 
-void buf_refer_block(control_block_t* block) {
-  if (block == head_block) {
-    return;
+void buf_latch_block(control_block_t* block, int mode) {
+  if (mode == LATCH_SHARED) {
+    pthread_rwlock_rdlock(&block->page_latch);
+  } else {
+    pthread_rwlock_wrlock(&block->page_latch);
+    buf_begin_change(block);
+  }
+}
+
+// Make the version odd once the latch is held exclusively, before the frame
+// or the block's page changes
+void buf_begin_change(control_block_t* block) {
+  uint64_t version = block->version.load(std::memory_order_relaxed);
+  block->version.store(version + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+// Release a shared or exclusive latch. Only the exclusive holder sees an odd
+// version, which it makes even again.
+void buf_unlatch_block(control_block_t* block) {
+  uint64_t version = block->version.load(std::memory_order_relaxed);
+  if (version & 1) {
+    block->version.store(version + 1, std::memory_order_release);
+  }
+  pthread_rwlock_unlock(&block->page_latch);
+}
+
+// Drop a pin without the partition latch, and wake the readers waiting for a
+// replaceable block if it was the last. The pin count and the count of
+// waiters are sequentially consistent, so either this sees a reader counted
+// as waiting, or that reader's last search sees the block unpinned.
+void buf_drop_pin(control_block_t* block) {
+  buf_num_pins--;
+  buf_partition_t* partition = block->partition;
+  if (--block->pin_count == 0 && partition->num_waiters > 0) {
+    pthread_mutex_lock(&partition->latch);
+    pthread_cond_broadcast(&partition->free_cond);
+    pthread_mutex_unlock(&partition->latch);
   }
+}
+
+// Retire replaceable blocks until the partition is back to its size, writing
+// the dirty ones back as an eviction does
+void buf_shrink_partition(buf_partition_t* partition) {
+  pthread_mutex_lock(&partition->latch);
 
-  if (block == tail_block) {
-    block->prev->next = NULL;
-    tail_block = block->prev;
+  while (partition->blocks.size() > partition->num_frames) {
+    control_block_t* block = buf_find_victim(partition);
+    if (block == NULL) {
+      break;
+    }
+
+    page_hash_t victim = {block->table_id, block->page_num};
+    int is_dirty = block->is_dirty;
+    block->is_dirty = 0;
+
+    partition->control_block_table.erase(victim);
+    if (is_dirty) {
+      partition->write_back_table.insert(victim);
+    }
+
+    policy_remove(block);
+    std::vector<control_block_t*>& blocks = partition->blocks;
+    blocks.erase(std::find(blocks.begin(), blocks.end(), block));
+    if (partition->clock_hand >= blocks.size()) {
+      partition->clock_hand = 0;
+    }
+
+    pthread_mutex_unlock(&partition->latch);
+
+    int result = 0;
+    if (is_dirty) {
+      log_flush_until(log_get_page_lsn(block->frame));
+      result = buf_write_back(victim.table_id, victim.page_num, block->frame);
+      if (result == 0) {
+        num_dirty_pages[victim.table_id]--;
+      }
+    }
+    if (result == 0) {
+      block->table_id = -1;
+      block->page_num = 0;
+    }
+    buf_unlatch_block(block);
+
+    pthread_mutex_lock(&partition->latch);
+    if (is_dirty) {
+      partition->write_back_table.erase(victim);
+      pthread_cond_broadcast(&partition->write_back_cond);
+    }
+
+    // The page stays, dirty, and the partition is left oversized until the
+    // next shrink
+    if (result != 0) {
+      block->is_dirty = 1;
+      partition->control_block_table[victim] = block;
+      blocks.push_back(block);
+      policy_push_front(block, 0);
+      buf_policy->load(block);
+      break;
+    }
+
+    buf_free_frame(partition, block->frame);
+    block->frame = &buf_retired_frame;
+    partition->retired_blocks.push_back(block);
+  }
+
+  pthread_mutex_unlock(&partition->latch);
+}
+
+// Add an empty block to the partition, taking a retired one if there is one.
+// It is not in a replacement list yet. Called with the partition latch held.
+control_block_t* buf_add_block(buf_partition_t* partition) {
+  page_t* frame = buf_alloc_frame(partition);
+  control_block_t* block;
+  if (partition->retired_blocks.empty()) {
+    block = buf_make_new_block(frame, partition);
   } else {
-    block->prev->next = block->next;
-    block->next->prev = block->prev;
+    // The version goes on from where it was, so that a reader of the old
+    // page never validates
+    block = partition->retired_blocks.back();
+    partition->retired_blocks.pop_back();
+    block->frame = frame;
   }
+  partition->blocks.push_back(block);
+  return block;
+}
 
-  head_block->prev = block;
-  block->next = head_block;
-  block->prev = NULL;
-  head_block = block;
+// Take a frame for a new block of the partition. Called with the partition
+// latch held.
+page_t* buf_alloc_frame(buf_partition_t* partition) {
+  if (partition->spare_frames.empty()) {
+    return new page_t;
+  }
+  page_t* frame = partition->spare_frames.back();
+  partition->spare_frames.pop_back();
+  return frame;
 }
 
-void buf_make_block_empty(control_block_t* block) {
-  block->is_dirty = 0;
-  pthread_mutex_unlock(&block->page_latch);
+// Give the memory of a retired block's frame back. The frame stays mapped, as
+// optimistic readers may still read it, and the partition grows into it
+// again. Called with the partition latch held.
+void buf_free_frame(buf_partition_t* partition, page_t* frame) {
+  madvise(frame, PAGE_SIZE, MADV_DONTNEED);
+  partition->spare_frames.push_back(frame);
+}
+
+// The pages not in the buffer yet are all read in at once through io_uring,
+// their blocks staying latched until then. A page read ahead is not worth
+// waiting for a block, and is read for a scan.
+void buf_read_ahead(void* arg, int /* result */) {
+  prefetch_t* prefetch = (prefetch_t*)arg;
+  int64_t table_id = prefetch->table_id;
+  int hint = buf_set_access_hint(ACCESS_SEQUENTIAL);
+
+  std::vector<control_block_t*> blocks;
+  std::vector<aio_future_t> reads(prefetch->pages.size());
+  for (pagenum_t page_num : prefetch->pages) {
+    int is_miss;
+    control_block_t* block =
+        buf_claim_page(table_id, page_num, LATCH_NONE, 0, &is_miss);
+    if (block == NULL) {
+      continue;
+    }
+
+    aio_future_t* read = &reads[blocks.size()];
+    aio_future_init(read);
+    blocks.push_back(block);
 
-  if (block == tail_block) {
+    buf_partition_t* partition = block->partition;
+    if (partition->victim_arena != NULL &&
+        buf_read_cached_victim(partition, table_id, page_num, block->frame) ==
+            0) {
+      aio_future_complete(read, PAGE_SIZE);
+    } else if (aio_active_backend != AIO_IO_URING ||
+               file_read_page_async(table_id, page_num, block->frame,
+                                    aio_future_complete, read) != 0) {
+      aio_future_complete(
+          read, file_read_page(table_id, page_num, block->frame) == 0
+                    ? PAGE_SIZE
+                    : -1);
+    }
+  }
+
+  // A page that could not be read is not left in the buffer
+  for (size_t i = 0; i < blocks.size(); i++) {
+    if (aio_future_wait(&reads[i]) != PAGE_SIZE) {
+      buf_drop_unread_block(blocks[i]);
+    } else {
+      buf_unpin_block(blocks[i], 0);
+    }
+  }
+
+  buf_set_access_hint(hint);
+  delete prefetch;
+}
+
+// Read the hottest pages of the dump back, as many as the buffer holds, by
+// table. A missing dump leaves nothing to reload.
+void buf_load_dump(size_t max_pages) {
+  FILE* fp = fopen(BUFDUMP_PATH, "r");
+  if (fp == NULL) {
     return;
   }
 
-  if (block == head_block) {
-    block->next->prev = NULL;
-    head_block = block->next;
-  } else {
-    block->prev->next = block->next;
-    block->next->prev = block->prev;
+  pagenum_t page_num;
+  char pathname[PATH_MAX];
+  for (size_t i = 0;
+       i < max_pages && fscanf(fp, "%lu %4095[^\n]", &page_num, pathname) == 2;
+       i++) {
+    buf_dumped_pages[pathname].push_back(page_num);
   }
+  fclose(fp);
+}
 
-  tail_block->next = block;
-  block->prev = tail_block;
-  block->next = NULL;
-  tail_block = block;
+// Reload the dumped pages of a table that was just opened. They are read in
+// page order, a read-ahead window of them per task, so that the aio workers
+// read separate windows in parallel and each reads close pages one after
+// another. Pages past the end of the table are dropped, as it may have been
+// recreated since the dump, and all of them if the header page can't be read.
+void buf_warm_up_table(int64_t table_id, std::vector<pagenum_t>* pages) {
+  control_block_t* header_block = buf_read_page_shared(table_id, 0);
+  if (header_block == NULL) {
+    return;
+  }
+  uint64_t number_of_pages = file_get_number_of_pages(header_block->frame);
+  buf_unpin_block(header_block, 0);
+
+  std::sort(pages->begin(), pages->end());
+  pages->erase(std::remove_if(pages->begin(), pages->end(),
+                              [number_of_pages](pagenum_t page_num) {
+                                return page_num == 0 ||
+                                       page_num >= number_of_pages;
+                              }),
+               pages->end());
+
+  size_t window = std::max(1, buf_read_ahead_window);
+  for (size_t first = 0; first < pages->size(); first += window) {
+    size_t last = std::min(pages->size(), first + window);
+    warm_up_t* warm_up = new warm_up_t{
+        table_id, std::vector<pagenum_t>(pages->begin() + first,
+                                         pages->begin() + last)};
+    buf_num_warm_up_pages += last - first;
+    if (aio_submit_task(buf_reload_pages, warm_up) != 0) {
+      buf_num_warmed_pages += last - first;
+      delete warm_up;
+    }
+  }
+}
+
+// A page already in the buffer, or with no replaceable block for it, is
+// counted as reloaded all the same, so that the warm-up is done once every
+// queued page is
+void buf_reload_pages(void* arg, int /* result */) {
+  warm_up_t* warm_up = (warm_up_t*)arg;
+
+  for (pagenum_t page_num : warm_up->pages) {
+    buf_partition_t* partition = buf_get_partition(warm_up->table_id, page_num);
+    pthread_mutex_lock(&partition->latch);
+    int is_resident = partition->control_block_table.count(
+                          {warm_up->table_id, page_num}) > 0;
+    pthread_mutex_unlock(&partition->latch);
+
+    if (!is_resident) {
+      control_block_t* block = buf_try_read_page(warm_up->table_id, page_num);
+      if (block != NULL) {
+        buf_unpin_block(block, 0);
+      }
+    }
+    buf_num_warmed_pages++;
+  }
+  delete warm_up;
 }
 
-control_block_t* buf_make_new_block() {
+// Write an evicted page back, through the doublewrite file as a batch of
+// its own if doublewrite is on
+int buf_write_back(int64_t table_id, pagenum_t page_num, const page_t* frame) {
+  if (!file_doublewrite) {
+    return file_write_page(table_id, page_num, frame);
+  }
+
+  page_t copy;
+  memcpy(&copy, frame, PAGE_SIZE);
+  file_stamp_checksum(&copy);
+
+  const page_t* pages[] = {&copy};
+  int result = file_begin_doublewrite(&table_id, &page_num, pages, 1);
+  if (result == 0) {
+    result = file_write_page(table_id, page_num, &copy);
+  }
+  file_end_doublewrite();
+  return result;
+}
+
+// Reserve the clean victim its place in the victim cache, before the latch
+// is let go for compressing it. Called with the partition latch held.
+uint64_t buf_reserve_victim(buf_partition_t* partition, page_hash_t victim) {
+  uint64_t ticket = ++partition->victim_ticket;
+  partition->victim_reservations[victim] = ticket;
+  return ticket;
+}
+
+// Compress a clean victim into the partition's victim cache, dropping the
+// oldest images in the way. A page read in again since it was reserved, even
+// if it was changed, written and evicted since, is not cached, so that no
+// image is older than its page.
+void buf_cache_victim(buf_partition_t* partition,
+                      page_hash_t victim,
+                      uint64_t ticket,
+                      const page_t* frame) {
+  uint8_t image[PAGE_SIZE];
+  int size = compress_block(frame->data, PAGE_SIZE, image, PAGE_SIZE - 1);
+
+  pthread_mutex_lock(&partition->latch);
+
+  auto reservation = partition->victim_reservations.find(victim);
+  if (reservation == partition->victim_reservations.end() ||
+      reservation->second != ticket) {
+    pthread_mutex_unlock(&partition->latch);
+    return;
+  }
+  partition->victim_reservations.erase(reservation);
+
+  if (size < 0 || (size_t)size > partition->victim_arena_size) {
+    pthread_mutex_unlock(&partition->latch);
+    return;
+  }
+
+  // An image that doesn't fit before the end of the arena goes to its start,
+  // and the images after the head are dropped as well
+  size_t offset = partition->victim_head;
+  int wraps = offset + size > partition->victim_arena_size;
+  if (wraps) {
+    offset = 0;
+  }
+  std::deque<victim_entry_t>& queue = partition->victim_queue;
+  while (!queue.empty()) {
+    const victim_entry_t& oldest = queue.front();
+    if (!(wraps && oldest.offset >= partition->victim_head) &&
+        (oldest.offset >= offset + size ||
+         oldest.offset + oldest.size <= offset)) {
+      break;
+    }
+    auto it = partition->victim_table.find(oldest.page);
+    if (it != partition->victim_table.end() &&
+        it->second.offset == oldest.offset) {
+      partition->victim_table.erase(it);
+    }
+    queue.pop_front();
+  }
+
+  memcpy(partition->victim_arena + offset, image, size);
+  victim_entry_t entry = {victim, offset, size};
+  partition->victim_table[victim] = entry;
+  queue.push_back(entry);
+  partition->victim_head = offset + size;
+
+  pthread_mutex_unlock(&partition->latch);
+}
+
+// Read the page from the partition's victim cache into the frame, if it is
+// there. Its image is dropped, as the page is resident from now on.
+int buf_read_cached_victim(buf_partition_t* partition,
+                           int64_t table_id,
+                           pagenum_t page_num,
+                           page_t* frame) {
+  pthread_mutex_lock(&partition->latch);
+
+  int result = -1;
+  auto it = partition->victim_table.find({table_id, page_num});
+  if (it != partition->victim_table.end()) {
+    const victim_entry_t& entry = it->second;
+    if (decompress_block(partition->victim_arena + entry.offset, entry.size,
+                         frame->data, PAGE_SIZE) == PAGE_SIZE) {
+      partition->num_victim_hits++;
+      result = 0;
+    }
+    partition->victim_table.erase(it);
+  }
+
+  pthread_mutex_unlock(&partition->latch);
+  return result;
+}
+
+// Pages are spread over the partitions by a mix of both halves of their key,
+// as the page table's own hash leaves consecutive pages of a table apart by
+// two and would use only half of the partitions
+uint64_t buf_hash_page(int64_t table_id, pagenum_t page_num) {
+  uint64_t h = (uint64_t)table_id * 0x9e3779b97f4a7c15ULL ^ page_num;
+  return h * 0xff51afd7ed558ccdULL;
+}
+
+buf_partition_t* buf_get_partition(int64_t table_id, pagenum_t page_num) {
+  return &buf_partitions[(buf_hash_page(table_id, page_num) >> 32) %
+                         buf_num_partitions];
+}
+
+// Take the version of a block found without the partition latch, if the
+// block holds the page
+bool buf_holds_page(const control_block_t* block,
+                    int64_t table_id,
+                    pagenum_t page_num,
+                    uint64_t* version) {
+  uint64_t v = block->version.load(std::memory_order_acquire);
+  if ((v & 1) || block->table_id != table_id || block->page_num != page_num ||
+      !buf_validate_block(block, v)) {
+    return false;
+  }
+  *version = v;
+  return true;
+}
+
+// Point the page's hint at its block. Called with the partition latch held.
+void buf_set_block_hint(control_block_t* block) {
+  uint64_t h = buf_hash_page(block->table_id, block->page_num);
+  std::atomic<control_block_t*>& hint =
+      buf_block_hints[h % buf_num_block_hints];
+  if (hint.load(std::memory_order_relaxed) != block) {
+    hint.store(block, std::memory_order_release);
+  }
+}
+
+// Partition latches are always taken in this order when more than one is held
+void buf_lock_partitions() {
+  for (int p = 0; p < buf_num_partitions; p++) {
+    pthread_mutex_lock(&buf_partitions[p].latch);
+  }
+}
+
+void buf_unlock_partitions() {
+  for (int p = buf_num_partitions - 1; p >= 0; p--) {
+    pthread_mutex_unlock(&buf_partitions[p].latch);
+  }
+}
+
+// Return the block of the partition the policy replaces next, with its latch
+// held, or NULL if every block is pinned. A clean block is preferred, as it
+// is replaced without a write-back.
+control_block_t* buf_find_victim(buf_partition_t* partition) {
+  control_block_t* block = NULL;
+  if (buf_prefer_clean) {
+    block = buf_policy->find_victim(partition, 1);
+  }
+  if (block == NULL) {
+    block = buf_policy->find_victim(partition, 0);
+  }
+  return block;
+}
+
+void buf_make_block_empty(control_block_t* block) {
+  if (block->is_dirty) {
+    num_dirty_pages[block->table_id]--;
+  }
+  block->table_id = -1;
+  block->page_num = 0;
+  block->is_dirty = 0;
+  buf_policy->empty(block);
+  buf_unlatch_block(block);
+
+  // Called with the partition latch held, so waiting readers are woken here,
+  // whether or not they are counted yet
+  buf_num_pins--;
+  buf_partition_t* partition = block->partition;
+  if (--block->pin_count == 0) {
+    pthread_cond_broadcast(&partition->free_cond);
+  }
+}
+
+control_block_t* buf_make_new_block(page_t* frame, buf_partition_t* partition) {
   control_block_t* block = new control_block_t;
-  block->frame = new page_t;
+  block->frame = frame;
+  block->partition = partition;
   block->table_id = -1;
   block->page_num = 0;
   block->is_dirty = 0;
-  block->page_latch = PTHREAD_MUTEX_INITIALIZER;
+  block->is_flushing = 0;
+  block->page_latch = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+  block->version = 0;
+  block->children = NULL;
+  block->pin_count = 0;
+  block->referenced = 0;
+  block->list = 0;
+  memset(block->history, 0, sizeof(block->history));
   block->next = NULL;
   block->prev = NULL;
   return block;
 }
+
+// Link the cached free pages into the on-disk free page lists. They are not
+// resident any more, so they are written directly, holding only their next
+// pointers. The pages of a table whose header page can't be read stay cached
+// for the next checkpoint.
+void buf_release_free_pages() {
+  pthread_mutex_lock(&free_page_cache_latch);
+
+  for (auto it = free_page_cache.begin(); it != free_page_cache.end();) {
+    if (it->second.empty()) {
+      it = free_page_cache.erase(it);
+      continue;
+    }
+
+    int64_t table_id = it->first;
+    control_block_t* header_block = buf_read_page(table_id, 0);
+    if (header_block == NULL) {
+      ++it;
+      continue;
+    }
+    pagenum_t first = file_get_first_free_page_number(header_block->frame);
+
+    for (pagenum_t page_num : it->second) {
+      page_t page = {};
+      file_set_next_free_page_number(&page, first);
+      file_write_page(table_id, page_num, &page);
+      first = page_num;
+    }
+
+    file_set_first_free_page_number(header_block->frame, first);
+    buf_unpin_block(header_block, 1);
+    it = free_page_cache.erase(it);
+  }
+
+  pthread_mutex_unlock(&free_page_cache_latch);
+}
+
+// Map one contiguous, page-aligned arena for the initial frames, backed by
+// huge pages when buf_use_huge_pages is set and the system provides them.
+page_t* buf_make_frame_arena(int num_buf) {
+  size_t size = (size_t)num_buf * PAGE_SIZE;
+  int prot = PROT_READ | PROT_WRITE;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+  void* arena = MAP_FAILED;
+  if (buf_use_huge_pages) {
+    size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    arena = mmap(NULL, size, prot, flags | MAP_HUGETLB, -1, 0);
+  }
+  if (arena == MAP_FAILED) {
+    arena = mmap(NULL, size, prot, flags, -1, 0);
+    if (arena == MAP_FAILED) {
+      return NULL;
+    }
+    if (buf_use_huge_pages) {
+      madvise(arena, size, MADV_HUGEPAGE);
+    }
+  }
+
+  frame_arena_size = size;
+  return (page_t*)arena;
+}
+
+bool buf_is_arena_frame(const page_t* frame) {
+  return frame_arena != NULL && frame >= frame_arena &&
+         (const uint8_t*)frame < (const uint8_t*)frame_arena + frame_arena_size;
+}
+
+int buf_start_cleaners() {
+  if (buf_num_cleaners <= 0) {
+    return 0;
+  }
+
+  buf_cleaners_running = 1;
+  buf_num_running_cleaners = buf_num_cleaners;
+  buf_cleaners = new pthread_t[buf_num_running_cleaners];
+  for (int i = 0; i < buf_num_running_cleaners; i++) {
+    if (pthread_create(&buf_cleaners[i], NULL, buf_cleaner,
+                       (void*)(intptr_t)i) != 0) {
+      buf_num_running_cleaners = i;
+      buf_stop_cleaners();
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void buf_stop_cleaners() {
+  if (buf_cleaners == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&buf_cleaner_latch);
+  buf_cleaners_running = 0;
+  pthread_cond_broadcast(&buf_cleaner_cond);
+  pthread_mutex_unlock(&buf_cleaner_latch);
+
+  for (int i = 0; i < buf_num_running_cleaners; i++) {
+    pthread_join(buf_cleaners[i], NULL);
+  }
+  delete[] buf_cleaners;
+  buf_cleaners = NULL;
+  buf_num_running_cleaners = 0;
+}
+
+// Each cleaner looks after every so many partitions. It sleeps for the
+// interval once there is nothing to write, and for as long as its rate
+// allows after writing.
+void* buf_cleaner(void* arg) {
+  int index = (int)(intptr_t)arg;
+  auto interval = std::chrono::milliseconds(buf_dump_interval_ms);
+  auto next_dump = std::chrono::steady_clock::now() + interval;
+
+  pthread_mutex_lock(&buf_cleaner_latch);
+  while (buf_cleaners_running) {
+    pthread_mutex_unlock(&buf_cleaner_latch);
+
+    // The first cleaner dumps the hot pages as well, so that a crash leaves a
+    // recent dump behind
+    if (index == 0 && buf_warm_up && buf_dump_interval_ms > 0 &&
+        std::chrono::steady_clock::now() >= next_dump) {
+      buf_dump_pages();
+      next_dump = std::chrono::steady_clock::now() + interval;
+    }
+
+    size_t num_written = 0;
+    int step = buf_num_running_cleaners;
+    for (int p = index; p < buf_num_partitions; p += step) {
+      num_written += buf_clean_partition(&buf_partitions[p]);
+    }
+
+    int64_t wait_ns = 0;
+    int is_throttled = 0;
+    if (num_written == 0) {
+      wait_ns = (int64_t)CLEANER_INTERVAL_MS * 1000000;
+    } else if (buf_cleaner_max_rate > 0) {
+      wait_ns = (int64_t)(num_written * 1000000000 / buf_cleaner_max_rate);
+      is_throttled = 1;
+    }
+
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (deadline.tv_nsec + wait_ns) / 1000000000;
+    deadline.tv_nsec = (deadline.tv_nsec + wait_ns) % 1000000000;
+
+    // A throttled cleaner is not woken early by readers
+    pthread_mutex_lock(&buf_cleaner_latch);
+    while (buf_cleaners_running && wait_ns > 0) {
+      if (pthread_cond_timedwait(&buf_cleaner_cond, &buf_cleaner_latch,
+                                 &deadline) != 0 ||
+          !is_throttled) {
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&buf_cleaner_latch);
+
+  return NULL;
+}
+
+// Write back the dirty blocks among the next ones to be replaced, so that a
+// reader finds a clean victim instead of writing one back itself. The blocks
+// are pinned, so that they are not replaced, and latched shared, so that they
+// do not change, while they are written. Blocks being changed are left for
+// the next round. Return the number of pages written.
+size_t buf_clean_partition(buf_partition_t* partition) {
+  std::vector<control_block_t*> candidates;
+  std::vector<control_block_t*> blocks;
+
+  pthread_mutex_lock(&partition->latch);
+  size_t target =
+      std::min((size_t)std::max(buf_clean_target, 0), partition->num_frames / 2);
+  buf_policy->list_victims(partition, target, &candidates);
+  for (control_block_t* block : candidates) {
+    if (block->is_dirty) {
+      block->pin_count++;
+      buf_num_pins++;
+      blocks.push_back(block);
+    }
+  }
+  pthread_mutex_unlock(&partition->latch);
+
+  size_t num_latched = 0;
+  for (control_block_t* block : blocks) {
+    if (pthread_rwlock_tryrdlock(&block->page_latch) == 0) {
+      blocks[num_latched++] = block;
+    } else {
+      buf_drop_pin(block);
+    }
+  }
+  blocks.resize(num_latched);
+
+  // A page a checkpoint is writing is left to it, as a later copy written
+  // before it would be overwritten by the older one
+  pthread_mutex_lock(&partition->latch);
+  num_latched = 0;
+  for (control_block_t* block : blocks) {
+    if (!block->is_flushing && block->is_dirty) {
+      blocks[num_latched++] = block;
+    } else {
+      buf_unlatch_block(block);
+      buf_drop_pin(block);
+    }
+  }
+  pthread_mutex_unlock(&partition->latch);
+  blocks.resize(num_latched);
+  if (blocks.empty()) {
+    return 0;
+  }
+
+  std::sort(blocks.begin(), blocks.end(), buf_precedes);
+
+  // The log goes first, as for a victim
+  int64_t page_lsn = 0;
+  std::vector<const page_t*> frames;
+  for (control_block_t* block : blocks) {
+    page_lsn = std::max(page_lsn, log_get_page_lsn(block->frame));
+    frames.push_back(block->frame);
+  }
+  log_flush_until(page_lsn);
+
+  size_t batch_size = file_doublewrite ? DOUBLEWRITE_PAGES : blocks.size();
+  std::vector<control_block_t*> failed;
+  for (size_t first = 0; first < blocks.size(); first += batch_size) {
+    size_t count = std::min(batch_size, blocks.size() - first);
+    buf_flush_blocks(&blocks[first], &frames[first], count, &failed);
+  }
+
+  // Only the pages written are clean. A checkpoint may have copied them
+  // meanwhile.
+  size_t num_written = 0;
+  pthread_mutex_lock(&partition->latch);
+  for (control_block_t* block : blocks) {
+    if (std::find(failed.begin(), failed.end(), block) != failed.end()) {
+      continue;
+    }
+    num_written++;
+    if (block->is_dirty) {
+      block->is_dirty = 0;
+      num_dirty_pages[block->table_id]--;
+      partition->num_cleaned++;
+    }
+  }
+  pthread_mutex_unlock(&partition->latch);
+
+  for (control_block_t* block : blocks) {
+    buf_unlatch_block(block);
+    buf_drop_pin(block);
+  }
+
+  return num_written;
+}
+
+// Blocks are written in the order of their pages
+bool buf_precedes(const control_block_t* b1, const control_block_t* b2) {
+  if (b1->table_id != b2->table_id) {
+    return b1->table_id < b2->table_id;
+  }
+  return b1->page_num < b2->page_num;
+}
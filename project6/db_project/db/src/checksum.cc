@@ -0,0 +1,152 @@
+#include "checksum.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// checksum_table[k] advances a byte followed by k zero bytes
+static uint32_t checksum_table[8][256];
+
+// Advances a register over CHECKSUM_STRIDE zero bytes, a byte at a time
+static uint32_t checksum_shift_table[4][256];
+
+static int checksum_hw = 0;
+static pthread_once_t checksum_once = PTHREAD_ONCE_INIT;
+
+// APIs.
+
+// Continue the checksum crc of earlier data with size bytes of data. The
+// checksum of no data is 0.
+uint32_t checksum_crc32c(uint32_t crc, const void* data, size_t size) {
+  pthread_once(&checksum_once, checksum_init);
+
+  const uint8_t* p = (const uint8_t*)data;
+  if (checksum_hw) {
+    return ~checksum_update_hw(~crc, p, size);
+  }
+  return ~checksum_update_sw(~crc, p, size);
+}
+
+// Utilities.
+
+void checksum_init() {
+  for (int i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int j = 0; j < 8; j++) {
+      crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+    }
+    checksum_table[0][i] = crc;
+  }
+  for (int k = 1; k < 8; k++) {
+    for (int i = 0; i < 256; i++) {
+      uint32_t crc = checksum_table[k - 1][i];
+      checksum_table[k][i] = (crc >> 8) ^ checksum_table[0][crc & 0xff];
+    }
+  }
+
+  // Advancing over zero bytes is linear in the register, so it is the sum of
+  // what it makes of the register's bits
+  uint32_t shifted_bits[32];
+  uint8_t zeros[CHECKSUM_STRIDE] = {};
+  for (int bit = 0; bit < 32; bit++) {
+    shifted_bits[bit] = checksum_update_sw(1u << bit, zeros, CHECKSUM_STRIDE);
+  }
+  for (int j = 0; j < 4; j++) {
+    for (int i = 0; i < 256; i++) {
+      uint32_t crc = 0;
+      for (int bit = 0; bit < 8; bit++) {
+        if (i >> bit & 1) {
+          crc ^= shifted_bits[8 * j + bit];
+        }
+      }
+      checksum_shift_table[j][i] = crc;
+    }
+  }
+
+#if defined(__x86_64__)
+  checksum_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+uint32_t checksum_shift(uint32_t crc) {
+  return checksum_shift_table[0][crc & 0xff] ^
+         checksum_shift_table[1][crc >> 8 & 0xff] ^
+         checksum_shift_table[2][crc >> 16 & 0xff] ^
+         checksum_shift_table[3][crc >> 24];
+}
+
+uint32_t checksum_update_sw(uint32_t crc, const uint8_t* p, size_t size) {
+  while (size >= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    word ^= crc;
+    crc = checksum_table[7][word & 0xff] ^ checksum_table[6][word >> 8 & 0xff] ^
+          checksum_table[5][word >> 16 & 0xff] ^
+          checksum_table[4][word >> 24 & 0xff] ^
+          checksum_table[3][word >> 32 & 0xff] ^
+          checksum_table[2][word >> 40 & 0xff] ^
+          checksum_table[1][word >> 48 & 0xff] ^ checksum_table[0][word >> 56];
+    p += 8;
+    size -= 8;
+  }
+  while (size-- > 0) {
+    crc = checksum_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+
+// Three strides go through three independent registers. The first one is
+// then advanced over the other two, and the second over the third.
+__attribute__((target("sse4.2"))) uint32_t
+checksum_update_hw(uint32_t crc, const uint8_t* p, size_t size) {
+  while (size >= 3 * CHECKSUM_STRIDE) {
+    uint64_t crc0 = crc;
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    for (size_t i = 0; i < CHECKSUM_STRIDE; i += 8) {
+      uint64_t word0, word1, word2;
+      memcpy(&word0, p + i, 8);
+      memcpy(&word1, p + CHECKSUM_STRIDE + i, 8);
+      memcpy(&word2, p + 2 * CHECKSUM_STRIDE + i, 8);
+      crc0 = _mm_crc32_u64(crc0, word0);
+      crc1 = _mm_crc32_u64(crc1, word1);
+      crc2 = _mm_crc32_u64(crc2, word2);
+    }
+    crc = checksum_shift(checksum_shift(crc0) ^ crc1) ^ crc2;
+    p += 3 * CHECKSUM_STRIDE;
+    size -= 3 * CHECKSUM_STRIDE;
+  }
+
+  uint64_t crc64 = crc;
+  while (size >= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+    p += 8;
+    size -= 8;
+  }
+  crc = crc64;
+  while (size-- > 0) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+  return crc;
+}
+
+int checksum_has_hw() {
+  pthread_once(&checksum_once, checksum_init);
+  return checksum_hw;
+}
+
+#else
+
+uint32_t checksum_update_hw(uint32_t crc, const uint8_t* p, size_t size) {
+  return checksum_update_sw(crc, p, size);
+}
+
+int checksum_has_hw() {
+  return 0;
+}
+
+#endif
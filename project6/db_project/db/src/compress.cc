@@ -0,0 +1,189 @@
+#include "compress.h"
+
+// APIs.
+
+// Each sequence is a token, whose high nibble is the number of literals and
+// low nibble the match length minus MIN_MATCH, the literals, a 2-byte offset
+// and the rest of the lengths in bytes of 255. The last sequence has no
+// match.
+int compress_block(const uint8_t* src, int size, uint8_t* dst, int capacity) {
+  int table[HASH_SIZE];
+  memset(table, -1, sizeof(table));
+
+  uint8_t* op = dst;
+  const uint8_t* end = dst + capacity;
+
+  int anchor = 0;
+  int ip = 0;
+  while (ip + MATCH_FIND_LIMIT <= size) {
+    uint32_t sequence = compress_read32(src + ip);
+    uint32_t h = compress_hash(sequence);
+    int ref = table[h];
+    table[h] = ip;
+
+    if (ref < 0 || ip - ref > MAX_DISTANCE ||
+        compress_read32(src + ref) != sequence) {
+      ip++;
+      continue;
+    }
+
+    int match_length = MIN_MATCH;
+    while (ip + match_length < size - LAST_LITERALS &&
+           src[ref + match_length] == src[ip + match_length]) {
+      match_length++;
+    }
+
+    int num_literals = ip - anchor;
+    if (op >= end) {
+      return -1;
+    }
+
+    uint8_t* token = op++;
+    *token = (num_literals < 15 ? num_literals : 15) << 4;
+    if (num_literals >= 15 &&
+        compress_write_length(&op, end, num_literals - 15) < 0) {
+      return -1;
+    }
+    if (num_literals + 2 > end - op) {
+      return -1;
+    }
+    memcpy(op, src + anchor, num_literals);
+    op += num_literals;
+
+    uint16_t offset = ip - ref;
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+
+    int length = match_length - MIN_MATCH;
+    *token |= length < 15 ? length : 15;
+    if (length >= 15 && compress_write_length(&op, end, length - 15) < 0) {
+      return -1;
+    }
+
+    ip += match_length;
+    anchor = ip;
+  }
+
+  int num_literals = size - anchor;
+  if (op >= end) {
+    return -1;
+  }
+
+  uint8_t* token = op++;
+  *token = (num_literals < 15 ? num_literals : 15) << 4;
+  if (num_literals >= 15 &&
+      compress_write_length(&op, end, num_literals - 15) < 0) {
+    return -1;
+  }
+  if (num_literals > end - op) {
+    return -1;
+  }
+  memcpy(op, src + anchor, num_literals);
+  op += num_literals;
+
+  return op - dst;
+}
+
+int decompress_block(const uint8_t* src, int size, uint8_t* dst, int capacity) {
+  const uint8_t* ip = src;
+  const uint8_t* ip_end = src + size;
+  uint8_t* op = dst;
+  uint8_t* op_end = dst + capacity;
+
+  while (ip < ip_end) {
+    uint8_t token = *ip++;
+
+    int num_literals = token >> 4;
+    if (num_literals == 15) {
+      uint8_t b;
+      do {
+        if (ip >= ip_end) {
+          return -1;
+        }
+        b = *ip++;
+        num_literals += b;
+      } while (b == 255);
+    }
+    if (num_literals > ip_end - ip || num_literals > op_end - op) {
+      return -1;
+    }
+    memcpy(op, ip, num_literals);
+    ip += num_literals;
+    op += num_literals;
+
+    // The last sequence ends with its literals
+    if (ip == ip_end) {
+      break;
+    }
+
+    if (ip_end - ip < 2) {
+      return -1;
+    }
+    int offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > op - dst) {
+      return -1;
+    }
+
+    int match_length = token & 15;
+    if (match_length == 15) {
+      uint8_t b;
+      do {
+        if (ip >= ip_end) {
+          return -1;
+        }
+        b = *ip++;
+        match_length += b;
+      } while (b == 255);
+    }
+    match_length += MIN_MATCH;
+    if (match_length > op_end - op) {
+      return -1;
+    }
+
+    // A match closer than its length repeats its first offset bytes, so it
+    // is copied forward in pieces that do not overlap
+    const uint8_t* match = op - offset;
+    if (offset == 1) {
+      memset(op, *match, match_length);
+      op += match_length;
+    } else {
+      while (match_length > 0) {
+        int length = match_length < offset ? match_length : offset;
+        memcpy(op, match, length);
+        op += length;
+        match += length;
+        match_length -= length;
+      }
+    }
+  }
+
+  return op - dst;
+}
+
+// Utilities.
+
+uint32_t compress_read32(const uint8_t* p) {
+  uint32_t value;
+  memcpy(&value, p, 4);
+  return value;
+}
+
+uint32_t compress_hash(uint32_t sequence) {
+  return (sequence * 2654435761U) >> (32 - HASH_LOG);
+}
+
+int compress_write_length(uint8_t** op, const uint8_t* end, int length) {
+  while (length >= 255) {
+    if (*op >= end) {
+      return -1;
+    }
+    *(*op)++ = 255;
+    length -= 255;
+  }
+  if (*op >= end) {
+    return -1;
+  }
+  *(*op)++ = length;
+  return 0;
+}
@@ -4,6 +4,10 @@
 
 int32_t order = DEFAULT_ORDER;
 
+std::atomic<pagenum_t> db_roots[MAX_NUM_TABLE];
+
+std::atomic<uint64_t> db_num_descent_restarts;
+
 // APIs.
 
 // Open an existing database file or create one if not exist.
@@ -24,16 +28,20 @@ int db_insert(int64_t table_id,
     return -1;
   }
 
-  control_block_t* header_block = buf_read_page(table_id, 0);
-  pagenum_t root = db_get_root_page_number(header_block->frame);
-  buf_unpin_block(header_block, 0);
+  pagenum_t root = db_get_root(table_id);
 
   if (root == 0) {
     return db_start_new_tree(table_id, key, value, val_size);
   }
 
   pagenum_t leaf = db_find_leaf(table_id, root, key);
-  control_block_t* leaf_block = buf_read_page(table_id, leaf);
+  if (leaf == 0) {
+    return -1;
+  }
+  control_block_t* leaf_block = buf_read_page_shared(table_id, leaf);
+  if (leaf_block == NULL) {
+    return -1;
+  }
   int64_t free_space = db_get_amount_of_free_space(leaf_block->frame);
   buf_unpin_block(leaf_block, 0);
 
@@ -50,9 +58,14 @@ int db_find(int64_t table_id,
             char* ret_val,
             uint16_t* val_size,
             int trx_id) {
-  control_block_t* header_block = buf_read_page(table_id, 0);
-  pagenum_t root = db_get_root_page_number(header_block->frame);
-  buf_unpin_block(header_block, 0);
+  if (trx_id == 0) {
+    int result = db_find_mapped(table_id, key, ret_val, val_size);
+    if (result != MAPPED_READ_UNAVAILABLE) {
+      return result;
+    }
+  }
+
+  pagenum_t root = db_get_root(table_id);
 
   pagenum_t leaf = db_find_leaf(table_id, root, key);
   if (leaf == 0) {
@@ -67,7 +80,10 @@ int db_find(int64_t table_id,
     }
   }
 
-  control_block_t* leaf_block = buf_read_page(table_id, leaf);
+  control_block_t* leaf_block = buf_read_page_shared(table_id, leaf);
+  if (leaf_block == NULL) {
+    return -1;
+  }
   int32_t num_keys = db_get_number_of_keys(leaf_block->frame);
   slot_t* slots = new slot_t[num_keys];
   db_get_slots(leaf_block->frame, slots, num_keys);
@@ -104,10 +120,11 @@ int db_delete(int64_t table_id, int64_t key) {
     return -1;
   }
 
-  control_block_t* header_block = buf_read_page(table_id, 0);
-  pagenum_t root = db_get_root_page_number(header_block->frame);
+  pagenum_t root = db_get_root(table_id);
   pagenum_t leaf = db_find_leaf(table_id, root, key);
-  buf_unpin_block(header_block, 0);
+  if (leaf == 0) {
+    return -1;
+  }
 
   return db_delete_entry(table_id, root, leaf, key);
 }
@@ -119,16 +136,27 @@ int db_scan(int64_t table_id,
             std::vector<int64_t>* keys,
             std::vector<char*>* values,
             std::vector<uint16_t>* val_sizes) {
-  control_block_t* header_block = buf_read_page(table_id, 0);
-  pagenum_t root = db_get_root_page_number(header_block->frame);
-  buf_unpin_block(header_block, 0);
+  int result =
+      db_scan_mapped(table_id, begin_key, end_key, keys, values, val_sizes);
+  if (result != MAPPED_READ_UNAVAILABLE) {
+    return result;
+  }
+
+  pagenum_t root = db_get_root(table_id);
 
   pagenum_t page_num = db_find_leaf(table_id, root, begin_key);
   if (page_num == 0) {
     return -1;
   }
 
-  control_block_t* block = buf_read_page(table_id, page_num);
+  // The leaves are read once, so they don't replace the pages of others
+  int hint = buf_set_access_hint(ACCESS_SEQUENTIAL);
+
+  control_block_t* block = buf_read_page_shared(table_id, page_num);
+  if (block == NULL) {
+    buf_set_access_hint(hint);
+    return -1;
+  }
   int32_t num_keys = db_get_number_of_keys(block->frame);
   slot_t* slots = new slot_t[num_keys];
   db_get_slots(block->frame, slots, num_keys);
@@ -142,14 +170,17 @@ int db_scan(int64_t table_id,
   if (i == num_keys) {
     buf_unpin_block(block, 0);
     delete[] slots;
+    buf_set_access_hint(hint);
     return -1;
   }
 
+  read_ahead_t read_ahead = {};
   while (1) {
     for (; i < num_keys; i++) {
       if (slots[i].key > end_key) {
         buf_unpin_block(block, 0);
         delete[] slots;
+        buf_set_access_hint(hint);
         return 0;
       }
 
@@ -164,11 +195,17 @@ int db_scan(int64_t table_id,
     if (page_num == 0) {
       break;
     }
+    pagenum_t parent = db_get_parent_page_number(block->frame);
 
     buf_unpin_block(block, 0);
-    block = buf_read_page(table_id, page_num);
-    num_keys = db_get_number_of_keys(block->frame);
+    db_read_ahead(table_id, parent, page_num, &read_ahead);
+    block = buf_read_page_shared(table_id, page_num);
     delete[] slots;
+    if (block == NULL) {
+      buf_set_access_hint(hint);
+      return -1;
+    }
+    num_keys = db_get_number_of_keys(block->frame);
     slots = new slot_t[num_keys];
     db_get_slots(block->frame, slots, num_keys);
     i = 0;
@@ -177,6 +214,7 @@ int db_scan(int64_t table_id,
   buf_unpin_block(block, 0);
 
   delete[] slots;
+  buf_set_access_hint(hint);
 
   return 0;
 }
@@ -187,8 +225,9 @@ int init_db(int num_buf,
             int log_num,
             char* log_path,
             char* logmsg_path) {
-  return shutdown_db() || buf_init_db(num_buf) || init_lock_table() ||
-         log_init_db(log_path) || log_recover(flag, log_num, logmsg_path);
+  return shutdown_db() || buf_init_db(num_buf) || db_init_roots() ||
+         init_lock_table() || log_init_db(log_path) ||
+         log_recover(flag, log_num, logmsg_path);
 }
 
 // Shutdown the database system.
@@ -202,9 +241,7 @@ int db_update(int64_t table_id,
               uint16_t new_val_size,
               uint16_t* old_val_size,
               int trx_id) {
-  control_block_t* header_block = buf_read_page(table_id, 0);
-  pagenum_t root = db_get_root_page_number(header_block->frame);
-  buf_unpin_block(header_block, 0);
+  pagenum_t root = db_get_root(table_id);
 
   pagenum_t leaf = db_find_leaf(table_id, root, key);
   if (leaf == 0) {
@@ -218,6 +255,9 @@ int db_update(int64_t table_id,
   }
 
   control_block_t* leaf_block = buf_read_page(table_id, leaf);
+  if (leaf_block == NULL) {
+    return -1;
+  }
   int32_t num_keys = db_get_number_of_keys(leaf_block->frame);
   slot_t* slots = new slot_t[num_keys];
   db_get_slots(leaf_block->frame, slots, num_keys);
@@ -245,9 +285,7 @@ int db_update(int64_t table_id,
 
   log_t* log = log_make_update_log(trx_id, table_id, leaf, slots[i].offset,
                                    slots[i].size, old_val, value);
-  int64_t lsn = log_get_lsn(log);
-
-  log_add(log);
+  int64_t lsn = log_add(log);
 
   log_set_page_lsn(leaf_block->frame, lsn);
 
@@ -465,13 +503,135 @@ void db_set_children(page_t* internal,
 
 // Output and utility.
 
+// Forget the roots of the tables, to be read from their header pages again
+int db_init_roots() {
+  for (int64_t i = 0; i < MAX_NUM_TABLE; i++) {
+    db_roots[i] = ROOT_NOT_CACHED;
+  }
+  return 0;
+}
+
+// Return the root of the table without latching its header page, once read,
+// or ROOT_NOT_CACHED if the header page can't be read
+pagenum_t db_get_root(int64_t table_id) {
+  if (table_id >= 0 && table_id < MAX_NUM_TABLE) {
+    pagenum_t root = db_roots[table_id].load(std::memory_order_acquire);
+    if (root != ROOT_NOT_CACHED) {
+      return root;
+    }
+  }
+
+  // Cached under the header latch, as a new root is, so that a root read
+  // before a change never overwrites the new one
+  control_block_t* header_block = buf_read_page_shared(table_id, 0);
+  if (header_block == NULL) {
+    return ROOT_NOT_CACHED;
+  }
+  pagenum_t root = db_get_root_page_number(header_block->frame);
+  if (table_id >= 0 && table_id < MAX_NUM_TABLE) {
+    pagenum_t not_cached = ROOT_NOT_CACHED;
+    db_roots[table_id].compare_exchange_strong(not_cached, root);
+  }
+  buf_unpin_block(header_block, 0);
+  return root;
+}
+
+// Change the root of the table, whose header page is latched exclusively
+void db_set_root(int64_t table_id, page_t* header, pagenum_t root) {
+  db_set_root_page_number(header, root);
+  if (table_id >= 0 && table_id < MAX_NUM_TABLE) {
+    db_roots[table_id].store(root, std::memory_order_release);
+  }
+}
+
+// Return the leaf that may hold the key, or 0 for an empty tree or a page on
+// the way that can't be read
 pagenum_t db_find_leaf(int64_t table_id, pagenum_t root, int64_t key) {
-  if (root == 0) {
-    return root;
+  if (root == 0 || root == ROOT_NOT_CACHED) {
+    return 0;
+  }
+
+  pagenum_t leaf;
+  for (int i = 0; i < MAX_OPTIMISTIC_RESTARTS; i++) {
+    if (db_find_leaf_optimistic(table_id, root, key, &leaf) == 0) {
+      return leaf;
+    }
+    db_num_descent_restarts++;
   }
+  return db_find_leaf_latched(table_id, root, key);
+}
 
+// Descend without latching, reading each page only while its version stays
+// the same. The child to go to is trusted once the parent is found unchanged
+// after the child's version is taken, so a page split or freed meanwhile is
+// never followed. Children are found through the blocks swizzled into their
+// parents, so the page table is not looked up once the tree is cached. Fails
+// on any change, to be restarted from the root. A page that can't be read
+// ends the descent without a leaf.
+int db_find_leaf_optimistic(int64_t table_id,
+                            pagenum_t root,
+                            int64_t key,
+                            pagenum_t* leaf) {
+  uint64_t version;
   pagenum_t page_num = root;
-  control_block_t* block = buf_read_page(table_id, page_num);
+  control_block_t* block =
+      buf_read_page_optimistic(table_id, page_num, &version);
+  if (block == NULL) {
+    *leaf = 0;
+    return 0;
+  }
+
+  // A tree deeper than this can only be read while being written
+  for (int depth = 0; depth < 64; depth++) {
+    const page_t* page = block->frame;
+    if (db_get_is_leaf(page)) {
+      if (!buf_validate_block(block, version)) {
+        return -1;
+      }
+      *leaf = page_num;
+      return 0;
+    }
+
+    int32_t num_keys = db_get_number_of_keys(page);
+    if (num_keys < 0 || 128 + num_keys * 16 + 8 > PAGE_SIZE) {
+      return -1;
+    }
+
+    int32_t i = 0;
+    for (i = 0; i < num_keys; i++) {
+      if (key < db_get_key(page, i)) {
+        break;
+      }
+    }
+    page_num = db_get_child_page_number(page, i);
+    if (!buf_validate_block(block, version)) {
+      return -1;
+    }
+
+    uint64_t child_version;
+    control_block_t* child =
+        buf_read_child_optimistic(block, i, table_id, page_num, &child_version);
+    if (!buf_validate_block(block, version)) {
+      return -1;
+    }
+    if (child == NULL) {
+      *leaf = 0;
+      return 0;
+    }
+    block = child;
+    version = child_version;
+  }
+
+  return -1;
+}
+
+// Descend latching every page on the way, one at a time
+pagenum_t db_find_leaf_latched(int64_t table_id, pagenum_t root, int64_t key) {
+  pagenum_t page_num = root;
+  control_block_t* block = buf_read_page_shared(table_id, page_num);
+  if (block == NULL) {
+    return 0;
+  }
   int32_t is_leaf = db_get_is_leaf(block->frame);
   while (!is_leaf) {
     int32_t num_keys = db_get_number_of_keys(block->frame);
@@ -485,7 +645,10 @@ pagenum_t db_find_leaf(int64_t table_id, pagenum_t root, int64_t key) {
 
     page_num = db_get_child_page_number(block->frame, i);
     buf_unpin_block(block, 0);
-    block = buf_read_page(table_id, page_num);
+    block = buf_read_page_shared(table_id, page_num);
+    if (block == NULL) {
+      return 0;
+    }
     is_leaf = db_get_is_leaf(block->frame);
   }
 
@@ -494,6 +657,257 @@ pagenum_t db_find_leaf(int64_t table_id, pagenum_t root, int64_t key) {
   return page_num;
 }
 
+// The scan has moved on to the right sibling(leaf), so it reads sequentially.
+// Keep at least half a window of the leaves after it being read ahead, taken
+// from the children of their parent.
+void db_read_ahead(int64_t table_id,
+                   pagenum_t parent,
+                   pagenum_t leaf,
+                   read_ahead_t* read_ahead) {
+  size_t window = buf_read_ahead_window > 0 ? buf_read_ahead_window : 0;
+  if (window == 0 || parent == 0) {
+    return;
+  }
+
+  std::vector<pagenum_t>& leaves = read_ahead->leaves;
+  pagenum_t last = leaf;
+  if (read_ahead->next < leaves.size() && leaves[read_ahead->next] == leaf) {
+    read_ahead->next++;
+    if (leaves.size() - read_ahead->next >= window / 2) {
+      return;
+    }
+    last = leaves.back();
+    leaves.erase(leaves.begin(), leaves.begin() + read_ahead->next);
+    read_ahead->next = 0;
+  } else {
+    leaves.clear();
+    read_ahead->next = 0;
+  }
+
+  control_block_t* block = buf_read_page_shared(table_id, parent);
+  if (block == NULL) {
+    return;
+  }
+  if (db_get_is_leaf(block->frame)) {
+    buf_unpin_block(block, 0);
+    return;
+  }
+
+  int32_t num_keys = db_get_number_of_keys(block->frame);
+  std::vector<pagenum_t> children(num_keys + 1);
+  db_get_children(block->frame, children.data(), num_keys + 1);
+  buf_unpin_block(block, 0);
+
+  int32_t i = 0;
+  while (i <= num_keys && children[i] != last) {
+    i++;
+  }
+
+  // The leaves after the last child are read ahead from the next parent, once
+  // the scan gets there
+  size_t num_leaves = leaves.size();
+  for (i++; i <= num_keys && leaves.size() < window; i++) {
+    leaves.push_back(children[i]);
+  }
+  buf_prefetch_pages(table_id, std::vector<pagenum_t>(
+                                   leaves.begin() + num_leaves, leaves.end()));
+}
+
+// Reads through the mapping.
+
+// A read through the mapping skips the buffer pool entirely. It is only tried
+// while the buffer holds no page of the table newer than the file, and it is
+// discarded if any page of the file was written in the meantime, so a page
+// read halfway through a write is never trusted.
+
+// Descend the mapped tree to the leaf that may hold the key, which is NULL
+// for an empty tree. Fails on a page that is not mapped or not sane.
+int db_find_mapped_leaf(int64_t table_id, int64_t key, const page_t** leaf) {
+  const page_t* page = file_get_mapped_page(table_id, 0);
+  if (page == NULL) {
+    return -1;
+  }
+
+  pagenum_t page_num = db_get_root_page_number(page);
+  if (page_num == 0) {
+    *leaf = NULL;
+    return 0;
+  }
+
+  // A tree deeper than this can only be read while being written
+  for (int depth = 0; depth < 64; depth++) {
+    page = file_get_mapped_page(table_id, page_num);
+    if (page == NULL) {
+      return -1;
+    }
+
+    int32_t num_keys = db_get_number_of_keys(page);
+    if (db_get_is_leaf(page)) {
+      if (num_keys < 0 || 128 + num_keys * 12 > PAGE_SIZE) {
+        return -1;
+      }
+      *leaf = page;
+      return 0;
+    }
+    if (num_keys < 0 || 128 + num_keys * 16 + 8 > PAGE_SIZE) {
+      return -1;
+    }
+
+    int32_t i = 0;
+    for (i = 0; i < num_keys; i++) {
+      if (key < db_get_key(page, i)) {
+        break;
+      }
+    }
+    page_num = db_get_child_page_number(page, i);
+  }
+
+  return -1;
+}
+
+int db_get_mapped_slot(const page_t* leaf, int32_t index, slot_t* slot) {
+  *slot = db_get_slot(leaf, index);
+  if (slot->size > MAX_VAL_SIZE || slot->offset + slot->size > PAGE_SIZE) {
+    return -1;
+  }
+  return 0;
+}
+
+int db_find_mapped(int64_t table_id,
+                   int64_t key,
+                   char* ret_val,
+                   uint16_t* val_size) {
+  uint64_t snapshot;
+  if (buf_count_dirty_pages(table_id) != 0 ||
+      file_begin_mapped_read(table_id, &snapshot) != 0) {
+    return MAPPED_READ_UNAVAILABLE;
+  }
+
+  const page_t* leaf;
+  if (db_find_mapped_leaf(table_id, key, &leaf) != 0) {
+    return MAPPED_READ_UNAVAILABLE;
+  }
+
+  int result = -1;
+  if (leaf != NULL) {
+    int32_t num_keys = db_get_number_of_keys(leaf);
+    for (int32_t i = 0; i < num_keys; i++) {
+      slot_t slot;
+      if (db_get_mapped_slot(leaf, i, &slot) != 0) {
+        return MAPPED_READ_UNAVAILABLE;
+      }
+      if (slot.key != key) {
+        continue;
+      }
+
+      if (ret_val != NULL) {
+        db_get_value(ret_val, leaf, slot.size, slot.offset);
+      }
+      if (val_size != NULL) {
+        *val_size = slot.size;
+      }
+      result = 0;
+      break;
+    }
+  }
+
+  if (file_end_mapped_read(table_id, snapshot) != 0) {
+    return MAPPED_READ_UNAVAILABLE;
+  }
+  return result;
+}
+
+int db_scan_mapped(int64_t table_id,
+                   int64_t begin_key,
+                   int64_t end_key,
+                   std::vector<int64_t>* keys,
+                   std::vector<char*>* values,
+                   std::vector<uint16_t>* val_sizes) {
+  uint64_t snapshot;
+  if (buf_count_dirty_pages(table_id) != 0 ||
+      file_begin_mapped_read(table_id, &snapshot) != 0) {
+    return MAPPED_READ_UNAVAILABLE;
+  }
+
+  const page_t* leaf;
+  if (db_find_mapped_leaf(table_id, begin_key, &leaf) != 0) {
+    return MAPPED_READ_UNAVAILABLE;
+  }
+  if (leaf == NULL) {
+    return file_end_mapped_read(table_id, snapshot) == 0
+               ? -1
+               : MAPPED_READ_UNAVAILABLE;
+  }
+
+  // Records are collected aside until the whole scan is known to be valid
+  std::vector<slot_t> slots;
+  std::vector<char*> found_values;
+  int result = 0;
+  int is_first = 1;
+  while (leaf != NULL) {
+    int32_t num_keys = db_get_number_of_keys(leaf);
+    if (num_keys < 0 || 128 + num_keys * 12 > PAGE_SIZE) {
+      result = MAPPED_READ_UNAVAILABLE;
+      break;
+    }
+
+    int32_t i = 0;
+    slot_t slot;
+    for (i = 0; i < num_keys; i++) {
+      if (db_get_mapped_slot(leaf, i, &slot) != 0) {
+        result = MAPPED_READ_UNAVAILABLE;
+        break;
+      }
+      if (slot.key > end_key) {
+        break;
+      }
+      if (slot.key < begin_key) {
+        continue;
+      }
+
+      char* value = new char[slot.size];
+      db_get_value(value, leaf, slot.size, slot.offset);
+      slots.push_back(slot);
+      found_values.push_back(value);
+    }
+    if (result != 0 || i < num_keys) {
+      break;
+    }
+    if (is_first && slots.empty()) {
+      result = -1;
+      break;
+    }
+    is_first = 0;
+
+    pagenum_t page_num = db_get_right_sibling_page_number(leaf);
+    if (page_num == 0) {
+      break;
+    }
+    leaf = file_get_mapped_page(table_id, page_num);
+    if (leaf == NULL) {
+      result = MAPPED_READ_UNAVAILABLE;
+    }
+  }
+
+  if (result != MAPPED_READ_UNAVAILABLE &&
+      file_end_mapped_read(table_id, snapshot) != 0) {
+    result = MAPPED_READ_UNAVAILABLE;
+  }
+  if (result != 0) {
+    for (char* value : found_values) {
+      delete[] value;
+    }
+    return result;
+  }
+
+  for (size_t i = 0; i < slots.size(); i++) {
+    keys->push_back(slots[i].key);
+    val_sizes->push_back(slots[i].size);
+    values->push_back(found_values[i]);
+  }
+  return 0;
+}
+
 int32_t cut(int32_t length) {
   if (length % 2 == 0) {
     return length / 2;
@@ -511,9 +925,18 @@ slot_t db_make_slot(int64_t key, uint16_t val_size, uint16_t offset) {
   return slot;
 }
 
+// Returns 0 if no page can be allocated. A page allocated but not readable is
+// freed, to be written whole once the checkpoint links it into the free list.
 pagenum_t db_make_page(int64_t table_id) {
   pagenum_t page_num = buf_alloc_page(table_id);
+  if (page_num == 0) {
+    return 0;
+  }
   control_block_t* block = buf_read_page(table_id, page_num);
+  if (block == NULL) {
+    buf_free_page(table_id, page_num);
+    return 0;
+  }
 
   db_set_is_leaf(block->frame, 0);
   db_set_number_of_keys(block->frame, 0);
@@ -527,7 +950,14 @@ pagenum_t db_make_page(int64_t table_id) {
 
 pagenum_t db_make_leaf(int64_t table_id) {
   pagenum_t page_num = db_make_page(table_id);
+  if (page_num == 0) {
+    return 0;
+  }
   control_block_t* block = buf_read_page(table_id, page_num);
+  if (block == NULL) {
+    buf_free_page(table_id, page_num);
+    return 0;
+  }
 
   db_set_is_leaf(block->frame, 1);
   db_set_amount_of_free_space(block->frame, PAGE_SIZE - 128);
@@ -538,8 +968,12 @@ pagenum_t db_make_leaf(int64_t table_id) {
   return page_num;
 }
 
+// Returns -1 if the parent can't be read
 int32_t db_get_left_index(int64_t table_id, pagenum_t parent, pagenum_t left) {
   control_block_t* parent_block = buf_read_page(table_id, parent);
+  if (parent_block == NULL) {
+    return -1;
+  }
   int32_t num_keys = db_get_number_of_keys(parent_block->frame);
 
   int32_t left_index;
@@ -554,12 +988,41 @@ int32_t db_get_left_index(int64_t table_id, pagenum_t parent, pagenum_t left) {
   return left_index;
 }
 
+// Point the children at their parent. If a child can't be read, the ones
+// changed before it are pointed back at old_parent, so a split or merge can
+// still be given up.
+int db_set_parents(int64_t table_id,
+                   const pagenum_t* children,
+                   int32_t num_children,
+                   pagenum_t parent,
+                   pagenum_t old_parent) {
+  for (int32_t i = 0; i < num_children; i++) {
+    control_block_t* block = buf_read_page(table_id, children[i]);
+    if (block == NULL) {
+      for (int32_t j = 0; j < i; j++) {
+        block = buf_read_page(table_id, children[j]);
+        if (block != NULL) {
+          db_set_parent_page_number(block->frame, old_parent);
+          buf_unpin_block(block, 1);
+        }
+      }
+      return -1;
+    }
+    db_set_parent_page_number(block->frame, parent);
+    buf_unpin_block(block, 1);
+  }
+  return 0;
+}
+
 int db_insert_into_leaf(int64_t table_id,
                         pagenum_t leaf,
                         int64_t key,
                         const char* value,
                         uint16_t val_size) {
   control_block_t* leaf_block = buf_read_page(table_id, leaf);
+  if (leaf_block == NULL) {
+    return -1;
+  }
   int32_t num_keys = db_get_number_of_keys(leaf_block->frame);
   int64_t free_space = db_get_amount_of_free_space(leaf_block->frame);
   uint16_t offset = 128 + num_keys * 12 + free_space - val_size;
@@ -597,6 +1060,23 @@ int db_insert_into_leaf_after_splitting(int64_t table_id,
                                         const char* value,
                                         uint16_t val_size) {
   control_block_t* leaf_block = buf_read_page(table_id, leaf);
+  if (leaf_block == NULL) {
+    return -1;
+  }
+
+  // Taken before the leaf is changed, so that it is left whole on a failure
+  pagenum_t new_leaf = db_make_leaf(table_id);
+  if (new_leaf == 0) {
+    buf_unpin_block(leaf_block, 0);
+    return -1;
+  }
+  control_block_t* new_leaf_block = buf_read_page(table_id, new_leaf);
+  if (new_leaf_block == NULL) {
+    buf_unpin_block(leaf_block, 0);
+    buf_free_page(table_id, new_leaf);
+    return -1;
+  }
+
   int32_t num_keys = db_get_number_of_keys(leaf_block->frame);
   slot_t* slots = new slot_t[num_keys + 1];
   db_get_slots(leaf_block->frame, slots, num_keys);
@@ -629,9 +1109,6 @@ int db_insert_into_leaf_after_splitting(int64_t table_id,
 
   db_set_all_values_and_headers(leaf_block->frame, slots, values, split_index);
 
-  pagenum_t new_leaf = db_make_leaf(table_id);
-  control_block_t* new_leaf_block = buf_read_page(table_id, new_leaf);
-
   db_set_all_values_and_headers(new_leaf_block->frame, slots + split_index,
                                 values + split_index,
                                 (num_keys + 1) - split_index);
@@ -663,6 +1140,9 @@ int db_insert_into_internal(int64_t table_id,
                             int64_t key,
                             pagenum_t right) {
   control_block_t* parent_block = buf_read_page(table_id, parent);
+  if (parent_block == NULL) {
+    return -1;
+  }
   int32_t num_keys = db_get_number_of_keys(parent_block->frame);
 
   int64_t* keys = new int64_t[num_keys + 1];
@@ -698,6 +1178,22 @@ int db_insert_into_internal_after_splitting(int64_t table_id,
                                             int64_t key,
                                             pagenum_t right) {
   control_block_t* internal_block = buf_read_page(table_id, internal);
+  if (internal_block == NULL) {
+    return -1;
+  }
+
+  pagenum_t new_internal = db_make_page(table_id);
+  if (new_internal == 0) {
+    buf_unpin_block(internal_block, 0);
+    return -1;
+  }
+  control_block_t* new_internal_block = buf_read_page(table_id, new_internal);
+  if (new_internal_block == NULL) {
+    buf_unpin_block(internal_block, 0);
+    buf_free_page(table_id, new_internal);
+    return -1;
+  }
+
   int32_t num_keys = db_get_number_of_keys(internal_block->frame);
   int64_t* keys = new int64_t[num_keys + 1];
   db_get_keys(internal_block->frame, keys, num_keys);
@@ -713,13 +1209,6 @@ int db_insert_into_internal_after_splitting(int64_t table_id,
 
   int32_t split = (num_keys + 2) / 2;
 
-  pagenum_t new_internal = db_make_page(table_id);
-  control_block_t* new_internal_block = buf_read_page(table_id, new_internal);
-
-  db_set_children(internal_block->frame, children, split);
-  db_set_keys(internal_block->frame, keys, split - 1);
-  db_set_number_of_keys(internal_block->frame, split - 1);
-
   int32_t k_prime = keys[split - 1];
 
   int32_t new_num_keys = (num_keys + 1) - (split - 1) - 1;
@@ -731,13 +1220,21 @@ int db_insert_into_internal_after_splitting(int64_t table_id,
   pagenum_t parent = db_get_parent_page_number(internal_block->frame);
   db_set_parent_page_number(new_internal_block->frame, parent);
 
-  for (int32_t i = 0; i <= new_num_keys; i++) {
-    pagenum_t child = db_get_child_page_number(new_internal_block->frame, i);
-    control_block_t* child_block = buf_read_page(table_id, child);
-    db_set_parent_page_number(child_block->frame, new_internal);
-    buf_unpin_block(child_block, 1);
+  // The children move before the page is cut, so that it is left whole if
+  // one of them can't be read
+  if (db_set_parents(table_id, children + split, new_num_keys + 1,
+                     new_internal, internal) != 0) {
+    buf_unpin_block(internal_block, 0);
+    buf_free_page(table_id, new_internal);
+    delete[] children;
+    delete[] keys;
+    return -1;
   }
 
+  db_set_children(internal_block->frame, children, split);
+  db_set_keys(internal_block->frame, keys, split - 1);
+  db_set_number_of_keys(internal_block->frame, split - 1);
+
   buf_unpin_block(internal_block, 1);
   buf_unpin_block(new_internal_block, 1);
 
@@ -752,6 +1249,9 @@ int db_insert_into_parent(int64_t table_id,
                           int64_t key,
                           pagenum_t right) {
   control_block_t* left_block = buf_read_page(table_id, left);
+  if (left_block == NULL) {
+    return -1;
+  }
   pagenum_t parent = db_get_parent_page_number(left_block->frame);
   buf_unpin_block(left_block, 0);
 
@@ -760,8 +1260,14 @@ int db_insert_into_parent(int64_t table_id,
   }
 
   int32_t left_index = db_get_left_index(table_id, parent, left);
+  if (left_index < 0) {
+    return -1;
+  }
 
   control_block_t* parent_block = buf_read_page(table_id, parent);
+  if (parent_block == NULL) {
+    return -1;
+  }
   int32_t num_keys = db_get_number_of_keys(parent_block->frame);
   buf_unpin_block(parent_block, 0);
 
@@ -777,7 +1283,27 @@ int db_insert_into_new_root(int64_t table_id,
                             int64_t key,
                             pagenum_t right) {
   pagenum_t root = db_make_page(table_id);
+  if (root == 0) {
+    return -1;
+  }
+
   control_block_t* root_block = buf_read_page(table_id, root);
+  control_block_t* header_block =
+      root_block == NULL ? NULL : buf_read_page(table_id, 0);
+  control_block_t* left_block =
+      header_block == NULL ? NULL : buf_read_page(table_id, left);
+  control_block_t* right_block =
+      left_block == NULL ? NULL : buf_read_page(table_id, right);
+  if (right_block == NULL) {
+    if (left_block != NULL) {
+      buf_unpin_block(left_block, 0);
+    }
+    if (header_block != NULL) {
+      buf_unpin_block(header_block, 0);
+    }
+    buf_free_page(table_id, root);
+    return -1;
+  }
 
   db_set_key(root_block->frame, key, 0);
   db_set_child_page_number(root_block->frame, left, 0);
@@ -787,13 +1313,8 @@ int db_insert_into_new_root(int64_t table_id,
   int64_t free_space = db_get_amount_of_free_space(root_block->frame);
   db_set_amount_of_free_space(root_block->frame, free_space - 3 * 8);
 
-  control_block_t* header_block = buf_read_page(table_id, 0);
-  db_set_root_page_number(header_block->frame, root);
-
-  control_block_t* left_block = buf_read_page(table_id, left);
+  db_set_root(table_id, header_block->frame, root);
   db_set_parent_page_number(left_block->frame, root);
-
-  control_block_t* right_block = buf_read_page(table_id, right);
   db_set_parent_page_number(right_block->frame, root);
 
   buf_unpin_block(root_block, 1);
@@ -809,7 +1330,17 @@ int db_start_new_tree(int64_t table_id,
                       const char* value,
                       uint16_t val_size) {
   pagenum_t root = db_make_leaf(table_id);
+  if (root == 0) {
+    return -1;
+  }
+
   control_block_t* root_block = buf_read_page(table_id, root);
+  control_block_t* header_block =
+      root_block == NULL ? NULL : buf_read_page(table_id, 0);
+  if (header_block == NULL) {
+    buf_free_page(table_id, root);
+    return -1;
+  }
 
   uint16_t offset = PAGE_SIZE - val_size;
   slot_t slot = db_make_slot(key, val_size, offset);
@@ -820,8 +1351,7 @@ int db_start_new_tree(int64_t table_id,
   int64_t free_space = db_get_amount_of_free_space(root_block->frame);
   db_set_amount_of_free_space(root_block->frame, free_space - (12 + val_size));
 
-  control_block_t* header_block = buf_read_page(table_id, 0);
-  db_set_root_page_number(header_block->frame, root);
+  db_set_root(table_id, header_block->frame, root);
 
   buf_unpin_block(root_block, 1);
   buf_unpin_block(header_block, 1);
@@ -831,15 +1361,10 @@ int db_start_new_tree(int64_t table_id,
 
 // Deletion.
 
-int32_t db_get_neighbor_index(int64_t table_id, pagenum_t page_num) {
-  control_block_t* block = buf_read_page(table_id, page_num);
-
-  pagenum_t parent = db_get_parent_page_number(block->frame);
-  control_block_t* parent_block = buf_read_page(table_id, parent);
-
-  int32_t num_keys = db_get_number_of_keys(parent_block->frame);
+int32_t db_get_neighbor_index(const page_t* parent, pagenum_t page_num) {
+  int32_t num_keys = db_get_number_of_keys(parent);
   pagenum_t* children = new pagenum_t[num_keys + 1];
-  db_get_children(parent_block->frame, children, num_keys + 1);
+  db_get_children(parent, children, num_keys + 1);
 
   int32_t i;
   for (i = 0; i <= num_keys; i++) {
@@ -848,16 +1373,16 @@ int32_t db_get_neighbor_index(int64_t table_id, pagenum_t page_num) {
     }
   }
 
-  buf_unpin_block(block, 0);
-  buf_unpin_block(parent_block, 0);
-
   delete[] children;
 
   return i - 1;
 }
 
-void db_remove_entry_from_leaf(int64_t table_id, pagenum_t leaf, int64_t key) {
+int db_remove_entry_from_leaf(int64_t table_id, pagenum_t leaf, int64_t key) {
   control_block_t* leaf_block = buf_read_page(table_id, leaf);
+  if (leaf_block == NULL) {
+    return -1;
+  }
   int32_t num_keys = db_get_number_of_keys(leaf_block->frame);
   slot_t* slots = new slot_t[num_keys];
   db_get_slots(leaf_block->frame, slots, num_keys);
@@ -882,12 +1407,17 @@ void db_remove_entry_from_leaf(int64_t table_id, pagenum_t leaf, int64_t key) {
     delete[] values[i];
   }
   delete[] values;
+
+  return 0;
 }
 
-void db_remove_entry_from_internal(int64_t table_id,
-                                   pagenum_t internal,
-                                   int64_t key) {
+int db_remove_entry_from_internal(int64_t table_id,
+                                  pagenum_t internal,
+                                  int64_t key) {
   control_block_t* internal_block = buf_read_page(table_id, internal);
+  if (internal_block == NULL) {
+    return -1;
+  }
   int32_t num_keys = db_get_number_of_keys(internal_block->frame);
   int64_t* keys = new int64_t[num_keys];
   db_get_keys(internal_block->frame, keys, num_keys);
@@ -910,10 +1440,15 @@ void db_remove_entry_from_internal(int64_t table_id,
 
   delete[] keys;
   delete[] children;
+
+  return 0;
 }
 
 int db_adjust_root(int64_t table_id, pagenum_t root) {
   control_block_t* root_block = buf_read_page(table_id, root);
+  if (root_block == NULL) {
+    return -1;
+  }
 
   int32_t num_keys = db_get_number_of_keys(root_block->frame);
   if (num_keys > 0) {
@@ -922,17 +1457,32 @@ int db_adjust_root(int64_t table_id, pagenum_t root) {
   }
 
   pagenum_t new_root = 0;
+  control_block_t* new_root_block = NULL;
 
   int32_t is_leaf = db_get_is_leaf(root_block->frame);
   if (!is_leaf) {
     new_root = db_get_child_page_number(root_block->frame, 0);
-    control_block_t* new_root_block = buf_read_page(table_id, new_root);
-    db_set_parent_page_number(new_root_block->frame, 0);
-    buf_unpin_block(new_root_block, 1);
+    new_root_block = buf_read_page(table_id, new_root);
+    if (new_root_block == NULL) {
+      buf_unpin_block(root_block, 0);
+      return -1;
+    }
   }
 
   control_block_t* header_block = buf_read_page(table_id, 0);
-  db_set_root_page_number(header_block->frame, new_root);
+  if (header_block == NULL) {
+    if (new_root_block != NULL) {
+      buf_unpin_block(new_root_block, 0);
+    }
+    buf_unpin_block(root_block, 0);
+    return -1;
+  }
+
+  if (new_root_block != NULL) {
+    db_set_parent_page_number(new_root_block->frame, 0);
+    buf_unpin_block(new_root_block, 1);
+  }
+  db_set_root(table_id, header_block->frame, new_root);
   buf_unpin_block(header_block, 1);
 
   buf_free_page(table_id, root);
@@ -951,13 +1501,21 @@ int db_coalesce_leafs(int64_t table_id,
   }
 
   control_block_t* leaf_block = buf_read_page(table_id, leaf);
+  if (leaf_block == NULL) {
+    return -1;
+  }
+  control_block_t* neighbor_block = buf_read_page(table_id, neighbor);
+  if (neighbor_block == NULL) {
+    buf_unpin_block(leaf_block, 0);
+    return -1;
+  }
+
   int32_t num_keys = db_get_number_of_keys(leaf_block->frame);
   slot_t* slots = new slot_t[num_keys];
   db_get_slots(leaf_block->frame, slots, num_keys);
   char** values = new char*[num_keys];
   db_get_values(leaf_block->frame, slots, values, num_keys);
 
-  control_block_t* neighbor_block = buf_read_page(table_id, neighbor);
   int32_t neighbor_num_keys = db_get_number_of_keys(neighbor_block->frame);
   slot_t* neighbor_slots = new slot_t[neighbor_num_keys + num_keys];
   db_get_slots(neighbor_block->frame, neighbor_slots, neighbor_num_keys);
@@ -1003,13 +1561,21 @@ int db_coalesce_internals(int64_t table_id,
   }
 
   control_block_t* internal_block = buf_read_page(table_id, internal);
+  if (internal_block == NULL) {
+    return -1;
+  }
+  control_block_t* neighbor_block = buf_read_page(table_id, neighbor);
+  if (neighbor_block == NULL) {
+    buf_unpin_block(internal_block, 0);
+    return -1;
+  }
+
   int32_t num_keys = db_get_number_of_keys(internal_block->frame);
   int64_t* keys = new int64_t[num_keys];
   db_get_keys(internal_block->frame, keys, num_keys);
   pagenum_t* children = new pagenum_t[num_keys + 1];
   db_get_children(internal_block->frame, children, num_keys + 1);
 
-  control_block_t* neighbor_block = buf_read_page(table_id, neighbor);
   int32_t neighbor_num_keys = db_get_number_of_keys(neighbor_block->frame);
   int64_t* neighbor_keys = new int64_t[neighbor_num_keys + num_keys + 1];
   db_get_keys(neighbor_block->frame, neighbor_keys, neighbor_num_keys);
@@ -1027,11 +1593,15 @@ int db_coalesce_internals(int64_t table_id,
   }
   neighbor_children[neighbor_num_keys + num_keys + 1] = children[num_keys];
 
-  for (int32_t i = 0; i < num_keys + 1; i++) {
-    pagenum_t temp = neighbor_children[i + neighbor_num_keys + 1];
-    control_block_t* temp_block = buf_read_page(table_id, temp);
-    db_set_parent_page_number(temp_block->frame, neighbor);
-    buf_unpin_block(temp_block, 1);
+  if (db_set_parents(table_id, children, num_keys + 1, neighbor, internal) !=
+      0) {
+    buf_unpin_block(internal_block, 0);
+    buf_unpin_block(neighbor_block, 0);
+    delete[] keys;
+    delete[] children;
+    delete[] neighbor_keys;
+    delete[] neighbor_children;
+    return -1;
   }
 
   db_set_keys(neighbor_block->frame, neighbor_keys,
@@ -1060,6 +1630,22 @@ int db_redistribute_leafs(int64_t table_id,
                           int32_t k_prime_index,
                           int64_t k_prime) {
   control_block_t* neighbor_block = buf_read_page(table_id, neighbor);
+  if (neighbor_block == NULL) {
+    return -1;
+  }
+  control_block_t* leaf_block = buf_read_page(table_id, leaf);
+  if (leaf_block == NULL) {
+    buf_unpin_block(neighbor_block, 0);
+    return -1;
+  }
+  pagenum_t parent = db_get_parent_page_number(leaf_block->frame);
+  control_block_t* parent_block = buf_read_page(table_id, parent);
+  if (parent_block == NULL) {
+    buf_unpin_block(leaf_block, 0);
+    buf_unpin_block(neighbor_block, 0);
+    return -1;
+  }
+
   int32_t neighbor_num_keys = db_get_number_of_keys(neighbor_block->frame);
   slot_t* neighbor_slots = new slot_t[neighbor_num_keys];
   db_get_slots(neighbor_block->frame, neighbor_slots, neighbor_num_keys);
@@ -1090,15 +1676,12 @@ int db_redistribute_leafs(int64_t table_id,
     }
   }
 
-  control_block_t* leaf_block = buf_read_page(table_id, leaf);
   int32_t num_keys = db_get_number_of_keys(leaf_block->frame);
   slot_t* slots = new slot_t[num_keys + num_split];
   db_get_slots(leaf_block->frame, slots, num_keys);
   char** values = new char*[num_keys + num_split];
   db_get_values(leaf_block->frame, slots, values, num_keys);
 
-  pagenum_t parent = db_get_parent_page_number(leaf_block->frame);
-  control_block_t* parent_block = buf_read_page(table_id, parent);
   int32_t parent_num_keys = db_get_number_of_keys(parent_block->frame);
   int64_t* parent_keys = new int64_t[parent_num_keys];
   db_get_keys(parent_block->frame, parent_keys, parent_num_keys);
@@ -1157,13 +1740,28 @@ int db_redistribute_internals(int64_t table_id,
                               int32_t k_prime_index,
                               int64_t k_prime) {
   control_block_t* internal_block = buf_read_page(table_id, internal);
+  if (internal_block == NULL) {
+    return -1;
+  }
+  control_block_t* neighbor_block = buf_read_page(table_id, neighbor);
+  if (neighbor_block == NULL) {
+    buf_unpin_block(internal_block, 0);
+    return -1;
+  }
+  pagenum_t parent = db_get_parent_page_number(internal_block->frame);
+  control_block_t* parent_block = buf_read_page(table_id, parent);
+  if (parent_block == NULL) {
+    buf_unpin_block(neighbor_block, 0);
+    buf_unpin_block(internal_block, 0);
+    return -1;
+  }
+
   int32_t num_keys = db_get_number_of_keys(internal_block->frame);
   int64_t* keys = new int64_t[num_keys + 1];
   db_get_keys(internal_block->frame, keys, num_keys + 1);
   pagenum_t* children = new pagenum_t[num_keys + 2];
   db_get_children(internal_block->frame, children, num_keys + 2);
 
-  control_block_t* neighbor_block = buf_read_page(table_id, neighbor);
   int32_t neighbor_num_keys = db_get_number_of_keys(neighbor_block->frame);
   int64_t* neighbor_keys = new int64_t[neighbor_num_keys];
   db_get_keys(neighbor_block->frame, neighbor_keys, neighbor_num_keys);
@@ -1171,8 +1769,6 @@ int db_redistribute_internals(int64_t table_id,
   db_get_children(neighbor_block->frame, neighbor_children,
                   neighbor_num_keys + 1);
 
-  pagenum_t parent = db_get_parent_page_number(internal_block->frame);
-  control_block_t* parent_block = buf_read_page(table_id, parent);
   int32_t parent_num_keys = db_get_number_of_keys(parent_block->frame);
   int64_t* parent_keys = new int64_t[parent_num_keys];
   db_get_keys(parent_block->frame, parent_keys, parent_num_keys);
@@ -1187,11 +1783,6 @@ int db_redistribute_internals(int64_t table_id,
 
     keys[0] = k_prime;
     parent_keys[k_prime_index] = neighbor_keys[neighbor_num_keys - 1];
-
-    pagenum_t temp = children[0];
-    control_block_t* temp_block = buf_read_page(table_id, temp);
-    db_set_parent_page_number(temp_block->frame, internal);
-    buf_unpin_block(temp_block, 1);
   } else {
     keys[num_keys] = k_prime;
     parent_keys[k_prime_index] = neighbor_keys[0];
@@ -1203,11 +1794,21 @@ int db_redistribute_internals(int64_t table_id,
       neighbor_children[i] = neighbor_children[i + 1];
     }
     neighbor_children[i] = neighbor_children[i + 1];
+  }
 
-    pagenum_t temp = children[num_keys + 1];
-    control_block_t* temp_block = buf_read_page(table_id, temp);
-    db_set_parent_page_number(temp_block->frame, internal);
-    buf_unpin_block(temp_block, 1);
+  // The child moved over is pointed at its new parent first, so that the three
+  // pages are left whole if it can't be read
+  pagenum_t moved = neighbor_index != -1 ? children[0] : children[num_keys + 1];
+  if (db_set_parents(table_id, &moved, 1, internal, neighbor) != 0) {
+    buf_unpin_block(internal_block, 0);
+    buf_unpin_block(neighbor_block, 0);
+    buf_unpin_block(parent_block, 0);
+    delete[] keys;
+    delete[] children;
+    delete[] neighbor_keys;
+    delete[] neighbor_children;
+    delete[] parent_keys;
+    return -1;
   }
 
   db_set_number_of_keys(internal_block->frame, num_keys + 1);
@@ -1237,20 +1838,28 @@ int db_delete_entry(int64_t table_id,
                     pagenum_t page_num,
                     int64_t key) {
   control_block_t* block = buf_read_page(table_id, page_num);
+  if (block == NULL) {
+    return -1;
+  }
   int32_t is_leaf = db_get_is_leaf(block->frame);
   buf_unpin_block(block, 0);
 
-  if (is_leaf) {
-    db_remove_entry_from_leaf(table_id, page_num, key);
-  } else {
-    db_remove_entry_from_internal(table_id, page_num, key);
+  int result = is_leaf ? db_remove_entry_from_leaf(table_id, page_num, key)
+                       : db_remove_entry_from_internal(table_id, page_num, key);
+  if (result != 0) {
+    return -1;
   }
 
   if (page_num == root) {
     return db_adjust_root(table_id, root);
   }
 
+  // From here on the entry is gone, and a page that can't be read only leaves
+  // the page less than half full
   block = buf_read_page(table_id, page_num);
+  if (block == NULL) {
+    return -1;
+  }
   int64_t free_space = db_get_amount_of_free_space(block->frame);
   int32_t num_keys = db_get_number_of_keys(block->frame);
   pagenum_t parent = db_get_parent_page_number(block->frame);
@@ -1267,10 +1876,14 @@ int db_delete_entry(int64_t table_id,
     }
   }
 
-  int32_t neighbor_index = db_get_neighbor_index(table_id, page_num);
+  control_block_t* parent_block = buf_read_page(table_id, parent);
+  if (parent_block == NULL) {
+    return -1;
+  }
+
+  int32_t neighbor_index = db_get_neighbor_index(parent_block->frame, page_num);
   int32_t k_prime_index = neighbor_index == -1 ? 0 : neighbor_index;
 
-  control_block_t* parent_block = buf_read_page(table_id, parent);
   int64_t k_prime = db_get_key(parent_block->frame, k_prime_index);
 
   pagenum_t neighbor =
@@ -1278,6 +1891,10 @@ int db_delete_entry(int64_t table_id,
           ? db_get_child_page_number(parent_block->frame, 1)
           : db_get_child_page_number(parent_block->frame, neighbor_index);
   control_block_t* neighbor_block = buf_read_page(table_id, neighbor);
+  if (neighbor_block == NULL) {
+    buf_unpin_block(parent_block, 0);
+    return -1;
+  }
   int32_t neighbor_num_keys = db_get_number_of_keys(neighbor_block->frame);
   int64_t neighbor_free_space =
       db_get_amount_of_free_space(neighbor_block->frame);
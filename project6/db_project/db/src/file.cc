@@ -1,168 +1,1629 @@
 #include "file.h"
 
-std::unordered_map<int64_t, int> fd_table;
+table_desc_t table_descs[MAX_NUM_TABLE];
+std::unordered_map<std::string, int64_t> table_ids;
+pthread_mutex_t table_desc_latch = PTHREAD_MUTEX_INITIALIZER;
+
+int num_open_files = 0;
+int file_max_open_files = DEFAULT_MAX_OPEN_FILES;
+std::vector<int64_t> file_open_tables;
+
+// Whether the catalog was read since the process started
+static int file_catalog_loaded = 0;
+
+std::atomic<uint64_t> file_clock;
+
+int file_sync_mode = SYNC_ON_CHECKPOINT;
+std::atomic<uint64_t> file_num_syncs;
+
+int file_growth_policy = GROWTH_DOUBLING;
+uint64_t file_extent_size = DEFAULT_EXTENT_SIZE;
+
+int file_direct_io = 0;
+
+int file_mmap_reads = 0;
+
+int file_page_format = PAGE_FORMAT_RAW;
+
+int file_checksum_mode = CHECKSUM_ON_READ;
+int file_in_recovery = 0;
+
+std::atomic<uint64_t> file_num_checksum_failures;
+
+int file_doublewrite = 0;
+int file_doublewrite_fd = -1;
+pthread_mutex_t file_doublewrite_latch = PTHREAD_MUTEX_INITIALIZER;
+std::vector<int64_t> file_doublewrite_tables;
+
+// The header pages of the last batch of copies
+static page_t file_doublewrite_header[DOUBLEWRITE_HEADER_PAGES];
+
+// Header fields are read and written as part of their whole page, so that
+// every I/O on a table file is page-sized and page-aligned.
+static void file_read_field(int fd,
+                            pagenum_t page_num,
+                            void* dest,
+                            int size,
+                            int offset) {
+  page_t page = {};
+  pread(fd, &page, PAGE_SIZE, page_num * PAGE_SIZE);
+  memcpy(dest, page.data + offset, size);
+}
+
+static void file_write_field(int fd,
+                             pagenum_t page_num,
+                             const void* src,
+                             int size,
+                             int offset) {
+  page_t page = {};
+  pread(fd, &page, PAGE_SIZE, page_num * PAGE_SIZE);
+  memcpy(page.data + offset, src, size);
+  if (file_checksum_mode != CHECKSUM_OFF) {
+    file_stamp_checksum(&page);
+  }
+  pwrite(fd, &page, PAGE_SIZE, page_num * PAGE_SIZE);
+}
 
 // Open existing database file or create one if it doesn't exist
 int64_t file_open_table_file(const char* pathname) {
-  int64_t table_id = std::stoll(std::string(pathname + 4));
-  if (fd_table[table_id] != 0) {
-    return table_id;
+  pthread_mutex_lock(&table_desc_latch);
+
+  if (!file_catalog_loaded) {
+    file_load_catalog();
   }
 
-  if (fd_table.size() >= MAX_NUM_TABLE) {
-    return -1;
+  int is_new = 0;
+  int64_t table_id;
+  auto it = table_ids.find(pathname);
+  if (it != table_ids.end()) {
+    table_id = it->second;
+  } else {
+    table_id = file_register_table(pathname);
+    is_new = 1;
   }
 
-  int fd = open(pathname, O_RDWR);
-  if (fd < 0) {
-    fd = open(pathname, O_RDWR | O_CREAT | O_TRUNC, DEFAULT_FILE_MODE);
-    if (fd < 0) {
-      return fd;
+  if (table_id >= 0 && file_open_table_desc(table_id) < 0) {
+    if (is_new) {
+      table_ids.erase(pathname);
+      table_descs[table_id].pathname.clear();
     }
+    table_id = -1;
+  }
 
-    file_write_magic_number(fd, MAGIC_NUM);
+  pthread_mutex_unlock(&table_desc_latch);
+  return table_id;
+}
 
-    uint64_t number_of_pages = INITIAL_DB_FILE_SIZE / PAGE_SIZE;
-    file_write_number_of_pages(fd, number_of_pages);
+// Allocate an on-disk page from the free page list
+pagenum_t file_alloc_page(int64_t table_id) {
+  int fd = file_acquire_fd(table_id);
 
-    pagenum_t first = number_of_pages - 1;
-    file_write_first_free_page_number(fd, first);
+  page_t header;
+  file_read_page(table_id, 0, &header);
 
-    for (pagenum_t i = first; i > 0; i--) {
-      file_write_next_free_page_number(fd, i - 1, i);
+  pagenum_t pagenum = file_get_first_free_page_number(&header);
+  if (pagenum != 0) {
+    page_t page;
+    file_read_page(table_id, pagenum, &page);
+    file_set_first_free_page_number(&header,
+                                    file_get_next_free_page_number(&page));
+  } else {
+    pagenum = file_get_high_water_mark(&header);
+    uint64_t number_of_pages = file_get_number_of_pages(&header);
+    if (pagenum == number_of_pages) {
+      number_of_pages = file_grow_table(table_id, number_of_pages);
+      file_set_number_of_pages(&header, number_of_pages);
     }
-    file_extend_to_end(fd, first);
+    file_set_high_water_mark(&header, pagenum + 1);
+  }
+  file_write_page(table_id, 0, &header);
 
-    fsync(fd);
+  fsync(fd);
+  file_release_fd(table_id);
+
+  return pagenum;
+}
+
+// Free an on-disk page to the free page list
+void file_free_page(int64_t table_id, pagenum_t pagenum) {
+  int fd = file_acquire_fd(table_id);
+
+  page_t header;
+  file_read_page(table_id, 0, &header);
+
+  page_t page = {};
+  file_set_next_free_page_number(&page,
+                                 file_get_first_free_page_number(&header));
+  file_write_page(table_id, pagenum, &page);
+  file_set_first_free_page_number(&header, pagenum);
+  file_write_page(table_id, 0, &header);
+
+  fsync(fd);
+  file_release_fd(table_id);
+}
+
+// Read an on-disk page into the in-memory page structure(dest). Fails if it
+// can not be read or its checksum does not match.
+int file_read_page(int64_t table_id, pagenum_t pagenum, struct page_t* dest) {
+  int fd = file_acquire_fd(table_id);
+  if (fd < 0) {
+    return -1;
   }
 
-  if (file_read_magic_number(fd) != MAGIC_NUM) {
+  int result = 0;
+  page_map_t* page_map = table_descs[table_id].page_map;
+  if (page_map != NULL && pagenum != 0) {
+    result = file_read_compressed_page(page_map, fd, pagenum, dest);
+  } else if (pread(fd, dest, PAGE_SIZE, file_page_offset(table_id, pagenum)) !=
+             PAGE_SIZE) {
+    result = -1;
+  }
+
+  if (result == 0 && file_should_verify_checksum() &&
+      file_verify_checksum(dest) < 0) {
+    result = -1;
+  }
+
+  file_release_fd(table_id);
+  return result;
+}
+
+// Write an in-memory page(src) to the on-disk page
+int file_write_page(int64_t table_id,
+                    pagenum_t pagenum,
+                    const struct page_t* src) {
+  int fd = file_acquire_fd(table_id);
+  if (fd < 0) {
     return -1;
   }
 
-  fd_table[table_id] = fd;
+  page_t stamped;
+  src = file_stamp_copy(src, &stamped);
 
-  return table_id;
+  file_map_t* map = table_descs[table_id].map;
+  if (map != NULL) {
+    map->num_writes_started++;
+  }
+
+  int result = 0;
+  page_map_t* page_map = table_descs[table_id].page_map;
+  if (page_map != NULL && pagenum != 0) {
+    result = file_write_compressed_page(page_map, fd, pagenum, src);
+  } else if (pwrite(fd, src, PAGE_SIZE, file_page_offset(table_id, pagenum)) !=
+             PAGE_SIZE) {
+    result = -1;
+  }
+
+  if (map != NULL) {
+    map->num_writes_finished++;
+  }
+
+  // The WAL already makes updates durable, so in SYNC_ON_CHECKPOINT mode the
+  // page is left in the OS cache until the next file_sync_table_files().
+  if (file_sync_mode == SYNC_ON_WRITE) {
+    if (fsync(fd) < 0) {
+      result = -1;
+    }
+    file_num_syncs++;
+  }
+
+  file_release_fd(table_id);
+  return result;
 }
 
-// Allocate an on-disk page from the free page list
-pagenum_t file_alloc_page(int64_t table_id) {
-  int fd = file_find_fd(table_id);
+// Write count in-memory pages(pages) to the on-disk pages from pagenum on,
+// with one system call per IOV_MAX pages. A table of the tablespace takes one
+// more wherever its pages cross from one extent to the next.
+int file_write_pages(int64_t table_id,
+                     pagenum_t pagenum,
+                     const page_t* const* pages,
+                     int count) {
+  page_map_t* page_map = table_descs[table_id].page_map;
+  if (page_map != NULL) {
+    int result = 0;
+    for (int i = 0; i < count; i++) {
+      if (file_write_page(table_id, pagenum + i, pages[i]) != 0) {
+        result = -1;
+      }
+    }
+    return result;
+  }
+
+  int fd = file_acquire_fd(table_id);
+  if (fd < 0) {
+    return -1;
+  }
 
-  pagenum_t first = file_read_first_free_page_number(fd);
-  if (first == 0) {
-    uint64_t number_of_pages = file_read_number_of_pages(fd);
+  std::vector<page_t> stamped;
+  std::vector<const page_t*> stamped_pages;
+  if (file_checksum_mode != CHECKSUM_OFF) {
+    stamped.resize(count);
+    for (int i = 0; i < count; i++) {
+      stamped_pages.push_back(file_stamp_copy(pages[i], &stamped[i]));
+    }
+    pages = stamped_pages.data();
+  }
+
+  file_map_t* map = table_descs[table_id].map;
+  if (map != NULL) {
+    map->num_writes_started++;
+  }
 
-    pagenum_t new_size = 2 * number_of_pages;
-    file_write_number_of_pages(fd, new_size);
+  int result = 0;
+  struct iovec iov[IOV_MAX];
+  for (int i = 0; i < count && result == 0;) {
+    off_t offset = file_page_offset(table_id, pagenum + i);
+    int iovcnt = 0;
+    while (i + iovcnt < count && iovcnt < IOV_MAX &&
+           (iovcnt == 0 || file_page_offset(table_id, pagenum + i + iovcnt) ==
+                               offset + (off_t)iovcnt * PAGE_SIZE)) {
+      iov[iovcnt].iov_base = (void*)pages[i + iovcnt];
+      iov[iovcnt].iov_len = PAGE_SIZE;
+      iovcnt++;
+    }
 
-    first = new_size - 1;
-    for (pagenum_t i = first; i > number_of_pages; i--) {
-      file_write_next_free_page_number(fd, i - 1, i);
+    ssize_t length = (ssize_t)iovcnt * PAGE_SIZE;
+    if (pwritev(fd, iov, iovcnt, offset) != length) {
+      // Fall back to single pages after a short write
+      for (int j = 0; j < iovcnt; j++) {
+        if (pwrite(fd, pages[i + j], PAGE_SIZE,
+                   file_page_offset(table_id, pagenum + i + j)) != PAGE_SIZE) {
+          result = -1;
+        }
+      }
     }
-    file_write_next_free_page_number(fd, 0, number_of_pages);
-    file_extend_to_end(fd, first);
+    i += iovcnt;
+  }
+
+  if (map != NULL) {
+    map->num_writes_finished++;
+  }
 
+  if (file_sync_mode == SYNC_ON_WRITE) {
     fsync(fd);
+    file_num_syncs++;
   }
 
-  pagenum_t next = file_read_next_free_page_number(fd, first);
-  file_write_first_free_page_number(fd, next);
+  file_release_fd(table_id);
+  return result;
+}
 
-  fsync(fd);
+// Read an on-disk page into dest without waiting, calling back on completion
+int file_read_page_async(int64_t table_id,
+                         pagenum_t pagenum,
+                         struct page_t* dest,
+                         aio_callback_t callback,
+                         void* arg) {
+  int fd = file_acquire_fd(table_id);
+  file_aio_t* io =
+      new file_aio_t{table_id, callback, arg, AIO_READ, pagenum, dest, NULL};
 
-  return first;
+  // A page of a compressed table is read on the spot. Queued as a task, it
+  // could wait on a worker that is waiting for it.
+  if (table_descs[table_id].page_map != NULL && pagenum != 0) {
+    file_run_compressed_aio(io, 0);
+    return 0;
+  }
+
+  int result = aio_submit(AIO_READ, fd, dest, PAGE_SIZE,
+                          file_page_offset(table_id, pagenum),
+                          file_complete_async, io);
+  if (result != 0) {
+    file_release_fd(table_id);
+    delete io;
+  }
+  return result;
 }
 
-// Free an on-disk page to the free page list
-void file_free_page(int64_t table_id, pagenum_t pagenum) {
-  int fd = file_find_fd(table_id);
+// Write src to the on-disk page without waiting, calling back on completion
+int file_write_page_async(int64_t table_id,
+                          pagenum_t pagenum,
+                          const struct page_t* src,
+                          aio_callback_t callback,
+                          void* arg) {
+  int fd = file_acquire_fd(table_id);
+  file_aio_t* io = new file_aio_t{table_id, callback, arg,        AIO_WRITE,
+                                  pagenum,  (page_t*)src, NULL};
+  if (file_checksum_mode != CHECKSUM_OFF) {
+    io->stamped = new page_t;
+    io->page = (page_t*)file_stamp_copy(src, io->stamped);
+  }
 
-  pagenum_t first = file_read_first_free_page_number(fd);
-  file_write_next_free_page_number(fd, first, pagenum);
-  file_write_first_free_page_number(fd, pagenum);
+  file_map_t* map = table_descs[table_id].map;
+  if (map != NULL) {
+    map->num_writes_started++;
+  }
 
-  fsync(fd);
+  int result;
+  if (table_descs[table_id].page_map != NULL && pagenum != 0) {
+    result = aio_submit_task(file_run_compressed_aio, io);
+  } else {
+    result = aio_submit(AIO_WRITE, fd, io->page, PAGE_SIZE,
+                        file_page_offset(table_id, pagenum),
+                        file_complete_async, io);
+  }
+  if (result != 0) {
+    if (map != NULL) {
+      map->num_writes_finished++;
+    }
+    file_release_fd(table_id);
+    delete io->stamped;
+    delete io;
+  }
+  return result;
+}
+
+// Return the mapped on-disk page, or NULL if it is not mapped
+const page_t* file_get_mapped_page(int64_t table_id, pagenum_t pagenum) {
+  if (table_id < 0 || table_id >= MAX_NUM_TABLE) {
+    return NULL;
+  }
+
+  file_map_t* map = table_descs[table_id].map;
+  if (map == NULL) {
+    return NULL;
+  }
+
+  if (pagenum >= map->number_of_pages) {
+    // The file has grown since it was mapped, so map its new pages in place.
+    pthread_mutex_lock(&map->latch);
+
+    int fd = file_acquire_fd(table_id);
+    uint64_t number_of_pages = map->number_of_pages;
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+      uint64_t new_size = st.st_size / PAGE_SIZE;
+      if (new_size > FILE_MAP_RESERVE / PAGE_SIZE) {
+        new_size = FILE_MAP_RESERVE / PAGE_SIZE;
+      }
+      if (new_size > number_of_pages &&
+          mmap(map->addr + number_of_pages * PAGE_SIZE,
+               (new_size - number_of_pages) * PAGE_SIZE, PROT_READ,
+               MAP_SHARED | MAP_FIXED, fd,
+               number_of_pages * PAGE_SIZE) != MAP_FAILED) {
+        map->number_of_pages = new_size;
+      }
+    }
+    file_release_fd(table_id);
+
+    pthread_mutex_unlock(&map->latch);
+
+    if (pagenum >= map->number_of_pages) {
+      return NULL;
+    }
+  }
+
+  return (const page_t*)(map->addr + pagenum * PAGE_SIZE);
+}
+
+// Take a snapshot of the page writes to the table file, to validate a read
+// through its mapping against. Fails while a page write is in progress.
+int file_begin_mapped_read(int64_t table_id, uint64_t* snapshot) {
+  if (table_id < 0 || table_id >= MAX_NUM_TABLE) {
+    return -1;
+  }
+
+  file_map_t* map = table_descs[table_id].map;
+  if (map == NULL) {
+    return -1;
+  }
+
+  *snapshot = map->num_writes_started;
+  if (map->num_writes_finished != *snapshot) {
+    return -1;
+  }
+  return 0;
 }
 
-// Read an on-disk page into the in-memory page structure(dest)
-void file_read_page(int64_t table_id, pagenum_t pagenum, struct page_t* dest) {
-  int fd = file_find_fd(table_id);
-  pread(fd, dest, PAGE_SIZE, pagenum * PAGE_SIZE);
+// Check that no page of the table file was written since the snapshot
+int file_end_mapped_read(int64_t table_id, uint64_t snapshot) {
+  file_map_t* map = table_descs[table_id].map;
+  if (map == NULL || map->num_writes_started != snapshot) {
+    return -1;
+  }
+  return 0;
 }
 
-// Write an in-memory page(src) to the on-disk page
-void file_write_page(int64_t table_id,
-                     pagenum_t pagenum,
-                     const struct page_t* src) {
-  int fd = file_find_fd(table_id);
-  pwrite(fd, src, PAGE_SIZE, pagenum * PAGE_SIZE);
-  fsync(fd);
+// Each run of pages that is consecutive in the file is written with a single
+// request, and all the runs are in flight at once.
+int file_write_pages_async(int64_t table_id,
+                           pagenum_t pagenum,
+                           const page_t* const* pages,
+                           int count,
+                           aio_callback_t callback,
+                           void* arg) {
+  int fd = file_acquire_fd(table_id);
+  if (fd < 0) {
+    return -1;
+  }
+
+  file_aio_batch_t* batch = new file_aio_batch_t;
+  batch->table_id = table_id;
+  batch->callback = callback;
+  batch->arg = arg;
+  batch->fd = fd;
+  batch->pagenum = pagenum;
+  batch->pages.assign(pages, pages + count);
+  batch->result = 0;
+
+  file_map_t* map = table_descs[table_id].map;
+  if (map != NULL) {
+    map->num_writes_started++;
+  }
+
+  // The pages of a compressed table are written one at a time by a task
+  if (table_descs[table_id].page_map != NULL) {
+    batch->num_runs = 1;
+    if (aio_submit_task(file_run_compressed_batch, batch) != 0) {
+      file_run_compressed_batch(batch, 0);
+    }
+    return 0;
+  }
+
+  if (file_checksum_mode != CHECKSUM_OFF) {
+    batch->stamped.resize(count);
+    for (int i = 0; i < count; i++) {
+      batch->pages[i] = file_stamp_copy(pages[i], &batch->stamped[i]);
+    }
+  }
+
+  batch->iov.resize(count);
+  for (int i = 0; i < count;) {
+    off_t offset = file_page_offset(table_id, pagenum + i);
+    int iovcnt = 0;
+    while (i + iovcnt < count && iovcnt < IOV_MAX &&
+           (iovcnt == 0 || file_page_offset(table_id, pagenum + i + iovcnt) ==
+                               offset + (off_t)iovcnt * PAGE_SIZE)) {
+      batch->iov[i + iovcnt].iov_base = (void*)batch->pages[i + iovcnt];
+      batch->iov[i + iovcnt].iov_len = PAGE_SIZE;
+      iovcnt++;
+    }
+    batch->runs.push_back({batch, i, iovcnt, offset});
+    i += iovcnt;
+  }
+
+  batch->num_runs = batch->runs.size() + 1;
+  for (file_aio_run_t& run : batch->runs) {
+    if (aio_submit(AIO_WRITEV, fd, &batch->iov[run.first], run.count,
+                   run.offset, file_complete_run, &run) != 0) {
+      file_complete_run(&run, -1);
+    }
+  }
+  file_end_batch(batch);
+
+  return 0;
 }
 
 // Close the database file
 void file_close_table_files() {
-  for (auto i : fd_table) {
-    close(i.second);
+  file_sync_table_files();
+  file_unmap_table_files();
+  file_free_page_maps();
+
+  pthread_mutex_lock(&table_desc_latch);
+
+  // The tables stay registered, so their ids keep naming the same files
+  for (int64_t i = 0; i < MAX_NUM_TABLE; i++) {
+    table_desc_t* desc = &table_descs[i];
+    int fd = desc->fd;
+    if (desc->segment != NULL) {
+      space_free_segment(desc->segment);
+      desc->segment = NULL;
+    } else if (fd >= 0) {
+      close(fd);
+    }
+    desc->fd = -1;
+  }
+  num_open_files = 0;
+  file_open_tables.clear();
+
+  space_close();
+  file_close_doublewrite();
+
+  pthread_mutex_unlock(&table_desc_latch);
+}
+
+// Flush the written pages of every open table file to the disk
+int file_sync_table_files() {
+  pthread_mutex_lock(&table_desc_latch);
+
+  int result = 0;
+  for (int64_t i = 0; i < MAX_NUM_TABLE; i++) {
+    int fd = table_descs[i].fd;
+    if (table_descs[i].page_map != NULL) {
+      // The page map is saved even if the file was closed since, so that the
+      // slots released meanwhile can be reused
+      if (fd < 0) {
+        fd = file_open_table_desc(i);
+      }
+      if (file_save_page_map(i, fd) < 0) {
+        result = -1;
+      }
+    } else if (table_descs[i].segment == NULL && fd >= 0) {
+      if (fdatasync(fd) < 0) {
+        result = -1;
+      }
+      file_num_syncs++;
+    }
+  }
+
+  // All the tables of the tablespace are synced at once
+  if (space_sync() < 0) {
+    result = -1;
+  }
+
+  pthread_mutex_unlock(&table_desc_latch);
+  return result;
+}
+
+// Return the offset of the on-disk page in the file of the table
+off_t file_page_offset(int64_t table_id, pagenum_t pagenum) {
+  segment_t* segment = table_descs[table_id].segment;
+  if (segment != NULL) {
+    return space_page_offset(segment, pagenum);
+  }
+  return pagenum * PAGE_SIZE;
+}
+
+// Pin the file descriptor of the table, reopening its file if it was closed.
+// A pinned descriptor is never closed until file_release_fd().
+int file_acquire_fd(int64_t table_id) {
+  if (table_id < 0 || table_id >= MAX_NUM_TABLE) {
+    return -1;
+  }
+
+  table_desc_t* desc = &table_descs[table_id];
+  desc->num_users++;
+
+  // Paired with file_close_lru_file(), which clears fd before it checks
+  // num_users, so either it sees this user or this user sees no descriptor.
+  int fd = desc->fd;
+  if (fd < 0) {
+    pthread_mutex_lock(&table_desc_latch);
+    fd = file_open_table_desc(table_id);
+    pthread_mutex_unlock(&table_desc_latch);
+
+    if (fd < 0) {
+      desc->num_users--;
+      return -1;
+    }
   }
-  fd_table.clear();
+
+  desc->last_used.store(++file_clock, std::memory_order_relaxed);
+  return fd;
+}
+
+void file_release_fd(int64_t table_id) {
+  table_descs[table_id].num_users--;
 }
 
+// The descriptor is not pinned, so it may be closed once more than
+// file_max_open_files are open. I/O paths use file_acquire_fd() instead.
 int file_find_fd(int64_t table_id) {
-  int fd = fd_table[table_id];
-  if (fd == 0) {
+  int fd = file_acquire_fd(table_id);
+  if (fd >= 0) {
+    file_release_fd(table_id);
+  }
+  return fd;
+}
+
+// Open a table file, without O_DIRECT if its file system does not support it
+int file_open(const char* pathname, int flags) {
+  int fd = open(pathname, flags, DEFAULT_FILE_MODE);
+  if (fd < 0 && errno == EINVAL && (flags & O_DIRECT)) {
+    fd = open(pathname, flags & ~O_DIRECT, DEFAULT_FILE_MODE);
+  }
+  return fd;
+}
+
+// Give the table a free id. A table named FILE_PREFIX followed by a number
+// gets that number, which log records and recovery name it by. Any other
+// table is numbered down from the last id, away from those.
+int64_t file_register_table(const char* pathname) {
+  int64_t table_id = -1;
+
+  size_t prefix_length = strlen(FILE_PREFIX);
+  if (strncmp(pathname, FILE_PREFIX, prefix_length) == 0 &&
+      pathname[prefix_length] != '\0') {
+    char* end;
+    int64_t number = strtoll(pathname + prefix_length, &end, 10);
+    if (*end == '\0' && number >= 0 && number < MAX_NUM_TABLE &&
+        table_descs[number].pathname.empty()) {
+      table_id = number;
+    }
+  }
+
+  // Any other id is kept in the catalog, so that recovery finds the table
+  // by it after a restart
+  if (table_id < 0) {
+    for (int64_t i = MAX_NUM_TABLE - 1; table_id < 0 && i >= 0; i--) {
+      if (table_descs[i].pathname.empty()) {
+        table_id = i;
+      }
+    }
+    if (table_id < 0 || file_add_to_catalog(table_id, pathname) < 0) {
+      return -1;
+    }
+  }
+
+  table_desc_t* desc = &table_descs[table_id];
+  desc->pathname = pathname;
+  desc->fd = -1;
+  table_ids[pathname] = table_id;
+
+  return table_id;
+}
+
+// Register the tables of the catalog, unless their ids or paths are taken
+// already. Called with table_desc_latch held.
+int file_load_catalog() {
+  file_catalog_loaded = 1;
+
+  FILE* fp = fopen(CATALOG_PATH, "r");
+  if (fp == NULL) {
+    return errno == ENOENT ? 0 : -1;
+  }
+
+  // A line cut short by a crash was never acknowledged, so it is dropped
+  int64_t table_id;
+  char pathname[PATH_MAX];
+  while (fscanf(fp, "%ld %4095[^\n]", &table_id, pathname) == 2) {
+    if (table_id < 0 || table_id >= MAX_NUM_TABLE ||
+        !table_descs[table_id].pathname.empty() ||
+        table_ids.count(pathname) > 0) {
+      continue;
+    }
+    table_descs[table_id].pathname = pathname;
+    table_descs[table_id].fd = -1;
+    table_ids[pathname] = table_id;
+  }
+
+  fclose(fp);
+  return 0;
+}
+
+// Append the table to the catalog and make it durable before the id is used
+int file_add_to_catalog(int64_t table_id, const char* pathname) {
+  int fd = open(CATALOG_PATH, O_WRONLY | O_CREAT | O_APPEND, DEFAULT_FILE_MODE);
+  if (fd < 0) {
+    return -1;
+  }
+
+  std::string line = std::to_string(table_id) + " " + pathname + "\n";
+  int result = 0;
+  if (write(fd, line.c_str(), line.size()) != (ssize_t)line.size() ||
+      fdatasync(fd) < 0) {
+    result = -1;
+  }
+
+  close(fd);
+  return result;
+}
+
+// Open the file of the table, creating it if it doesn't exist. An id that was
+// never registered names the file FILE_PREFIX followed by the id, as before
+// tables had arbitrary paths, which is only opened if it exists, so that
+// recovery never redoes a table into a new empty file. Called with
+// table_desc_latch held.
+int file_open_table_desc(int64_t table_id) {
+  table_desc_t* desc = &table_descs[table_id];
+  if (desc->fd >= 0) {
+    return desc->fd;
+  }
+
+  if (!file_catalog_loaded) {
+    file_load_catalog();
+  }
+
+  int is_unregistered = desc->pathname.empty();
+  if (is_unregistered) {
     std::string pathname = FILE_PREFIX + std::to_string(table_id);
-    if (file_open_table_file(pathname.c_str()) < 0) {
+    if (table_ids.count(pathname) > 0) {
       return -1;
     }
+    desc->pathname = pathname;
+    table_ids[pathname] = table_id;
+  }
+
+  if (space_pathname != NULL) {
+    return file_open_segment(table_id);
+  }
+
+  if (num_open_files >= file_max_open_files) {
+    file_close_lru_file();
+  }
+
+  int fd = file_open_table_path(desc->pathname.c_str(), !is_unregistered);
+  if (fd < 0) {
+    if (is_unregistered) {
+      table_ids.erase(desc->pathname);
+      desc->pathname.clear();
+    }
+    return -1;
+  }
 
-    fd = fd_table[table_id];
+  desc->fd = fd;
+  num_open_files++;
+  file_open_tables.push_back(table_id);
+
+  if (desc->page_map == NULL &&
+      file_read_page_format(fd) == PAGE_FORMAT_COMPRESSED) {
+    file_load_page_map(table_id);
+  }
+
+  // The pages of a compressed table can not be read in place
+  if (file_mmap_reads && desc->map == NULL && desc->page_map == NULL) {
+    file_map_table_file(table_id, fd);
   }
+
   return fd;
 }
 
+// Open a table file, creating it if it doesn't exist and can_create is set
+int file_open_table_path(const char* pathname, int can_create) {
+  int flags = O_RDWR;
+  if (file_direct_io) {
+    flags |= O_DIRECT;
+  }
+
+  int fd = file_open(pathname, flags);
+  if (fd < 0 && !can_create) {
+    return -1;
+  }
+  if (fd < 0) {
+    fd = file_open(pathname, flags | O_CREAT | O_TRUNC);
+    if (fd < 0) {
+      return fd;
+    }
+
+    // Only the header page of a compressed table has a fixed place
+    uint64_t number_of_pages = INITIAL_DB_FILE_SIZE / PAGE_SIZE;
+    if (file_page_format == PAGE_FORMAT_COMPRESSED) {
+      file_allocate_pages(fd, 0, 1);
+      remove((std::string(pathname) + PAGE_MAP_SUFFIX).c_str());
+    } else {
+      file_allocate_pages(fd, 0, number_of_pages);
+    }
+
+    page_t header = {};
+    file_set_magic_number(&header, MAGIC_NUM);
+    file_set_number_of_pages(&header, number_of_pages);
+    file_set_first_free_page_number(&header, 0);
+    file_set_high_water_mark(&header, 1);
+    file_set_page_format(&header, file_page_format);
+    pwrite(fd, &header, PAGE_SIZE, 0);
+
+    fsync(fd);
+  }
+
+  if (file_read_magic_number(fd) != MAGIC_NUM) {
+    close(fd);
+    return -1;
+  }
+
+  // Compressed pages are packed in sectors, which O_DIRECT can not address
+  if ((flags & O_DIRECT) &&
+      file_read_page_format(fd) == PAGE_FORMAT_COMPRESSED) {
+    close(fd);
+    fd = file_open(pathname, flags & ~O_DIRECT);
+    if (fd < 0) {
+      return fd;
+    }
+  }
+
+  // Files created before the high-water mark threaded every page into the
+  // free page list, so none of their pages is left unused.
+  if (file_read_high_water_mark(fd) == 0) {
+    file_write_high_water_mark(fd, file_read_number_of_pages(fd));
+  }
+
+  return fd;
+}
+
+// Open the segment of the table in the tablespace, creating it if it doesn't
+// exist. Its tables are always raw and never mapped, as their pages are
+// spread over extents of the tablespace. Called with table_desc_latch held.
+int file_open_segment(int64_t table_id) {
+  table_desc_t* desc = &table_descs[table_id];
+  if (space_open() < 0) {
+    return -1;
+  }
+  if (desc->segment == NULL &&
+      space_open_segment(desc->pathname.c_str(), &desc->segment) < 0) {
+    return -1;
+  }
+
+  desc->fd = space_fd;
+  return space_fd;
+}
+
+// Close the least recently used file that no thread is using, after syncing
+// it. The open files are compared by their last use, which costs a pass over
+// file_max_open_files of them at most, but only once a file is opened beyond
+// that, so that file_acquire_fd() stays a timestamp store. Called with
+// table_desc_latch held.
+void file_close_lru_file() {
+  size_t victim = file_open_tables.size();
+  for (size_t i = 0; i < file_open_tables.size(); i++) {
+    table_desc_t* desc = &table_descs[file_open_tables[i]];
+    if (desc->num_users == 0 &&
+        (victim == file_open_tables.size() ||
+         desc->last_used < table_descs[file_open_tables[victim]].last_used)) {
+      victim = i;
+    }
+  }
+  if (victim == file_open_tables.size()) {
+    return;
+  }
+
+  table_desc_t* desc = &table_descs[file_open_tables[victim]];
+  int fd = desc->fd;
+  desc->fd = -1;
+  if (desc->num_users != 0) {
+    desc->fd = fd;
+    return;
+  }
+
+  fdatasync(fd);
+  close(fd);
+  num_open_files--;
+  file_open_tables[victim] = file_open_tables.back();
+  file_open_tables.pop_back();
+}
+
+void file_complete_async(void* arg, int result) {
+  file_aio_t* io = (file_aio_t*)arg;
+  if (io->type == AIO_READ && result == PAGE_SIZE &&
+      file_should_verify_checksum() && file_verify_checksum(io->page) < 0) {
+    result = -1;
+  }
+  file_map_t* map = table_descs[io->table_id].map;
+  if (io->type == AIO_WRITE && map != NULL) {
+    map->num_writes_finished++;
+  }
+  file_release_fd(io->table_id);
+  io->callback(io->arg, result);
+  delete io->stamped;
+  delete io;
+}
+
+// A run written short, or not at all, is written again a page at a time
+void file_complete_run(void* arg, int result) {
+  file_aio_run_t* run = (file_aio_run_t*)arg;
+  file_aio_batch_t* batch = run->batch;
+
+  if (result != run->count * PAGE_SIZE) {
+    for (int i = run->first; i < run->first + run->count; i++) {
+      if (pwrite(batch->fd, batch->pages[i], PAGE_SIZE,
+                 file_page_offset(batch->table_id, batch->pagenum + i)) !=
+          PAGE_SIZE) {
+        batch->result = -1;
+      }
+    }
+  }
+
+  file_end_batch(batch);
+}
+
+// Call the batch back once its last run is written
+void file_end_batch(file_aio_batch_t* batch) {
+  if (--batch->num_runs > 0) {
+    return;
+  }
+
+  file_map_t* map = table_descs[batch->table_id].map;
+  if (map != NULL) {
+    map->num_writes_finished++;
+  }
+
+  if (file_sync_mode == SYNC_ON_WRITE) {
+    fsync(batch->fd);
+    file_num_syncs++;
+  }
+
+  file_release_fd(batch->table_id);
+  batch->callback(batch->arg, batch->result);
+  delete batch;
+}
+
 int64_t file_read_magic_number(int fd) {
   int64_t magic_number;
-  pread(fd, &magic_number, 8, 0);
+  file_read_field(fd, 0, &magic_number, 8, 0);
   return magic_number;
 }
 
 void file_write_magic_number(int fd, const int64_t magic_number) {
-  pwrite(fd, &magic_number, 8, 0);
+  file_write_field(fd, 0, &magic_number, 8, 0);
 }
 
 pagenum_t file_read_first_free_page_number(int fd) {
   pagenum_t first;
-  pread(fd, &first, 8, 8);
+  file_read_field(fd, 0, &first, 8, 8);
   return first;
 }
 
 void file_write_first_free_page_number(int fd, const pagenum_t first) {
-  pwrite(fd, &first, 8, 8);
+  file_write_field(fd, 0, &first, 8, 8);
 }
 
 uint64_t file_read_number_of_pages(int fd) {
   uint64_t number_of_pages;
-  pread(fd, &number_of_pages, 8, 16);
+  file_read_field(fd, 0, &number_of_pages, 8, 16);
   return number_of_pages;
 }
 
 void file_write_number_of_pages(int fd, const uint64_t number_of_pages) {
-  pwrite(fd, &number_of_pages, 8, 16);
+  file_write_field(fd, 0, &number_of_pages, 8, 16);
 }
 
 pagenum_t file_read_next_free_page_number(int fd, pagenum_t page_num) {
   pagenum_t next;
-  pread(fd, &next, 8, page_num * PAGE_SIZE);
+  file_read_field(fd, page_num, &next, 8, 0);
   return next;
 }
 
 void file_write_next_free_page_number(int fd,
                                       const pagenum_t next,
                                       pagenum_t page_num) {
-  pwrite(fd, &next, 8, page_num * PAGE_SIZE);
+  file_write_field(fd, page_num, &next, 8, 0);
+}
+
+pagenum_t file_read_high_water_mark(int fd) {
+  pagenum_t high_water_mark;
+  file_read_field(fd, 0, &high_water_mark, 8, 48);
+  return high_water_mark;
+}
+
+void file_write_high_water_mark(int fd, const pagenum_t high_water_mark) {
+  file_write_field(fd, 0, &high_water_mark, 8, 48);
+}
+
+// Map the table file read-only into a reserved address range, which later
+// growth of the file is mapped into as well
+int file_map_table_file(int64_t table_id, int fd) {
+  void* addr = mmap(NULL, FILE_MAP_RESERVE, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (addr == MAP_FAILED) {
+    return -1;
+  }
+
+  struct stat st;
+  uint64_t number_of_pages = 0;
+  if (fstat(fd, &st) == 0) {
+    number_of_pages = st.st_size / PAGE_SIZE;
+  }
+  if (number_of_pages > FILE_MAP_RESERVE / PAGE_SIZE) {
+    number_of_pages = FILE_MAP_RESERVE / PAGE_SIZE;
+  }
+
+  if (number_of_pages > 0 &&
+      mmap(addr, number_of_pages * PAGE_SIZE, PROT_READ,
+           MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(addr, FILE_MAP_RESERVE);
+    return -1;
+  }
+
+  file_map_t* map = new file_map_t;
+  map->addr = (uint8_t*)addr;
+  map->number_of_pages = number_of_pages;
+  map->latch = PTHREAD_MUTEX_INITIALIZER;
+  map->num_writes_started = 0;
+  map->num_writes_finished = 0;
+  table_descs[table_id].map = map;
+
+  return 0;
+}
+
+void file_unmap_table_files() {
+  for (int64_t i = 0; i < MAX_NUM_TABLE; i++) {
+    file_map_t* map = table_descs[i].map;
+    if (map != NULL) {
+      munmap(map->addr, FILE_MAP_RESERVE);
+      delete map;
+      table_descs[i].map = NULL;
+    }
+  }
+}
+
+// Reserve disk space for the pages [first, last) of the file
+int file_allocate_pages(int fd, pagenum_t first, pagenum_t last) {
+  off_t offset = first * PAGE_SIZE;
+  off_t length = (last - first) * PAGE_SIZE;
+  if (fallocate(fd, 0, offset, length) == 0) {
+    return 0;
+  }
+  return ftruncate(fd, offset + length);
+}
+
+// Return the number of pages a table grows to by the growth policy
+uint64_t file_get_grown_size(uint64_t number_of_pages) {
+  return file_growth_policy == GROWTH_FIXED_EXTENT
+             ? number_of_pages + file_extent_size
+             : 2 * number_of_pages;
+}
+
+// Grow the file by the growth policy and return its new number of pages. The
+// new pages stay above the high-water mark, so none of them is threaded.
+uint64_t file_grow_table_file(int fd, uint64_t number_of_pages) {
+  uint64_t new_size = file_get_grown_size(number_of_pages);
+  file_allocate_pages(fd, number_of_pages, new_size);
+  return new_size;
+}
+
+// Grow the table by the growth policy and return its new number of pages.
+// A compressed table only grows in pages, as its file grows when they are
+// written, and a table of the tablespace grows by whole extents.
+uint64_t file_grow_table(int64_t table_id, uint64_t number_of_pages) {
+  if (table_descs[table_id].page_map != NULL) {
+    return file_get_grown_size(number_of_pages);
+  }
+
+  segment_t* segment = table_descs[table_id].segment;
+  if (segment != NULL) {
+    return space_grow_segment(segment, file_get_grown_size(number_of_pages));
+  }
+
+  int fd = file_acquire_fd(table_id);
+  uint64_t new_size = file_grow_table_file(fd, number_of_pages);
+  file_release_fd(table_id);
+  return new_size;
+}
+
+// Compressed tables.
+
+static uint64_t file_make_slot(uint64_t sector, int num_sectors, int is_raw) {
+  return sector << 5 | is_raw << 4 | num_sectors;
+}
+
+static uint64_t file_get_slot_sector(uint64_t slot) {
+  return slot >> 5;
+}
+
+static int file_get_slot_num_sectors(uint64_t slot) {
+  return slot & 15;
+}
+
+static int file_get_slot_is_raw(uint64_t slot) {
+  return slot >> 4 & 1;
+}
+
+std::string file_get_page_map_path(int64_t table_id) {
+  return table_descs[table_id].pathname + PAGE_MAP_SUFFIX;
+}
+
+// Load the page map saved at the last checkpoint. Every sector that none of
+// its pages uses, including those written after the checkpoint, is free.
+int file_load_page_map(int64_t table_id) {
+  page_map_t* page_map = new page_map_t;
+  page_map->latch = PTHREAD_MUTEX_INITIALIZER;
+
+  int map_fd = open(file_get_page_map_path(table_id).c_str(), O_RDONLY);
+  if (map_fd >= 0) {
+    struct stat st;
+    if (fstat(map_fd, &st) == 0) {
+      page_map->entries.resize(st.st_size / sizeof(uint64_t));
+      pread(map_fd, page_map->entries.data(),
+            page_map->entries.size() * sizeof(uint64_t), 0);
+    }
+    close(map_fd);
+  }
+
+  std::vector<uint64_t> slots;
+  for (uint64_t slot : page_map->entries) {
+    if (slot != 0) {
+      slots.push_back(slot);
+    }
+  }
+  std::sort(slots.begin(), slots.end());
+
+  uint64_t next = SECTORS_PER_PAGE;
+  for (uint64_t slot : slots) {
+    uint64_t sector = file_get_slot_sector(slot);
+    while (next < sector) {
+      int num_sectors = sector - next < SECTORS_PER_PAGE ? sector - next
+                                                         : SECTORS_PER_PAGE;
+      page_map->free_slots[num_sectors].push_back(next);
+      next += num_sectors;
+    }
+    next = std::max(next, sector + file_get_slot_num_sectors(slot));
+  }
+  page_map->end_sector = next;
+
+  table_descs[table_id].page_map = page_map;
+  return 0;
+}
+
+// Make the pages written so far durable, then replace the saved page map by
+// the one pointing at them. Only then are the slots the table gave up before
+// free to reuse.
+int file_save_page_map(int64_t table_id, int fd) {
+  page_map_t* page_map = table_descs[table_id].page_map;
+
+  pthread_mutex_lock(&page_map->latch);
+  std::vector<uint64_t> entries = page_map->entries;
+  std::vector<uint64_t> released_slots;
+  released_slots.swap(page_map->released_slots);
+  pthread_mutex_unlock(&page_map->latch);
+
+  int result = fdatasync(fd);
+  if (result == 0) {
+    std::string path = file_get_page_map_path(table_id);
+    std::string temp_path = path + ".tmp";
+
+    int map_fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                      DEFAULT_FILE_MODE);
+    ssize_t size = entries.size() * sizeof(uint64_t);
+    if (map_fd < 0 || pwrite(map_fd, entries.data(), size, 0) != size ||
+        fsync(map_fd) < 0 || rename(temp_path.c_str(), path.c_str()) < 0) {
+      result = -1;
+    }
+    if (map_fd >= 0) {
+      close(map_fd);
+    }
+  }
+
+  pthread_mutex_lock(&page_map->latch);
+  for (uint64_t slot : released_slots) {
+    if (result == 0) {
+      int num_sectors = file_get_slot_num_sectors(slot);
+      page_map->free_slots[num_sectors].push_back(file_get_slot_sector(slot));
+    } else {
+      page_map->released_slots.push_back(slot);
+    }
+  }
+  pthread_mutex_unlock(&page_map->latch);
+
+  return result;
+}
+
+void file_free_page_maps() {
+  for (int64_t i = 0; i < MAX_NUM_TABLE; i++) {
+    delete table_descs[i].page_map;
+    table_descs[i].page_map = NULL;
+  }
+}
+
+// A page never written reads as zeros, as it would from a raw table file
+int file_read_compressed_page(page_map_t* page_map,
+                              int fd,
+                              pagenum_t pagenum,
+                              page_t* dest) {
+  pthread_mutex_lock(&page_map->latch);
+  uint64_t slot =
+      pagenum < page_map->entries.size() ? page_map->entries[pagenum] : 0;
+  pthread_mutex_unlock(&page_map->latch);
+
+  if (slot == 0) {
+    memset(dest, 0, PAGE_SIZE);
+    return 0;
+  }
+
+  off_t offset = file_get_slot_sector(slot) * SECTOR_SIZE;
+  if (file_get_slot_is_raw(slot)) {
+    return pread(fd, dest, PAGE_SIZE, offset) == PAGE_SIZE ? 0 : -1;
+  }
+
+  page_t image;
+  int num_sectors = file_get_slot_num_sectors(slot);
+  if (pread(fd, &image, num_sectors * SECTOR_SIZE, offset) !=
+      num_sectors * SECTOR_SIZE) {
+    return -1;
+  }
+
+  uint32_t size;
+  memcpy(&size, image.data, 4);
+  if (size > (uint32_t)(num_sectors * SECTOR_SIZE - 4) ||
+      decompress_block(image.data + 4, size, dest->data, PAGE_SIZE) !=
+          PAGE_SIZE) {
+    return -1;
+  }
+  return 0;
+}
+
+// The page is written to a new slot, holding its compressed size and image,
+// or the page as it is if compressing it would not save a sector. If the
+// slot can't be written, the page keeps its old slot.
+int file_write_compressed_page(page_map_t* page_map,
+                               int fd,
+                               pagenum_t pagenum,
+                               const page_t* src) {
+  page_t image = {};
+  int size = compress_block(src->data, PAGE_SIZE, image.data + 4,
+                            PAGE_SIZE - SECTOR_SIZE - 4);
+
+  int is_raw = size < 0;
+  int num_sectors = SECTORS_PER_PAGE;
+  if (!is_raw) {
+    uint32_t image_size = size;
+    memcpy(image.data, &image_size, 4);
+    num_sectors = (size + 4 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+  }
+
+  pthread_mutex_lock(&page_map->latch);
+  uint64_t sector = file_alloc_slot(page_map, num_sectors);
+  pthread_mutex_unlock(&page_map->latch);
+
+  ssize_t length = num_sectors * SECTOR_SIZE;
+  if (pwrite(fd, is_raw ? src : &image, length, sector * SECTOR_SIZE) !=
+      length) {
+    pthread_mutex_lock(&page_map->latch);
+    page_map->released_slots.push_back(
+        file_make_slot(sector, num_sectors, is_raw));
+    pthread_mutex_unlock(&page_map->latch);
+    return -1;
+  }
+
+  // The page points at its new slot only once the slot is written
+  pthread_mutex_lock(&page_map->latch);
+  if (pagenum >= page_map->entries.size()) {
+    page_map->entries.resize(pagenum + 1, 0);
+  }
+  uint64_t old_slot = page_map->entries[pagenum];
+  page_map->entries[pagenum] = file_make_slot(sector, num_sectors, is_raw);
+  if (old_slot != 0) {
+    page_map->released_slots.push_back(old_slot);
+  }
+  pthread_mutex_unlock(&page_map->latch);
+  return 0;
+}
+
+void file_run_compressed_aio(void* arg, int /* result */) {
+  file_aio_t* io = (file_aio_t*)arg;
+  table_desc_t* desc = &table_descs[io->table_id];
+
+  int result = PAGE_SIZE;
+  if (io->type == AIO_READ) {
+    if (file_read_compressed_page(desc->page_map, desc->fd, io->pagenum,
+                                  io->page) != 0) {
+      result = -1;
+    }
+  } else if (file_write_compressed_page(desc->page_map, desc->fd, io->pagenum,
+                                        io->page) != 0) {
+    result = -1;
+  }
+
+  file_complete_async(io, result);
+}
+
+void file_run_compressed_batch(void* arg, int /* result */) {
+  file_aio_batch_t* batch = (file_aio_batch_t*)arg;
+  if (file_write_pages(batch->table_id, batch->pagenum, batch->pages.data(),
+                       batch->pages.size()) != 0) {
+    batch->result = -1;
+  }
+  file_end_batch(batch);
+}
+
+// Take a free slot of the size, or else one past the end of the file. Called
+// with the latch of the page map held.
+uint64_t file_alloc_slot(page_map_t* page_map, int num_sectors) {
+  std::vector<uint64_t>& free_slots = page_map->free_slots[num_sectors];
+  if (!free_slots.empty()) {
+    uint64_t sector = free_slots.back();
+    free_slots.pop_back();
+    return sector;
+  }
+
+  uint64_t sector = page_map->end_sector;
+  page_map->end_sector += num_sectors;
+  return sector;
+}
+
+int file_read_page_format(int fd) {
+  int32_t page_format;
+  file_read_field(fd, 0, &page_format, 4, 56);
+  return page_format;
+}
+
+// Page checksums.
+
+// The checksum covers the page but for itself, so it is stamped in place
+uint32_t file_compute_checksum(const page_t* page) {
+  uint32_t checksum = checksum_crc32c(0, page->data, PAGE_CHECKSUM_OFFSET);
+  return checksum_crc32c(checksum, page->data + PAGE_CHECKSUM_OFFSET + 4,
+                         PAGE_SIZE - PAGE_CHECKSUM_OFFSET - 4);
+}
+
+// The flag is covered by the checksum, so a page is stamped before it
+void file_stamp_checksum(page_t* page) {
+  file_set_page_flags(page, file_get_page_flags(page) | PAGE_FLAG_STAMPED);
+  file_set_checksum(page, file_compute_checksum(page));
+}
+
+int file_verify_checksum(const page_t* page) {
+  if ((file_get_page_flags(page) & PAGE_FLAG_STAMPED) &&
+      file_get_checksum(page) != file_compute_checksum(page)) {
+    file_num_checksum_failures++;
+    return -1;
+  }
+  return 0;
+}
+
+int file_should_verify_checksum() {
+  return file_checksum_mode == CHECKSUM_ON_READ ||
+         (file_checksum_mode == CHECKSUM_LAZY && file_in_recovery);
+}
+
+// Return the page to write in place of src: src itself if pages are not
+// stamped, or else a stamped copy of it. A page in the buffer may change
+// while it is written back, so only the copy is sure to match its checksum.
+const page_t* file_stamp_copy(const page_t* src, page_t* copy) {
+  if (file_checksum_mode == CHECKSUM_OFF) {
+    return src;
+  }
+  memcpy(copy, src, PAGE_SIZE);
+  file_stamp_checksum(copy);
+  return copy;
+}
+
+// Doublewrite.
+
+// Write stamped copies of the pages to the doublewrite file in one write and
+// sync it. The caller then writes the same pages in place and calls
+// file_end_doublewrite(), which lets the next batch begin.
+int file_begin_doublewrite(const int64_t* table_ids,
+                           const pagenum_t* pagenums,
+                           const page_t* const* pages,
+                           int count) {
+  pthread_mutex_lock(&file_doublewrite_latch);
+
+  // Until the in-place writes of the last batch are durable, its copies are
+  // all that is left of a page whose write was torn
+  for (int64_t table_id : file_doublewrite_tables) {
+    int fd = file_acquire_fd(table_id);
+    if (fd >= 0) {
+      fdatasync(fd);
+      file_release_fd(table_id);
+    }
+  }
+  file_doublewrite_tables.clear();
+
+  if (count > DOUBLEWRITE_PAGES || file_open_doublewrite() < 0) {
+    return -1;
+  }
+
+  page_t* header = file_doublewrite_header;
+  memset(header, 0, sizeof(file_doublewrite_header));
+  int64_t magic_number = DOUBLEWRITE_MAGIC_NUM;
+  uint64_t num_pages = count;
+  memcpy(header[0].data, &magic_number, 8);
+  memcpy(header[0].data + 8, &num_pages, 8);
+  for (int i = 0; i < count; i++) {
+    uint8_t* entry = header[1].data + i * DOUBLEWRITE_ENTRY_SIZE;
+    memcpy(entry, &table_ids[i], 8);
+    memcpy(entry + 8, &pagenums[i], 8);
+
+    if (std::find(file_doublewrite_tables.begin(),
+                  file_doublewrite_tables.end(),
+                  table_ids[i]) == file_doublewrite_tables.end()) {
+      file_doublewrite_tables.push_back(table_ids[i]);
+    }
+  }
+
+  int result = 0;
+  struct iovec iov[IOV_MAX];
+  int iovcnt = 0;
+  off_t offset = 0;
+  for (int i = -DOUBLEWRITE_HEADER_PAGES; i < count; i++) {
+    iov[iovcnt].iov_base =
+        i < 0 ? (void*)&header[DOUBLEWRITE_HEADER_PAGES + i] : (void*)pages[i];
+    iov[iovcnt].iov_len = PAGE_SIZE;
+    iovcnt++;
+
+    if (iovcnt == IOV_MAX || i == count - 1) {
+      ssize_t length = (ssize_t)iovcnt * PAGE_SIZE;
+      if (pwritev(file_doublewrite_fd, iov, iovcnt, offset) != length) {
+        result = -1;
+      }
+      offset += length;
+      iovcnt = 0;
+    }
+  }
+
+  if (result == 0 && fdatasync(file_doublewrite_fd) < 0) {
+    result = -1;
+  }
+  return result;
+}
+
+void file_end_doublewrite() {
+  pthread_mutex_unlock(&file_doublewrite_latch);
+}
+
+// Rewrite the pages whose in-place write was torn from their copies, and
+// return how many were. A copy that is torn itself was never written in
+// place. Torn pages are found by their checksums, which the copies always
+// have.
+int file_repair_torn_pages() {
+  pthread_mutex_lock(&file_doublewrite_latch);
+
+  int fd = file_doublewrite_fd;
+  if (fd < 0) {
+    fd = file_open(DOUBLEWRITE_PATH, O_RDWR);
+  }
+  if (fd < 0) {
+    pthread_mutex_unlock(&file_doublewrite_latch);
+    return 0;
+  }
+  file_doublewrite_fd = fd;
+
+  page_t* header = file_doublewrite_header;
+  memset(header, 0, sizeof(file_doublewrite_header));
+  pread(fd, header, sizeof(file_doublewrite_header), 0);
+
+  int64_t magic_number;
+  uint64_t num_pages;
+  memcpy(&magic_number, header[0].data, 8);
+  memcpy(&num_pages, header[0].data + 8, 8);
+  if (magic_number != DOUBLEWRITE_MAGIC_NUM || num_pages > DOUBLEWRITE_PAGES) {
+    num_pages = 0;
+  }
+
+  int num_repaired = 0;
+  std::vector<int64_t> repaired_tables;
+  for (uint64_t i = 0; i < num_pages; i++) {
+    int64_t table_id;
+    pagenum_t pagenum;
+    const uint8_t* entry = header[1].data + i * DOUBLEWRITE_ENTRY_SIZE;
+    memcpy(&table_id, entry, 8);
+    memcpy(&pagenum, entry + 8, 8);
+    if (table_id < 0 || table_id >= MAX_NUM_TABLE) {
+      continue;
+    }
+
+    // A table whose file is gone is not recreated from its copies
+    if (file_find_fd(table_id) < 0) {
+      continue;
+    }
+
+    page_t copy;
+    if (pread(fd, &copy, PAGE_SIZE, (DOUBLEWRITE_HEADER_PAGES + i) * PAGE_SIZE) !=
+            PAGE_SIZE ||
+        !(file_get_page_flags(&copy) & PAGE_FLAG_STAMPED) ||
+        file_verify_checksum(&copy) < 0) {
+      continue;
+    }
+
+    page_t page;
+    if (file_read_page(table_id, pagenum, &page) == 0 &&
+        file_verify_checksum(&page) == 0) {
+      continue;
+    }
+
+    file_write_page(table_id, pagenum, &copy);
+    num_repaired++;
+    if (std::find(repaired_tables.begin(), repaired_tables.end(), table_id) ==
+        repaired_tables.end()) {
+      repaired_tables.push_back(table_id);
+    }
+  }
+
+  for (int64_t table_id : repaired_tables) {
+    int table_fd = file_acquire_fd(table_id);
+    if (table_fd >= 0) {
+      fdatasync(table_fd);
+      file_release_fd(table_id);
+    }
+  }
+
+  // The repaired pages are durable, so the copies are not needed any more
+  memset(header, 0, PAGE_SIZE);
+  pwrite(fd, header, PAGE_SIZE, 0);
+  fdatasync(fd);
+
+  pthread_mutex_unlock(&file_doublewrite_latch);
+  return num_repaired;
+}
+
+// Called with file_doublewrite_latch held
+int file_open_doublewrite() {
+  if (file_doublewrite_fd >= 0) {
+    return 0;
+  }
+
+  int flags = O_RDWR | O_CREAT;
+  if (file_direct_io) {
+    flags |= O_DIRECT;
+  }
+  file_doublewrite_fd = file_open(DOUBLEWRITE_PATH, flags);
+  return file_doublewrite_fd >= 0 ? 0 : -1;
+}
+
+// Empty the doublewrite file once the pages are durable in place, so that a
+// later start finds no copies to repair from
+void file_close_doublewrite() {
+  pthread_mutex_lock(&file_doublewrite_latch);
+
+  if (file_doublewrite_fd >= 0) {
+    memset(file_doublewrite_header, 0, PAGE_SIZE);
+    pwrite(file_doublewrite_fd, file_doublewrite_header, PAGE_SIZE, 0);
+    fdatasync(file_doublewrite_fd);
+    close(file_doublewrite_fd);
+    file_doublewrite_fd = -1;
+  }
+  file_doublewrite_tables.clear();
+
+  pthread_mutex_unlock(&file_doublewrite_latch);
+}
+
+// Header page fields of an in-memory page.
+
+int64_t file_get_magic_number(const page_t* header) {
+  int64_t magic_number;
+  memcpy(&magic_number, header->data, 8);
+  return magic_number;
+}
+
+void file_set_magic_number(page_t* header, const int64_t magic_number) {
+  memcpy(header->data, &magic_number, 8);
+}
+
+pagenum_t file_get_first_free_page_number(const page_t* header) {
+  pagenum_t first;
+  memcpy(&first, header->data + 8, 8);
+  return first;
+}
+
+void file_set_first_free_page_number(page_t* header, const pagenum_t first) {
+  memcpy(header->data + 8, &first, 8);
+}
+
+uint64_t file_get_number_of_pages(const page_t* header) {
+  uint64_t number_of_pages;
+  memcpy(&number_of_pages, header->data + 16, 8);
+  return number_of_pages;
+}
+
+void file_set_number_of_pages(page_t* header, const uint64_t number_of_pages) {
+  memcpy(header->data + 16, &number_of_pages, 8);
+}
+
+pagenum_t file_get_high_water_mark(const page_t* header) {
+  pagenum_t high_water_mark;
+  memcpy(&high_water_mark, header->data + 48, 8);
+  return high_water_mark;
+}
+
+void file_set_high_water_mark(page_t* header, const pagenum_t high_water_mark) {
+  memcpy(header->data + 48, &high_water_mark, 8);
+}
+
+int32_t file_get_page_format(const page_t* header) {
+  int32_t page_format;
+  memcpy(&page_format, header->data + 56, 4);
+  return page_format;
+}
+
+void file_set_page_format(page_t* header, const int32_t page_format) {
+  memcpy(header->data + 56, &page_format, 4);
+}
+
+pagenum_t file_get_next_free_page_number(const page_t* page) {
+  pagenum_t next;
+  memcpy(&next, page->data, 8);
+  return next;
+}
+
+void file_set_next_free_page_number(page_t* page, const pagenum_t next) {
+  memcpy(page->data, &next, 8);
+}
+
+uint32_t file_get_checksum(const page_t* page) {
+  uint32_t checksum;
+  memcpy(&checksum, page->data + PAGE_CHECKSUM_OFFSET, 4);
+  return checksum;
+}
+
+void file_set_checksum(page_t* page, const uint32_t checksum) {
+  memcpy(page->data + PAGE_CHECKSUM_OFFSET, &checksum, 4);
+}
+
+uint32_t file_get_page_flags(const page_t* page) {
+  uint32_t flags;
+  memcpy(&flags, page->data + PAGE_FLAGS_OFFSET, 4);
+  return flags;
 }
 
-void file_extend_to_end(int fd, pagenum_t last) {
-  pwrite(fd, "\0", 1, (last + 1) * PAGE_SIZE - 1);
+void file_set_page_flags(page_t* page, const uint32_t flags) {
+  memcpy(page->data + PAGE_FLAGS_OFFSET, &flags, 4);
 }
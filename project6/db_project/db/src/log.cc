@@ -5,6 +5,8 @@
 int log_fd;
 
 int64_t g_lsn = 0;
+std::atomic<int64_t> log_flushed_lsn;
+std::atomic<uint64_t> log_num_syncs;
 
 std::vector<log_t*> log_buffer;
 pthread_mutex_t log_buffer_latch;
@@ -232,26 +234,36 @@ static void _add(log_t* log) {
   log_buffer.push_back(log);
 }
 
-void log_add(log_t* log) {
+// Return the LSN given to the log, which may be flushed and freed as soon as
+// it is added
+int64_t log_add(log_t* log) {
   pthread_mutex_lock(&log_buffer_latch);
 
   _add(log);
+  int64_t lsn = log_get_lsn(log);
 
   pthread_mutex_unlock(&log_buffer_latch);
+
+  return lsn;
 }
 
 static void _flush() {
-  for (log_t* log : log_buffer) {
-    uint32_t size = log_get_log_size(log);
-    int64_t lsn = log_get_lsn(log);
-    pwrite(log_fd, log->data, size, lsn);
+  if (!log_buffer.empty()) {
+    for (log_t* log : log_buffer) {
+      uint32_t size = log_get_log_size(log);
+      int64_t lsn = log_get_lsn(log);
+      pwrite(log_fd, log->data, size, lsn);
+
+      delete[] log->data;
+      delete log;
+    }
+    fsync(log_fd);
+    log_num_syncs++;
 
-    delete[] log->data;
-    delete log;
+    log_buffer.clear();
   }
-  fsync(log_fd);
 
-  log_buffer.clear();
+  log_flushed_lsn.store(g_lsn, std::memory_order_release);
 }
 
 void log_flush() {
@@ -262,6 +274,22 @@ void log_flush() {
   pthread_mutex_unlock(&log_buffer_latch);
 }
 
+// Make the log durable up to the record at lsn. The whole buffer is flushed
+// if it is not yet, so the records added since go along.
+void log_flush_until(int64_t lsn) {
+  if (lsn < log_flushed_lsn.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  pthread_mutex_lock(&log_buffer_latch);
+
+  if (lsn >= log_flushed_lsn.load(std::memory_order_relaxed)) {
+    _flush();
+  }
+
+  pthread_mutex_unlock(&log_buffer_latch);
+}
+
 void log_add_and_flush(log_t* log) {
   pthread_mutex_lock(&log_buffer_latch);
 
@@ -273,6 +301,8 @@ void log_add_and_flush(log_t* log) {
 
 int log_init_db(char* log_path) {
   log_buffer_latch = PTHREAD_MUTEX_INITIALIZER;
+  log_flushed_lsn = 0;
+  log_num_syncs = 0;
 
   log_fd = open(log_path, O_RDWR);
   if (log_fd < 0) {
@@ -368,10 +398,15 @@ void log_get_losers(std::set<int32_t>& winners,
   std::reverse(undo_logs.begin(), undo_logs.end());
 }
 
+// Return 1 if the log is applied, 0 if the page is newer, or -1 if the page
+// can't be read
 int log_redo(log_t* log) {
   int64_t table_id = log_get_table_id(log);
   pagenum_t page_num = log_get_page_num(log);
   control_block_t* block = buf_read_page(table_id, page_num);
+  if (block == NULL) {
+    return -1;
+  }
 
   int64_t lsn = log_get_lsn(log);
   if (lsn <= log_get_page_lsn(block->frame)) {
@@ -396,10 +431,13 @@ int log_redo(log_t* log) {
   return 1;
 }
 
-void log_undo(log_t* log) {
+int log_undo(log_t* log) {
   int64_t table_id = log_get_table_id(log);
   pagenum_t page_num = log_get_page_num(log);
   control_block_t* block = buf_read_page(table_id, page_num);
+  if (block == NULL) {
+    return -1;
+  }
 
   uint16_t offset = log_get_offset(log);
   uint16_t length = log_get_data_length(log);
@@ -410,15 +448,15 @@ void log_undo(log_t* log) {
   memcpy(block->frame->data + offset, old_val, length);
 
   log_t* compensate_log = log_make_compensate_log(log);
-  int64_t lsn = log_get_lsn(compensate_log);
-
-  log_add(compensate_log);
+  int64_t lsn = log_add(compensate_log);
 
   log_set_page_lsn(block->frame, lsn);
 
   buf_unpin_block(block, 1);
 
   delete[] old_val;
+
+  return 0;
 }
 
 std::vector<log_t*> log_trace(int64_t last_lsn) {
@@ -454,6 +492,11 @@ std::vector<log_t*> log_trace(int64_t last_lsn) {
 int log_recover(int flag, int log_num, char* logmsg_path) {
   FILE* logmsg_fp = fopen(logmsg_path, "w");
 
+  // The pages recovery reads may have been torn by the crash. Those written
+  // through the doublewrite file are repaired before redo reads them.
+  file_in_recovery = 1;
+  file_repair_torn_pages();
+
   // ANALYZE
 
   fprintf(logmsg_fp, "[ANALYSIS] Analysis pass start\n");
@@ -479,6 +522,8 @@ int log_recover(int flag, int log_num, char* logmsg_path) {
 
   fprintf(logmsg_fp, "[REDO] Redo pass start\n");
 
+  // A page that can't be read is left as it is, and recovery fails
+  int result = 0;
   int i = 0;
   while ((flag != REDO_CRASH || i < log_num) && i < redo_logs.size()) {
     log_t* log = redo_logs[i++];
@@ -494,7 +539,11 @@ int log_recover(int flag, int log_num, char* logmsg_path) {
     } else if (type == ROLLBACK) {
       fprintf(logmsg_fp, "LSN %lu [ROLLBACK] Transaction id %d\n", lsn, trx_id);
     } else {
-      if (log_redo(log)) {
+      int applied = log_redo(log);
+      if (applied < 0) {
+        fprintf(logmsg_fp, "LSN %lu [REDO] Page not readable\n", lsn);
+        result = -1;
+      } else if (applied) {
         if (type == UPDATE) {
           fprintf(logmsg_fp, "LSN %lu [UPDATE] Transaction id %d redo apply\n",
                   lsn, trx_id);
@@ -510,7 +559,8 @@ int log_recover(int flag, int log_num, char* logmsg_path) {
     }
   }
   if (flag == REDO_CRASH) {
-    return 0;
+    file_in_recovery = 0;
+    return result;
   }
 
   fprintf(logmsg_fp, "[REDO] Redo pass end\n");
@@ -534,29 +584,26 @@ int log_recover(int flag, int log_num, char* logmsg_path) {
       delete trx_table[trx_id];
       trx_table.erase(trx_id);
     } else if (type == UPDATE) {
-      log_undo(log);
+      if (log_undo(log) != 0) {
+        fprintf(logmsg_fp, "LSN %lu [UNDO] Page not readable\n", lsn);
+        result = -1;
+        continue;
+      }
       fprintf(logmsg_fp, "LSN %lu [UPDATE] Transaction id %d undo apply\n", lsn,
               trx_id);
     }
   }
   if (flag == UNDO_CRASH) {
-    return 0;
+    file_in_recovery = 0;
+    return result;
   }
 
   fprintf(logmsg_fp, "[UNDO] Undo pass end\n");
 
   fclose(logmsg_fp);
+  file_in_recovery = 0;
 
-  log_flush();
-
-  control_block_t* temp = head_block;
-  while (temp != NULL) {
-    if (temp->is_dirty) {
-      file_write_page(temp->table_id, temp->page_num, temp->frame);
-      temp->is_dirty = 0;
-    }
-    temp = temp->next;
-  }
+  buf_checkpoint();
 
   for (log_t* log : redo_logs) {
     delete[] log->data;
@@ -567,5 +614,5 @@ int log_recover(int flag, int log_num, char* logmsg_path) {
     delete log;
   }
 
-  return 0;
+  return result;
 }
@@ -0,0 +1,364 @@
+#include "policy.h"
+
+#include "buffer.h"
+
+// GLOBALS.
+
+const policy_t policies[NUM_POLICIES] = {
+    {"LRU", policy_lru_load, policy_lru_load_once, policy_lru_refer,
+     policy_lru_empty, policy_lru_find_victim, policy_lru_list_victims},
+    {"CLOCK", policy_clock_load, policy_clock_load_once, policy_clock_refer,
+     policy_clock_empty, policy_clock_find_victim, policy_clock_list_victims},
+    // 2Q and LRU-K already replace pages referenced once first
+    {"2Q", policy_2q_load, policy_2q_load, policy_2q_refer, policy_2q_empty,
+     policy_2q_find_victim, policy_2q_list_victims},
+    {"LRU-K", policy_lru_k_load, policy_lru_k_load, policy_lru_k_refer,
+     policy_lru_k_empty, policy_lru_k_find_victim, policy_lru_k_list_victims},
+};
+
+// APIs.
+
+// LRU moves a block to the front of its list on every reference, and
+// replaces from the back. Pages read by scans go to the front of the second
+// list instead, which is replaced first while it holds more than its share,
+// so that a scan replaces mostly the pages it read itself. A page referenced
+// again moves to the first list.
+
+void policy_lru_load(control_block_t* block) {
+  policy_lru_refer(block);
+}
+
+void policy_lru_load_once(control_block_t* block) {
+  policy_remove(block);
+  policy_push_front(block, 1);
+}
+
+void policy_lru_refer(control_block_t* block) {
+  if (block == block->partition->lists[0].head) {
+    return;
+  }
+  policy_remove(block);
+  policy_push_front(block, 0);
+}
+
+void policy_lru_empty(control_block_t* block) {
+  policy_remove(block);
+  policy_push_back(block, 0);
+}
+
+control_block_t* policy_lru_find_victim(buf_partition_t* partition,
+                                        int clean_only) {
+  size_t scan_size = partition->blocks.size() / SCAN_SHARE;
+  int list =
+      partition->lists[1].size > scan_size || partition->lists[0].size == 0;
+
+  control_block_t* block = policy_scan_list(partition, list, clean_only);
+  if (block == NULL) {
+    block = policy_scan_list(partition, 1 - list, clean_only);
+  }
+  return block;
+}
+
+void policy_lru_list_victims(buf_partition_t* partition,
+                             size_t count,
+                             std::vector<control_block_t*>* blocks) {
+  size_t scan_size = partition->blocks.size() / SCAN_SHARE;
+  int list =
+      partition->lists[1].size > scan_size || partition->lists[0].size == 0;
+
+  size_t num_blocks = blocks->size();
+  policy_list_from_tail(partition, list, count, blocks);
+  policy_list_from_tail(partition, 1 - list,
+                        count - (blocks->size() - num_blocks), blocks);
+}
+
+// CLOCK only sets a bit on a reference. The hand sweeps the blocks, clearing
+// the bits it passes, and replaces the first block whose bit was clear.
+
+void policy_clock_load(control_block_t* block) {
+  block->referenced = 1;
+}
+
+// The hand replaces a page read by a scan the first time it comes by
+void policy_clock_load_once(control_block_t* block) {
+  block->referenced = 0;
+}
+
+void policy_clock_refer(control_block_t* block) {
+  block->referenced = 1;
+}
+
+void policy_clock_empty(control_block_t* block) {
+  block->referenced = 0;
+}
+
+// The search for a clean block only looks ahead of the hand, so the pages it
+// passes keep their reference bits for the sweep that follows
+control_block_t* policy_clock_find_victim(buf_partition_t* partition,
+                                          int clean_only) {
+  size_t num_blocks = partition->blocks.size();
+  if (clean_only) {
+    size_t depth = std::min((size_t)CLEAN_SEARCH_DEPTH, num_blocks);
+    for (size_t step = 0; step < depth; step++) {
+      control_block_t* block =
+          partition->blocks[(partition->clock_hand + step) % num_blocks];
+      if (!block->referenced && policy_try_take(block, clean_only)) {
+        return block;
+      }
+    }
+    return NULL;
+  }
+
+  for (size_t step = 0; step < 2 * num_blocks; step++) {
+    control_block_t* block = partition->blocks[partition->clock_hand];
+    partition->clock_hand = (partition->clock_hand + 1) % num_blocks;
+
+    if (block->referenced) {
+      block->referenced = 0;
+      continue;
+    }
+    if (policy_try_take(block, clean_only)) {
+      return block;
+    }
+  }
+  return NULL;
+}
+
+// The hand replaces the blocks whose bits are clear first
+void policy_clock_list_victims(buf_partition_t* partition,
+                               size_t count,
+                               std::vector<control_block_t*>* blocks) {
+  size_t num_blocks = partition->blocks.size();
+  size_t num_listed = 0;
+  for (size_t step = 0; step < num_blocks && num_listed < count; step++) {
+    control_block_t* block =
+        partition->blocks[(partition->clock_hand + step) % num_blocks];
+    if (block->pin_count == 0 && !block->referenced) {
+      blocks->push_back(block);
+      num_listed++;
+    }
+  }
+}
+
+// 2Q (simplified) loads pages into the first list, which is replaced in FIFO
+// order while it holds more than its share of the blocks. A page referenced
+// again moves to the second list, which is kept in LRU order, so a scan
+// replaces only the pages it read itself.
+
+void policy_2q_load(control_block_t* block) {
+  policy_remove(block);
+  policy_push_front(block, 0);
+}
+
+void policy_2q_refer(control_block_t* block) {
+  if (block == block->partition->lists[1].head) {
+    return;
+  }
+  policy_remove(block);
+  policy_push_front(block, 1);
+}
+
+void policy_2q_empty(control_block_t* block) {
+  policy_remove(block);
+  policy_push_back(block, 0);
+}
+
+control_block_t* policy_2q_find_victim(buf_partition_t* partition,
+                                       int clean_only) {
+  size_t a1_size = partition->blocks.size() / A1_SHARE;
+  int list =
+      partition->lists[0].size > a1_size || partition->lists[1].size == 0 ? 0
+                                                                          : 1;
+
+  control_block_t* block = policy_scan_list(partition, list, clean_only);
+  if (block == NULL) {
+    block = policy_scan_list(partition, 1 - list, clean_only);
+  }
+  return block;
+}
+
+void policy_2q_list_victims(buf_partition_t* partition,
+                            size_t count,
+                            std::vector<control_block_t*>* blocks) {
+  size_t a1_size = partition->blocks.size() / A1_SHARE;
+  int list =
+      partition->lists[0].size > a1_size || partition->lists[1].size == 0 ? 0
+                                                                          : 1;
+
+  size_t num_blocks = blocks->size();
+  policy_list_from_tail(partition, list, count, blocks);
+  policy_list_from_tail(partition, 1 - list,
+                        count - (blocks->size() - num_blocks), blocks);
+}
+
+// LRU-K keeps the times of the last K references of a block. A block
+// referenced fewer than K times is replaced first, and otherwise the one
+// whose K-th last reference is the oldest. Blocks are sampled from a hand
+// like CLOCK's, so that a victim is found without sorting the partition.
+
+void policy_lru_k_load(control_block_t* block) {
+  memset(block->history, 0, sizeof(block->history));
+  block->history[0] = ++block->partition->clock;
+}
+
+void policy_lru_k_refer(control_block_t* block) {
+  for (int i = LRU_K - 1; i > 0; i--) {
+    block->history[i] = block->history[i - 1];
+  }
+  block->history[0] = ++block->partition->clock;
+}
+
+void policy_lru_k_empty(control_block_t* block) {
+  memset(block->history, 0, sizeof(block->history));
+}
+
+control_block_t* policy_lru_k_find_victim(buf_partition_t* partition,
+                                          int clean_only) {
+  size_t num_blocks = partition->blocks.size();
+  size_t max_steps = clean_only ? CLEAN_SEARCH_DEPTH : num_blocks;
+
+  control_block_t* victim = NULL;
+  int num_sampled = 0;
+  for (size_t step = 0; step < max_steps && num_sampled < LRU_K_SAMPLE_SIZE;
+       step++) {
+    control_block_t* block = partition->blocks[partition->clock_hand];
+    partition->clock_hand = (partition->clock_hand + 1) % num_blocks;
+
+    if (block->pin_count != 0 || (clean_only && block->is_dirty)) {
+      continue;
+    }
+    num_sampled++;
+
+    if (victim != NULL) {
+      uint64_t distance = block->history[LRU_K - 1];
+      uint64_t victim_distance = victim->history[LRU_K - 1];
+      if (distance > victim_distance ||
+          (distance == victim_distance &&
+           block->history[0] >= victim->history[0])) {
+        continue;
+      }
+    }
+    if (!policy_try_take(block, clean_only)) {
+      continue;
+    }
+
+    if (victim != NULL) {
+      buf_unlatch_block(victim);
+    }
+    victim = block;
+  }
+  return victim;
+}
+
+// Without sampling, the blocks go in the order of their K-th last reference
+void policy_lru_k_list_victims(buf_partition_t* partition,
+                               size_t count,
+                               std::vector<control_block_t*>* blocks) {
+  std::vector<control_block_t*> unpinned;
+  for (control_block_t* block : partition->blocks) {
+    if (block->pin_count == 0) {
+      unpinned.push_back(block);
+    }
+  }
+
+  count = std::min(count, unpinned.size());
+  std::partial_sort(unpinned.begin(), unpinned.begin() + count, unpinned.end(),
+                    [](const control_block_t* b1, const control_block_t* b2) {
+                      if (b1->history[LRU_K - 1] != b2->history[LRU_K - 1]) {
+                        return b1->history[LRU_K - 1] < b2->history[LRU_K - 1];
+                      }
+                      return b1->history[0] < b2->history[0];
+                    });
+  blocks->insert(blocks->end(), unpinned.begin(), unpinned.begin() + count);
+}
+
+// Utilities.
+
+// Latch the block if it can be replaced
+int policy_try_take(control_block_t* block, int clean_only) {
+  if (block->pin_count != 0 || (clean_only && block->is_dirty)) {
+    return 0;
+  }
+  if (pthread_rwlock_trywrlock(&block->page_latch) != 0) {
+    return 0;
+  }
+  buf_begin_change(block);
+  return 1;
+}
+
+// Return the first replaceable block from the back of the list, with its latch
+// held
+control_block_t* policy_scan_list(buf_partition_t* partition,
+                                  int list,
+                                  int clean_only) {
+  size_t depth = 0;
+  for (control_block_t* temp = partition->lists[list].tail; temp != NULL;
+       temp = temp->prev) {
+    if (clean_only && depth++ == CLEAN_SEARCH_DEPTH) {
+      break;
+    }
+    if (policy_try_take(temp, clean_only)) {
+      return temp;
+    }
+  }
+  return NULL;
+}
+
+void policy_list_from_tail(buf_partition_t* partition,
+                           int list,
+                           size_t count,
+                           std::vector<control_block_t*>* blocks) {
+  size_t num_listed = 0;
+  for (control_block_t* temp = partition->lists[list].tail;
+       temp != NULL && num_listed < count; temp = temp->prev) {
+    if (temp->pin_count == 0) {
+      blocks->push_back(temp);
+      num_listed++;
+    }
+  }
+}
+
+void policy_remove(control_block_t* block) {
+  buf_list_t* list = &block->partition->lists[block->list];
+  if (block->prev != NULL) {
+    block->prev->next = block->next;
+  } else {
+    list->head = block->next;
+  }
+  if (block->next != NULL) {
+    block->next->prev = block->prev;
+  } else {
+    list->tail = block->prev;
+  }
+  block->next = NULL;
+  block->prev = NULL;
+  list->size--;
+}
+
+void policy_push_front(control_block_t* block, int list) {
+  buf_list_t* l = &block->partition->lists[list];
+  block->list = list;
+  block->prev = NULL;
+  block->next = l->head;
+  if (l->head != NULL) {
+    l->head->prev = block;
+  } else {
+    l->tail = block;
+  }
+  l->head = block;
+  l->size++;
+}
+
+void policy_push_back(control_block_t* block, int list) {
+  buf_list_t* l = &block->partition->lists[list];
+  block->list = list;
+  block->next = NULL;
+  block->prev = l->tail;
+  if (l->tail != NULL) {
+    l->tail->next = block;
+  } else {
+    l->head = block;
+  }
+  l->tail = block;
+  l->size++;
+}
@@ -0,0 +1,356 @@
+#include "space.h"
+
+#include "file.h"
+
+const char* space_pathname = NULL;
+int space_fd = -1;
+pthread_mutex_t space_latch = PTHREAD_MUTEX_INITIALIZER;
+
+// The header page of the open tablespace, written through on every change
+static page_t space_header;
+
+static uint64_t space_get_field(const void* page, int offset) {
+  uint64_t value;
+  memcpy(&value, (const uint8_t*)page + offset, 8);
+  return value;
+}
+
+static void space_set_field(void* page, int offset, uint64_t value) {
+  memcpy((uint8_t*)page + offset, &value, 8);
+}
+
+// APIs.
+
+// Open the tablespace file, creating it if it doesn't exist
+int space_open() {
+  pthread_mutex_lock(&space_latch);
+  if (space_fd >= 0) {
+    pthread_mutex_unlock(&space_latch);
+    return 0;
+  }
+
+  int flags = O_RDWR;
+  if (file_direct_io) {
+    flags |= O_DIRECT;
+  }
+
+  int fd = file_open(space_pathname, flags);
+  if (fd < 0) {
+    fd = file_open(space_pathname, flags | O_CREAT | O_TRUNC);
+    if (fd < 0) {
+      pthread_mutex_unlock(&space_latch);
+      return -1;
+    }
+
+    // The first extent holds the header, the first directory page and the
+    // metadata pages allocated next
+    uint64_t number_of_pages = INITIAL_SPACE_SIZE / PAGE_SIZE;
+    file_allocate_pages(fd, 0, number_of_pages);
+
+    page_t header = {};
+    space_set_field(&header, 0, SPACE_MAGIC_NUM);
+    space_set_field(&header, SPACE_NUMBER_OF_PAGES, number_of_pages);
+    space_set_field(&header, SPACE_NEXT_EXTENT, EXTENT_SIZE);
+    space_set_field(&header, SPACE_FIRST_DIRECTORY, 1);
+    space_set_field(&header, SPACE_NEXT_METADATA_PAGE, 2);
+    space_set_field(&header, SPACE_METADATA_END, EXTENT_SIZE);
+
+    page_t directory = {};
+    pwrite(fd, &directory, PAGE_SIZE, PAGE_SIZE);
+    pwrite(fd, &header, PAGE_SIZE, 0);
+
+    fsync(fd);
+  }
+
+  if (pread(fd, &space_header, PAGE_SIZE, 0) != PAGE_SIZE ||
+      space_get_field(&space_header, 0) != SPACE_MAGIC_NUM) {
+    close(fd);
+    pthread_mutex_unlock(&space_latch);
+    return -1;
+  }
+
+  space_fd = fd;
+
+  pthread_mutex_unlock(&space_latch);
+  return 0;
+}
+
+void space_close() {
+  pthread_mutex_lock(&space_latch);
+  if (space_fd >= 0) {
+    fdatasync(space_fd);
+    close(space_fd);
+    space_fd = -1;
+  }
+  pthread_mutex_unlock(&space_latch);
+}
+
+// Find the segment of the table, or create it with its header page
+int space_open_segment(const char* name, segment_t** segment) {
+  if (strlen(name) > MAX_TABLE_NAME_LENGTH) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&space_latch);
+
+  uint64_t first_inode = 0;
+  page_t directory;
+  uint64_t pagenum = space_get_field(&space_header, SPACE_FIRST_DIRECTORY);
+  while (pagenum != 0 && first_inode == 0 &&
+         space_read_page(pagenum, &directory) == 0) {
+    uint64_t num_entries = space_get_field(&directory, 8);
+    for (uint64_t i = 0; i < num_entries && i < MAX_DIRECTORY_ENTRIES; i++) {
+      const uint8_t* entry = directory.data + 64 + i * DIRECTORY_ENTRY_SIZE;
+      if (strncmp((const char*)entry, name, MAX_TABLE_NAME_LENGTH + 1) == 0) {
+        first_inode = space_get_field(entry, MAX_TABLE_NAME_LENGTH + 1);
+        break;
+      }
+    }
+    pagenum = space_get_field(&directory, 0);
+  }
+
+  *segment = first_inode != 0 ? space_load_segment(first_inode)
+                              : space_create_segment(name);
+
+  pthread_mutex_unlock(&space_latch);
+  return *segment != NULL ? 0 : -1;
+}
+
+void space_free_segment(segment_t* segment) {
+  if (segment == NULL) {
+    return;
+  }
+  for (const std::vector<uint64_t>* extents : segment->retired_extents) {
+    delete extents;
+  }
+  delete segment->extents.load();
+  delete segment;
+}
+
+// Add extents to the segment until it holds new_size pages, and return the
+// number of pages it holds
+uint64_t space_grow_segment(segment_t* segment, uint64_t new_size) {
+  pthread_mutex_lock(&space_latch);
+
+  const std::vector<uint64_t>* extents = segment->extents;
+  std::vector<uint64_t>* grown = new std::vector<uint64_t>(*extents);
+  while (grown->size() * EXTENT_SIZE < new_size) {
+    uint64_t extent = space_alloc_extent();
+    if (extent == 0 || space_add_extent(segment, extent) < 0) {
+      break;
+    }
+    grown->push_back(extent);
+  }
+
+  uint64_t number_of_pages = grown->size() * EXTENT_SIZE;
+  if (grown->size() > extents->size()) {
+    // The new extents are durable before any page is written to them, so
+    // recovery finds the pages where they were written
+    fdatasync(space_fd);
+
+    segment->retired_extents.push_back(extents);
+    segment->extents = grown;
+  } else {
+    delete grown;
+  }
+
+  pthread_mutex_unlock(&space_latch);
+  return number_of_pages;
+}
+
+// Return the offset of a page of the segment in the tablespace file
+off_t space_page_offset(const segment_t* segment, uint64_t pagenum) {
+  const std::vector<uint64_t>* extents = segment->extents;
+  uint64_t i = pagenum / EXTENT_SIZE;
+  if (i >= extents->size()) {
+    return -1;
+  }
+  return ((*extents)[i] + pagenum % EXTENT_SIZE) * PAGE_SIZE;
+}
+
+int space_sync() {
+  if (space_fd < 0) {
+    return 0;
+  }
+  return fdatasync(space_fd);
+}
+
+// Utilities.
+
+int space_read_page(uint64_t pagenum, void* dest) {
+  if (pread(space_fd, dest, PAGE_SIZE, pagenum * PAGE_SIZE) != PAGE_SIZE) {
+    return -1;
+  }
+  return 0;
+}
+
+int space_write_page(uint64_t pagenum, const void* src) {
+  if (pwrite(space_fd, src, PAGE_SIZE, pagenum * PAGE_SIZE) != PAGE_SIZE) {
+    return -1;
+  }
+  return 0;
+}
+
+// Take the next unused extent, growing the tablespace file by doubling once
+// it is full. Return 0 if the file can not grow. Called with space_latch
+// held.
+uint64_t space_alloc_extent() {
+  uint64_t extent = space_get_field(&space_header, SPACE_NEXT_EXTENT);
+  uint64_t number_of_pages =
+      space_get_field(&space_header, SPACE_NUMBER_OF_PAGES);
+  if (extent + EXTENT_SIZE > number_of_pages) {
+    uint64_t new_size = 2 * number_of_pages;
+    if (file_allocate_pages(space_fd, number_of_pages, new_size) < 0) {
+      return 0;
+    }
+    space_set_field(&space_header, SPACE_NUMBER_OF_PAGES, new_size);
+  }
+
+  space_set_field(&space_header, SPACE_NEXT_EXTENT, extent + EXTENT_SIZE);
+  space_write_page(0, &space_header);
+  return extent;
+}
+
+// Take the next page for directory and inode pages, which are allocated an
+// extent at a time as well. Called with space_latch held.
+uint64_t space_alloc_metadata_page() {
+  uint64_t pagenum = space_get_field(&space_header, SPACE_NEXT_METADATA_PAGE);
+  if (pagenum == space_get_field(&space_header, SPACE_METADATA_END)) {
+    pagenum = space_alloc_extent();
+    if (pagenum == 0) {
+      return 0;
+    }
+    space_set_field(&space_header, SPACE_METADATA_END, pagenum + EXTENT_SIZE);
+  }
+
+  space_set_field(&space_header, SPACE_NEXT_METADATA_PAGE, pagenum + 1);
+  space_write_page(0, &space_header);
+  return pagenum;
+}
+
+// Read the extents of a segment from its chain of inode pages
+segment_t* space_load_segment(uint64_t first_inode) {
+  std::vector<uint64_t>* extents = new std::vector<uint64_t>;
+
+  page_t inode;
+  uint64_t last_inode = first_inode;
+  for (uint64_t pagenum = first_inode; pagenum != 0;
+       pagenum = space_get_field(&inode, 0)) {
+    if (space_read_page(pagenum, &inode) < 0) {
+      delete extents;
+      return NULL;
+    }
+
+    uint64_t num_extents = space_get_field(&inode, 8);
+    for (uint64_t i = 0; i < num_extents && i < MAX_INODE_EXTENTS; i++) {
+      extents->push_back(space_get_field(&inode, 16 + i * 8));
+    }
+    last_inode = pagenum;
+  }
+
+  segment_t* segment = new segment_t;
+  segment->first_inode = first_inode;
+  segment->last_inode = last_inode;
+  segment->extents = extents;
+  return segment;
+}
+
+// Create a segment of one extent, whose first page is the header page of an
+// empty table. Called with space_latch held.
+segment_t* space_create_segment(const char* name) {
+  uint64_t first_inode = space_alloc_metadata_page();
+  uint64_t extent = space_alloc_extent();
+  if (first_inode == 0 || extent == 0) {
+    return NULL;
+  }
+
+  page_t header = {};
+  file_set_magic_number(&header, MAGIC_NUM);
+  file_set_number_of_pages(&header, EXTENT_SIZE);
+  file_set_first_free_page_number(&header, 0);
+  file_set_high_water_mark(&header, 1);
+  file_set_page_format(&header, PAGE_FORMAT_RAW);
+
+  page_t inode = {};
+  space_set_field(&inode, 8, 1);
+  space_set_field(&inode, 16, extent);
+
+  if (space_write_page(extent, &header) < 0 ||
+      space_write_page(first_inode, &inode) < 0 ||
+      space_add_directory_entry(name, first_inode) < 0 ||
+      fdatasync(space_fd) < 0) {
+    return NULL;
+  }
+
+  segment_t* segment = new segment_t;
+  segment->first_inode = first_inode;
+  segment->last_inode = first_inode;
+  segment->extents = new std::vector<uint64_t>{extent};
+  return segment;
+}
+
+// Add the entry to the last directory page, chaining a new one if it is full.
+// Called with space_latch held.
+int space_add_directory_entry(const char* name, uint64_t first_inode) {
+  page_t directory;
+  uint64_t pagenum = space_get_field(&space_header, SPACE_FIRST_DIRECTORY);
+  while (space_read_page(pagenum, &directory) == 0) {
+    uint64_t num_entries = space_get_field(&directory, 8);
+    if (num_entries < MAX_DIRECTORY_ENTRIES) {
+      uint8_t* entry = directory.data + 64 + num_entries * DIRECTORY_ENTRY_SIZE;
+      memset(entry, 0, DIRECTORY_ENTRY_SIZE);
+      strncpy((char*)entry, name, MAX_TABLE_NAME_LENGTH);
+      space_set_field(entry, MAX_TABLE_NAME_LENGTH + 1, first_inode);
+      space_set_field(&directory, 8, num_entries + 1);
+      return space_write_page(pagenum, &directory);
+    }
+
+    uint64_t next = space_get_field(&directory, 0);
+    if (next == 0) {
+      next = space_alloc_metadata_page();
+      page_t empty = {};
+      if (next == 0 || space_write_page(next, &empty) < 0) {
+        return -1;
+      }
+      space_set_field(&directory, 0, next);
+      if (space_write_page(pagenum, &directory) < 0) {
+        return -1;
+      }
+    }
+    pagenum = next;
+  }
+  return -1;
+}
+
+// Append the extent to the last inode page of the segment, chaining a new one
+// if it is full. Called with space_latch held.
+int space_add_extent(segment_t* segment, uint64_t extent) {
+  page_t inode;
+  if (space_read_page(segment->last_inode, &inode) < 0) {
+    return -1;
+  }
+
+  uint64_t num_extents = space_get_field(&inode, 8);
+  if (num_extents < MAX_INODE_EXTENTS) {
+    space_set_field(&inode, 16 + num_extents * 8, extent);
+    space_set_field(&inode, 8, num_extents + 1);
+    return space_write_page(segment->last_inode, &inode);
+  }
+
+  uint64_t next = space_alloc_metadata_page();
+  if (next == 0) {
+    return -1;
+  }
+
+  page_t next_inode = {};
+  space_set_field(&next_inode, 8, 1);
+  space_set_field(&next_inode, 16, extent);
+  space_set_field(&inode, 0, next);
+  if (space_write_page(next, &next_inode) < 0 ||
+      space_write_page(segment->last_inode, &inode) < 0) {
+    return -1;
+  }
+
+  segment->last_inode = next;
+  return 0;
+}
@@ -4,7 +4,9 @@
 
 #include <map>
 #include <random>
+#include <set>
 #include <string>
+#include <thread>
 
 int64_t table_id;
 const char* pathname = "DATA1";
@@ -25,6 +27,1146 @@ TEST(DbBasic, IsInitialRootNull) {
   remove(logmsg_path);
 }
 
+TEST(DbBasic, CachesRoot) {
+  init_db(64, 0, 0, log_path, logmsg_path);
+
+  table_id = open_table(pathname);
+
+  // The root is read once, and follows the tree as it grows and shrinks
+  EXPECT_EQ(db_roots[table_id], ROOT_NOT_CACHED);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 1000; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+  control_block_t* header_block = buf_read_page_shared(table_id, 0);
+  pagenum_t root = db_get_root_page_number(header_block->frame);
+  buf_unpin_block(header_block, 0);
+  EXPECT_EQ(db_roots[table_id], root);
+
+  control_block_t* root_block = buf_read_page_shared(table_id, root);
+  EXPECT_FALSE(db_get_is_leaf(root_block->frame));
+  buf_unpin_block(root_block, 0);
+
+  for (int64_t i = 0; i < 1000; i++) {
+    ASSERT_EQ(db_delete(table_id, i), 0);
+  }
+  EXPECT_EQ(db_roots[table_id], 0);
+
+  // A restart reads the root again
+  ASSERT_EQ(db_insert(table_id, 0, value.c_str(), MIN_VAL_SIZE), 0);
+  root = db_roots[table_id];
+  init_db(64, 0, 0, log_path, logmsg_path);
+  table_id = open_table(pathname);
+  EXPECT_EQ(db_roots[table_id], ROOT_NOT_CACHED);
+  ASSERT_EQ(db_insert(table_id, 1, value.c_str(), MIN_VAL_SIZE), 0);
+  EXPECT_EQ(db_roots[table_id], root);
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, ReusesFreedPages) {
+  init_db(4, 0, 0, log_path, logmsg_path);
+
+  table_id = open_table(pathname);
+
+  pagenum_t allocated_page = buf_alloc_page(table_id);
+  pagenum_t freed_page = buf_alloc_page(table_id);
+  EXPECT_NE(allocated_page, freed_page);
+
+  buf_free_page(table_id, freed_page);
+  EXPECT_EQ(buf_alloc_page(table_id), freed_page);
+
+  buf_free_page(table_id, freed_page);
+  ASSERT_EQ(buf_checkpoint(), 0);
+
+  int fd = file_find_fd(table_id);
+  EXPECT_EQ(file_read_first_free_page_number(fd), freed_page);
+  EXPECT_NE(file_read_next_free_page_number(fd, freed_page), allocated_page);
+
+  // Pages freed in a batch are handed out again before the file grows
+  std::set<pagenum_t> freed_pages;
+  for (int i = 0; i < 100; i++) {
+    freed_pages.insert(buf_alloc_page(table_id));
+  }
+  ASSERT_EQ(freed_pages.size(), 100);
+  for (pagenum_t pagenum : freed_pages) {
+    buf_free_page(table_id, pagenum);
+  }
+  ASSERT_EQ(buf_checkpoint(), 0);
+  uint64_t num_pages = file_read_number_of_pages(fd);
+
+  std::set<pagenum_t> reused_pages;
+  for (int i = 0; i < 100; i++) {
+    reused_pages.insert(buf_alloc_page(table_id));
+  }
+  EXPECT_EQ(reused_pages, freed_pages);
+  EXPECT_FALSE(reused_pages.count(allocated_page));
+
+  ASSERT_EQ(buf_checkpoint(), 0);
+  EXPECT_EQ(file_read_number_of_pages(fd), num_pages);
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, ReadsCleanTablesThroughMapping) {
+  file_mmap_reads = 1;
+  init_db(16, 0, 0, log_path, logmsg_path);
+
+  table_id = open_table(pathname);
+  file_mmap_reads = 0;
+  ASSERT_NE(file_get_mapped_page(table_id, 0), nullptr);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 500; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+  EXPECT_GT(buf_count_dirty_pages(table_id), 0);
+
+  // Dirty tables are still read through the buffer
+  char ret_val[MAX_VAL_SIZE];
+  uint16_t val_size;
+  uint64_t num_reads = buf_count_hits() + buf_count_misses();
+  ASSERT_EQ(db_find(table_id, 250, ret_val, &val_size), 0);
+  EXPECT_GT(buf_count_hits() + buf_count_misses(), num_reads);
+
+  ASSERT_EQ(buf_checkpoint(), 0);
+  EXPECT_EQ(buf_count_dirty_pages(table_id), 0);
+
+  num_reads = buf_count_hits() + buf_count_misses();
+  for (int64_t i = 0; i < 500; i++) {
+    ASSERT_EQ(db_find(table_id, i, ret_val, &val_size), 0);
+    EXPECT_EQ(std::string(ret_val, val_size), value);
+  }
+  EXPECT_EQ(db_find(table_id, 500, ret_val, &val_size), -1);
+
+  std::vector<int64_t> keys;
+  std::vector<char*> values;
+  std::vector<uint16_t> val_sizes;
+  ASSERT_EQ(db_scan(table_id, 100, 399, &keys, &values, &val_sizes), 0);
+  EXPECT_EQ(keys.size(), 300);
+  EXPECT_EQ(keys.front(), 100);
+  EXPECT_EQ(keys.back(), 399);
+  for (char* v : values) {
+    delete[] v;
+  }
+  EXPECT_EQ(buf_count_hits() + buf_count_misses(), num_reads);
+
+  // An update makes the table dirty again until the next checkpoint
+  std::string new_value(MIN_VAL_SIZE, 'b');
+  int trx_id = trx_begin();
+  ASSERT_EQ(db_update(table_id, 250, (char*)new_value.c_str(), MIN_VAL_SIZE,
+                      &val_size, trx_id),
+            0);
+  trx_commit(trx_id);
+  ASSERT_EQ(db_find(table_id, 250, ret_val, &val_size), 0);
+  EXPECT_EQ(std::string(ret_val, val_size), new_value);
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, ReadsAheadOnScans) {
+  init_db(1024, 0, 0, log_path, logmsg_path);
+
+  table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 10000; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+
+  // Start from a cold buffer
+  shutdown_db();
+  init_db(1024, 0, 0, log_path, logmsg_path);
+  table_id = open_table(pathname);
+
+  std::vector<int64_t> keys;
+  std::vector<char*> values;
+  std::vector<uint16_t> val_sizes;
+  ASSERT_EQ(db_scan(table_id, 0, 9999, &keys, &values, &val_sizes), 0);
+  ASSERT_EQ(keys.size(), 10000);
+  for (int64_t i = 0; i < 10000; i++) {
+    EXPECT_EQ(keys[i], i);
+    EXPECT_EQ(std::string(values[i], val_sizes[i]), value);
+    delete[] values[i];
+  }
+  EXPECT_GT(buf_num_prefetches, 0);
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, ReplacesUnpinnedBlocksWithEveryPolicy) {
+  buf_num_cleaners = 0;
+  for (int policy = 0; policy < NUM_POLICIES; policy++) {
+    SCOPED_TRACE(policies[policy].name);
+    buf_replacement_policy = policy;
+    init_db(64, 0, 0, log_path, logmsg_path);
+
+    table_id = open_table(pathname);
+
+    std::string value(MIN_VAL_SIZE, 'a');
+    for (int64_t i = 0; i < 3000; i++) {
+      ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+    }
+
+    // The pinned header page stays in its block while every other page is
+    // read through the buffer
+    control_block_t* header_block = buf_read_page(table_id, 0);
+    EXPECT_EQ(header_block->pin_count, 1);
+
+    pagenum_t high_water_mark = file_get_high_water_mark(header_block->frame);
+    ASSERT_GT(high_water_mark, 64);
+    for (pagenum_t page_num = 1; page_num < high_water_mark; page_num++) {
+      buf_unpin_block(buf_read_page(table_id, page_num), 0);
+      ASSERT_EQ(header_block->table_id, table_id);
+      ASSERT_EQ(header_block->page_num, 0);
+    }
+    buf_unpin_block(header_block, 0);
+
+    char ret_val[MAX_VAL_SIZE];
+    uint16_t val_size;
+    for (int64_t i = 0; i < 3000; i++) {
+      ASSERT_EQ(db_find(table_id, i, ret_val, &val_size), 0);
+    }
+
+    EXPECT_EQ(header_block->pin_count, 0);
+    EXPECT_GT(buf_count_misses(), 0);
+
+    shutdown_db();
+    remove(pathname);
+    remove(log_path);
+    remove(logmsg_path);
+  }
+  buf_replacement_policy = POLICY_LRU;
+  buf_num_cleaners = DEFAULT_NUM_CLEANERS;
+}
+
+TEST(BufferTest, KeepsReferenceBitsOnCleanSearch) {
+  buf_num_cleaners = 0;
+  buf_replacement_policy = POLICY_CLOCK;
+  init_db(64, 0, 0, log_path, logmsg_path);
+
+  table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 3000; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+
+  // Only the sweep for any victim clears the bits it passes
+  buf_partition_t* partition = &buf_partitions[0];
+  pthread_mutex_lock(&partition->latch);
+  for (control_block_t* block : partition->blocks) {
+    block->referenced = 1;
+  }
+  size_t clock_hand = partition->clock_hand;
+  EXPECT_EQ(buf_policy->find_victim(partition, 1), nullptr);
+  EXPECT_EQ(partition->clock_hand, clock_hand);
+  for (control_block_t* block : partition->blocks) {
+    EXPECT_EQ(block->referenced, 1);
+  }
+  pthread_mutex_unlock(&partition->latch);
+
+  shutdown_db();
+  buf_replacement_policy = POLICY_LRU;
+  buf_num_cleaners = DEFAULT_NUM_CLEANERS;
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, KeepsHotPagesAcrossScans) {
+  init_db(256, 0, 0, log_path, logmsg_path);
+
+  table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 30000; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+
+  control_block_t* header_block = buf_read_page_shared(table_id, 0);
+  pagenum_t high_water_mark = file_get_high_water_mark(header_block->frame);
+  buf_unpin_block(header_block, 0);
+  ASSERT_GT(high_water_mark, 512);
+
+  // Dirty pages would be passed over for clean ones
+  ASSERT_EQ(buf_checkpoint(), 0);
+
+  // Pages read sequentially replace each other rather than the hot pages,
+  // unless the hints are ignored
+  for (int use_hints = 1; use_hints >= 0; use_hints--) {
+    SCOPED_TRACE(use_hints);
+    buf_use_access_hints = use_hints;
+
+    for (int i = 0; i < 2; i++) {
+      for (pagenum_t page_num = 1; page_num <= 32; page_num++) {
+        buf_unpin_block(buf_read_page_shared(table_id, page_num), 0);
+      }
+    }
+
+    int hint = buf_set_access_hint(ACCESS_SEQUENTIAL);
+    for (pagenum_t page_num = 33; page_num < high_water_mark; page_num++) {
+      buf_unpin_block(buf_read_page_shared(table_id, page_num), 0);
+    }
+    EXPECT_EQ(buf_set_access_hint(hint), ACCESS_SEQUENTIAL);
+
+    int num_resident = 0;
+    for (pagenum_t page_num = 1; page_num <= 32; page_num++) {
+      buf_partition_t* partition = buf_get_partition(table_id, page_num);
+      pthread_mutex_lock(&partition->latch);
+      num_resident +=
+          partition->control_block_table.count({table_id, page_num});
+      pthread_mutex_unlock(&partition->latch);
+    }
+    if (use_hints) {
+      EXPECT_EQ(num_resident, 32);
+    } else {
+      EXPECT_LT(num_resident, 32);
+    }
+  }
+  buf_use_access_hints = 1;
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, DropsPagesThatFailToRead) {
+  init_db(16, 0, 0, log_path, logmsg_path);
+  table_id = open_table(pathname);
+  std::string value(MIN_VAL_SIZE, 'a');
+  ASSERT_EQ(db_insert(table_id, 1, value.c_str(), MIN_VAL_SIZE), 0);
+  pagenum_t root = db_get_root(table_id);
+  shutdown_db();
+
+  init_db(16, 0, 0, log_path, logmsg_path);
+  table_id = open_table(pathname);
+
+  // The root leaf fails its checksum once a byte of it is flipped on disk
+  page_t page;
+  ASSERT_EQ(file_read_page(table_id, root, &page), 0);
+  int fd = file_find_fd(table_id);
+  off_t offset = file_page_offset(table_id, root);
+  page.data[PAGE_SIZE - 1] ^= 1;
+  ASSERT_EQ(pwrite(fd, &page, PAGE_SIZE, offset), PAGE_SIZE);
+
+  EXPECT_EQ(buf_read_page_shared(table_id, root), nullptr);
+  buf_partition_t* partition = buf_get_partition(table_id, root);
+  EXPECT_EQ(partition->control_block_table.count({table_id, root}), 0);
+  EXPECT_EQ(db_find(table_id, 1, NULL, NULL), -1);
+
+  page.data[PAGE_SIZE - 1] ^= 1;
+  ASSERT_EQ(pwrite(fd, &page, PAGE_SIZE, offset), PAGE_SIZE);
+  EXPECT_EQ(db_find(table_id, 1, NULL, NULL), 0);
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+// Flip the last byte of the page on disk, so that it fails its checksum, or
+// flip it back
+void flip_page_on_disk(int64_t table_id, pagenum_t page_num) {
+  page_t page;
+  int fd = file_find_fd(table_id);
+  off_t offset = file_page_offset(table_id, page_num);
+  ASSERT_EQ(pread(fd, &page, PAGE_SIZE, offset), PAGE_SIZE);
+  page.data[PAGE_SIZE - 1] ^= 1;
+  ASSERT_EQ(pwrite(fd, &page, PAGE_SIZE, offset), PAGE_SIZE);
+}
+
+TEST(BufferTest, GivesUpChangesThroughUnreadablePages) {
+  init_db(16, 0, 0, log_path, logmsg_path);
+  table_id = open_table(pathname);
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 1000; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+  pagenum_t root = db_get_root(table_id);
+  shutdown_db();
+
+  init_db(16, 0, 0, log_path, logmsg_path);
+  table_id = open_table(pathname);
+
+  page_t root_page;
+  ASSERT_EQ(file_read_page(table_id, root, &root_page), 0);
+  ASSERT_FALSE(db_get_is_leaf(&root_page));
+  pagenum_t leaf = db_get_child_page_number(&root_page, 0);
+  pagenum_t neighbor = db_get_child_page_number(&root_page, 1);
+
+  // Neither an insert nor a delete gets past an unreadable root
+  flip_page_on_disk(table_id, root);
+  EXPECT_EQ(db_insert(table_id, 1000, value.c_str(), MIN_VAL_SIZE), -1);
+  EXPECT_EQ(db_delete(table_id, 0), -1);
+  flip_page_on_disk(table_id, root);
+  EXPECT_EQ(db_find(table_id, 0, NULL, NULL), 0);
+
+  // The leftmost leaf can't be merged with its unreadable neighbor, so the
+  // delete that leaves it less than half full fails, with the entry gone
+  page_t leaf_page;
+  ASSERT_EQ(file_read_page(table_id, leaf, &leaf_page), 0);
+  int32_t num_keys = db_get_number_of_keys(&leaf_page);
+  buf_partition_t* partition = buf_get_partition(table_id, neighbor);
+  ASSERT_EQ(partition->control_block_table.count({table_id, neighbor}), 0);
+  flip_page_on_disk(table_id, neighbor);
+
+  int64_t key = 0;
+  int result = 0;
+  while (key < num_keys && result == 0) {
+    result = db_delete(table_id, key++);
+  }
+  EXPECT_EQ(result, -1);
+  EXPECT_EQ(db_find(table_id, key - 1, NULL, NULL), -1);
+
+  flip_page_on_disk(table_id, neighbor);
+  while (key < num_keys) {
+    EXPECT_EQ(db_delete(table_id, key++), 0);
+  }
+  EXPECT_EQ(db_insert(table_id, 1000, value.c_str(), MIN_VAL_SIZE), 0);
+  for (key = 0; key <= 1000; key++) {
+    EXPECT_EQ(db_find(table_id, key, NULL, NULL), key < num_keys ? -1 : 0);
+  }
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, ServesMissesFromVictimCache) {
+  buf_victim_cache_size = 1024 * 1024;
+  init_db(64, 0, 0, log_path, logmsg_path);
+
+  table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 10000; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+  ASSERT_EQ(buf_checkpoint(), 0);
+
+  control_block_t* header_block = buf_read_page_shared(table_id, 0);
+  pagenum_t high_water_mark = file_get_high_water_mark(header_block->frame);
+  buf_unpin_block(header_block, 0);
+  ASSERT_GT(high_water_mark, 256);
+
+  // Clean pages evicted on the first pass are read back from memory on the
+  // second, as they are in the file but for the stamped checksum and flags
+  page_t page;
+  for (int i = 0; i < 2; i++) {
+    for (pagenum_t page_num = 1; page_num < high_water_mark; page_num++) {
+      control_block_t* block = buf_read_page_shared(table_id, page_num);
+      ASSERT_EQ(file_read_page(table_id, page_num, &page), 0);
+      memcpy(page.data + PAGE_CHECKSUM_OFFSET,
+             block->frame->data + PAGE_CHECKSUM_OFFSET, 8);
+      EXPECT_EQ(memcmp(block->frame, &page, PAGE_SIZE), 0);
+      buf_unpin_block(block, 0);
+    }
+  }
+  buf_stats_t stats;
+  buf_get_stats(&stats);
+  EXPECT_GT(stats.num_victim_hits, 0);
+
+  // A freed page is dropped from the victim cache
+  for (pagenum_t page_num = 1; page_num < high_water_mark; page_num++) {
+    buf_partition_t* partition = buf_get_partition(table_id, page_num);
+    if (partition->victim_table.count({table_id, page_num}) > 0) {
+      buf_free_page(table_id, page_num);
+      EXPECT_EQ(partition->victim_table.count({table_id, page_num}), 0);
+      break;
+    }
+  }
+
+  shutdown_db();
+  buf_victim_cache_size = 0;
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, DropsVictimsReadAgainBeforeCached) {
+  buf_victim_cache_size = 1024 * 1024;
+  init_db(64, 0, 0, log_path, logmsg_path);
+  table_id = open_table(pathname);
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 10000; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+  pagenum_t leaf = db_find_leaf(table_id, db_get_root(table_id), 0);
+  control_block_t* header_block = buf_read_page_shared(table_id, 0);
+  pagenum_t high_water_mark = file_get_high_water_mark(header_block->frame);
+  buf_unpin_block(header_block, 0);
+  ASSERT_GT(high_water_mark, 256);
+  shutdown_db();
+
+  init_db(64, 0, 0, log_path, logmsg_path);
+  table_id = open_table(pathname);
+
+  // The leaf is taken as a victim, and stalls before it is compressed
+  page_t stale;
+  ASSERT_EQ(file_read_page(table_id, leaf, &stale), 0);
+  buf_partition_t* partition = buf_get_partition(table_id, leaf);
+  pthread_mutex_lock(&partition->latch);
+  uint64_t ticket = buf_reserve_victim(partition, {table_id, leaf});
+  pthread_mutex_unlock(&partition->latch);
+
+  // Meanwhile it is read in again, changed, written back and evicted clean
+  control_block_t* block = buf_read_page(table_id, leaf);
+  block->frame->data[PAGE_SIZE - 1] ^= 1;
+  buf_unpin_block(block, 1);
+  ASSERT_EQ(buf_checkpoint(), 0);
+  for (pagenum_t page_num = 1; page_num < high_water_mark; page_num++) {
+    if (page_num != leaf) {
+      buf_unpin_block(buf_read_page_shared(table_id, page_num), 0);
+    }
+  }
+  ASSERT_EQ(partition->control_block_table.count({table_id, leaf}), 0);
+  ASSERT_EQ(partition->victim_table.count({table_id, leaf}), 1);
+
+  // The stale image doesn't take the place of the one cached since
+  buf_cache_victim(partition, {table_id, leaf}, ticket, &stale);
+  block = buf_read_page_shared(table_id, leaf);
+  EXPECT_EQ(block->frame->data[PAGE_SIZE - 1],
+            stale.data[PAGE_SIZE - 1] ^ 1);
+  buf_unpin_block(block, 0);
+
+  shutdown_db();
+  buf_victim_cache_size = 0;
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, WaitsForPinnedBlocksAndResizes) {
+  // Every pin is counted, so no cleaner may take any
+  buf_num_cleaners = 0;
+  init_db(64, 0, 0, log_path, logmsg_path);
+  ASSERT_EQ(buf_num_partitions, 1);
+
+  table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 5000; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+  control_block_t* header_block = buf_read_page(table_id, 0);
+  ASSERT_GT(file_get_high_water_mark(header_block->frame),
+            70 + MAX_OVERFLOW_BLOCKS);
+  buf_unpin_block(header_block, 0);
+
+  // Pin every block
+  std::vector<control_block_t*> blocks;
+  for (pagenum_t page_num = 1; page_num <= 64; page_num++) {
+    blocks.push_back(buf_read_page(table_id, page_num));
+  }
+
+  buf_stats_t stats;
+  buf_get_stats(&stats);
+  EXPECT_EQ(stats.num_frames, 64);
+  EXPECT_EQ(stats.num_overflows, 0);
+
+  // A reader holding no pins fails or waits instead of growing the buffer
+  std::thread reader([]() {
+    EXPECT_EQ(buf_try_read_page(table_id, 65), nullptr);
+    control_block_t* block = buf_read_page(table_id, 65);
+    EXPECT_EQ(block->page_num, 65);
+    buf_unpin_block(block, 0);
+  });
+  while (buf_partitions[0].num_waiters == 0) {
+    std::this_thread::yield();
+  }
+  buf_unpin_block(blocks.back(), 0);
+  blocks.pop_back();
+  reader.join();
+
+  buf_get_stats(&stats);
+  EXPECT_EQ(stats.num_waits, 1);
+  EXPECT_EQ(stats.num_frames, 64);
+
+  // A reader holding pins takes a block more, which is retired afterwards
+  blocks.push_back(buf_read_page(table_id, 66));
+  blocks.push_back(buf_read_page(table_id, 67));
+  buf_get_stats(&stats);
+  EXPECT_EQ(stats.num_overflows, 1);
+  EXPECT_EQ(stats.num_frames, 65);
+
+  // Up to a bound, past which it can only wait for an unpin
+  pagenum_t page_num = 68;
+  while (buf_partitions[0].blocks.size() < 64 + MAX_OVERFLOW_BLOCKS) {
+    blocks.push_back(buf_read_page(table_id, page_num++));
+  }
+  EXPECT_EQ(buf_try_read_page(table_id, page_num), nullptr);
+  buf_get_stats(&stats);
+  EXPECT_EQ(stats.num_overflows, MAX_OVERFLOW_BLOCKS);
+
+  for (control_block_t* block : blocks) {
+    buf_unpin_block(block, 1);
+  }
+  buf_unpin_block(buf_read_page(table_id, page_num), 0);
+  buf_get_stats(&stats);
+  EXPECT_EQ(stats.num_frames, 64);
+
+  EXPECT_EQ(buf_resize(0), -1);
+  ASSERT_EQ(buf_resize(128), 0);
+  buf_get_stats(&stats);
+  EXPECT_EQ(stats.target_frames, 128);
+  EXPECT_EQ(stats.num_frames, 128);
+
+  ASSERT_EQ(buf_resize(16), 0);
+  buf_get_stats(&stats);
+  EXPECT_EQ(stats.target_frames, 16);
+  EXPECT_EQ(stats.num_frames, 16);
+
+  char ret_val[MAX_VAL_SIZE];
+  uint16_t val_size;
+  for (int64_t i = 0; i < 5000; i++) {
+    ASSERT_EQ(db_find(table_id, i, ret_val, &val_size), 0);
+    EXPECT_EQ(std::string(ret_val, val_size), value);
+  }
+  buf_get_stats(&stats);
+  EXPECT_EQ(stats.num_frames, 16);
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+  buf_num_cleaners = DEFAULT_NUM_CLEANERS;
+}
+
+TEST(BufferTest, WakesEveryWaiterOnUnpin) {
+  buf_num_cleaners = 0;
+  init_db(8, 0, 0, log_path, logmsg_path);
+  ASSERT_EQ(buf_num_partitions, 1);
+
+  table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 10000; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+  control_block_t* header_block = buf_read_page_shared(table_id, 0);
+  pagenum_t high_water_mark = file_get_high_water_mark(header_block->frame);
+  buf_unpin_block(header_block, 0);
+
+  // More readers than frames keep every frame pinned, so readers holding no
+  // pins wait while the others unpin
+  const int num_threads = 16;
+  std::atomic<int> num_done(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([t, high_water_mark, &num_done]() {
+      std::mt19937 gen(t);
+      std::uniform_int_distribution<pagenum_t> pages(1, high_water_mark - 1);
+      for (int i = 0; i < 5000; i++) {
+        control_block_t* block = buf_read_page_shared(table_id, pages(gen));
+        std::this_thread::yield();
+        buf_unpin_block(block, 0);
+      }
+      num_done++;
+    });
+  }
+
+  // A reader that missed its wakeup is woken by a resize, as it would never
+  // be otherwise
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+  while (num_done < num_threads && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(num_done, num_threads);
+  if (num_done < num_threads) {
+    ASSERT_EQ(buf_resize(64), 0);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  buf_stats_t stats;
+  buf_get_stats(&stats);
+  EXPECT_GT(stats.num_waits, 0);
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+  buf_num_cleaners = DEFAULT_NUM_CLEANERS;
+}
+
+TEST(BufferTest, CleansBlocksAheadOfReaders) {
+  init_db(64, 0, 0, log_path, logmsg_path);
+
+  table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 10000; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+
+  // Once the cleaners catch up, the blocks to be replaced next are clean
+  buf_stats_t stats;
+  for (int i = 0; i < 100; i++) {
+    std::vector<control_block_t*> blocks;
+    for (int p = 0; p < buf_num_partitions; p++) {
+      pthread_mutex_lock(&buf_partitions[p].latch);
+      buf_policy->list_victims(&buf_partitions[p], DEFAULT_CLEAN_TARGET,
+                               &blocks);
+      pthread_mutex_unlock(&buf_partitions[p].latch);
+    }
+    if (std::none_of(blocks.begin(), blocks.end(),
+                     [](control_block_t* block) { return block->is_dirty; })) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  buf_get_stats(&stats);
+  EXPECT_GT(stats.num_cleaned, 0);
+  EXPECT_GT(buf_count_dirty_pages(table_id), 0);
+
+  // Cleaned pages are read back as they were written
+  init_db(64, 0, 0, log_path, logmsg_path);
+  table_id = open_table(pathname);
+  char ret_val[MAX_VAL_SIZE];
+  uint16_t val_size;
+  for (int64_t i = 0; i < 10000; i++) {
+    ASSERT_EQ(db_find(table_id, i, ret_val, &val_size), 0);
+    EXPECT_EQ(std::string(ret_val, val_size), value);
+  }
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, WarmsUpFromDump) {
+  buf_warm_up = 1;
+  init_db(256, 0, 0, log_path, logmsg_path);
+
+  table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 20000; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+
+  std::vector<page_hash_t> resident;
+  for (int p = 0; p < buf_num_partitions; p++) {
+    for (auto& entry : buf_partitions[p].control_block_table) {
+      resident.push_back(entry.first);
+    }
+  }
+  ASSERT_GT(resident.size(), 1);
+
+  // The pages resident at shutdown are read back once the table is opened
+  shutdown_db();
+  init_db(256, 0, 0, log_path, logmsg_path);
+  table_id = open_table(pathname);
+
+  for (int i = 0; i < 100 && buf_num_warmed_pages < buf_num_warm_up_pages;
+       i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_GT(buf_num_warm_up_pages, 0);
+  EXPECT_EQ(buf_num_warmed_pages, buf_num_warm_up_pages);
+
+  for (page_hash_t page : resident) {
+    buf_partition_t* partition = buf_get_partition(page.table_id, page.page_num);
+    EXPECT_EQ(partition->control_block_table.count(page), 1);
+  }
+
+  shutdown_db();
+  buf_warm_up = 0;
+  remove(BUFDUMP_PATH);
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, SharesPageLatchesBetweenReaders) {
+  init_db(16, 0, 0, log_path, logmsg_path);
+
+  table_id = open_table(pathname);
+
+  // Readers take the page while another reader holds it
+  control_block_t* block = buf_read_page_shared(table_id, 0);
+  std::thread reader([block]() {
+    control_block_t* shared_block = buf_read_page_shared(table_id, 0);
+    EXPECT_EQ(shared_block, block);
+    buf_unpin_block(shared_block, 0);
+  });
+  reader.join();
+
+  // A writer waits for the readers
+  std::atomic<int> is_written(0);
+  std::thread writer([&is_written]() {
+    control_block_t* block = buf_read_page(table_id, 0);
+    file_set_high_water_mark(block->frame,
+                             file_get_high_water_mark(block->frame) + 1);
+    is_written = 1;
+    buf_unpin_block(block, 1);
+  });
+  while (block->pin_count < 2) {
+    std::this_thread::yield();
+  }
+  pagenum_t high_water_mark = file_get_high_water_mark(block->frame);
+  EXPECT_EQ(is_written, 0);
+  buf_unpin_block(block, 0);
+  writer.join();
+
+  block = buf_read_page_shared(table_id, 0);
+  EXPECT_EQ(file_get_high_water_mark(block->frame), high_water_mark + 1);
+  buf_unpin_block(block, 0);
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, ValidatesOptimisticReads) {
+  init_db(1024, 0, 0, log_path, logmsg_path);
+
+  table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 10000; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+
+  // A read stays valid until the page is latched exclusively
+  uint64_t version;
+  control_block_t* block = buf_read_page_optimistic(table_id, 0, &version);
+  EXPECT_EQ(version % 2, 0);
+  EXPECT_EQ(block->pin_count, 0);
+  EXPECT_TRUE(buf_validate_block(block, version));
+
+  control_block_t* latched_block = buf_read_page(table_id, 0);
+  EXPECT_EQ(latched_block, block);
+  EXPECT_FALSE(buf_validate_block(block, version));
+  buf_unpin_block(latched_block, 1);
+  EXPECT_FALSE(buf_validate_block(block, version));
+
+  uint64_t new_version;
+  EXPECT_EQ(buf_read_page_optimistic(table_id, 0, &new_version), block);
+  EXPECT_EQ(new_version, version + 2);
+
+  // Readers descend while the leaves they read are updated
+  std::atomic<int> is_done(0);
+  std::thread updater([&is_done]() {
+    std::string new_value(MIN_VAL_SIZE, 'b');
+    uint16_t old_val_size;
+    for (int64_t i = 0; i < 10000; i += 7) {
+      int trx_id = trx_begin();
+      EXPECT_EQ(db_update(table_id, i, (char*)new_value.c_str(), MIN_VAL_SIZE,
+                          &old_val_size, trx_id),
+                0);
+      trx_commit(trx_id);
+    }
+    is_done = 1;
+  });
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([t, &is_done]() {
+      int64_t key = t;
+      while (!is_done) {
+        EXPECT_EQ(db_find(table_id, key, NULL, NULL), 0);
+        key = (key + 101) % 10000;
+      }
+    });
+  }
+  updater.join();
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+
+  char ret_val[MAX_VAL_SIZE];
+  uint16_t val_size;
+  ASSERT_EQ(db_find(table_id, 9996, ret_val, &val_size), 0);
+  EXPECT_EQ(std::string(ret_val, val_size), std::string(MIN_VAL_SIZE, 'b'));
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, ShrinksUnderOptimisticReaders) {
+  init_db(64, 0, 0, log_path, logmsg_path);
+  ASSERT_EQ(buf_num_partitions, 1);
+
+  table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 5000; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+
+  // A block retired after an optimistic reader found it still has a frame to
+  // read, which fails validation
+  std::map<control_block_t*, uint64_t> versions;
+  for (control_block_t* block : buf_partitions[0].blocks) {
+    versions[block] = block->version.load();
+  }
+  ASSERT_EQ(buf_resize(1), 0);
+  ASSERT_FALSE(buf_partitions[0].retired_blocks.empty());
+  for (control_block_t* block : buf_partitions[0].retired_blocks) {
+    ASSERT_NE(block->frame, nullptr);
+    EXPECT_EQ(db_get_is_leaf(block->frame), 0);
+    EXPECT_FALSE(buf_validate_block(block, versions[block]));
+  }
+  ASSERT_EQ(buf_resize(64), 0);
+
+  // Blocks are retired under the readers descending through them
+  std::atomic<bool> done(false);
+  std::vector<std::thread> threads;
+  std::vector<int> num_missing(4);
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([t, &done, &num_missing]() {
+      while (!done) {
+        for (int64_t i = t; i < 5000; i += 37) {
+          if (db_find(table_id, i, NULL, NULL) != 0) {
+            num_missing[t]++;
+          }
+        }
+      }
+    });
+  }
+  for (int i = 0; i < 200; i++) {
+    ASSERT_EQ(buf_resize(16), 0);
+    ASSERT_EQ(buf_resize(64), 0);
+  }
+  done = true;
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (int t = 0; t < 4; t++) {
+    EXPECT_EQ(num_missing[t], 0);
+  }
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, SwizzlesResidentChildren) {
+  init_db(1024, 0, 0, log_path, logmsg_path);
+
+  table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 10000; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+  ASSERT_EQ(db_find(table_id, 5000, NULL, NULL), 0);
+
+  control_block_t* header_block = buf_read_page_shared(table_id, 0);
+  pagenum_t root = db_get_root_page_number(header_block->frame);
+  buf_unpin_block(header_block, 0);
+
+  // The root holds the block of the child the descent went to
+  control_block_t* root_block = buf_read_page_shared(table_id, root);
+  ASSERT_FALSE(db_get_is_leaf(root_block->frame));
+  int32_t num_keys = db_get_number_of_keys(root_block->frame);
+  int32_t i = 0;
+  while (i < num_keys && 5000 >= db_get_key(root_block->frame, i)) {
+    i++;
+  }
+  pagenum_t child = db_get_child_page_number(root_block->frame, i);
+  std::atomic<control_block_t*>* children = root_block->children;
+  buf_unpin_block(root_block, 0);
+  ASSERT_NE(children, nullptr);
+  ASSERT_NE(children[i].load(), nullptr);
+  EXPECT_EQ(children[i].load()->page_num, child);
+
+  // Children replaced since are found again
+  ASSERT_EQ(buf_resize(64), 0);
+  for (int64_t key = 0; key < 10000; key += 37) {
+    EXPECT_EQ(db_find(table_id, key, NULL, NULL), 0);
+  }
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, SpreadsPagesOverPartitions) {
+  init_db(1024, 0, 0, log_path, logmsg_path);
+  ASSERT_EQ(buf_num_partitions, DEFAULT_NUM_PARTITIONS);
+
+  table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 10000; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+
+  for (int p = 0; p < buf_num_partitions; p++) {
+    EXPECT_FALSE(buf_partitions[p].control_block_table.empty());
+  }
+
+  // Every reader finds every record while the others read the same pages
+  std::vector<std::thread> threads;
+  std::vector<int> num_found(8);
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([t, &num_found]() {
+      char ret_val[MAX_VAL_SIZE];
+      uint16_t val_size;
+      for (int64_t i = 0; i < 10000; i++) {
+        if (db_find(table_id, (i * 7 + t * 1250) % 10000, ret_val,
+                    &val_size) == 0) {
+          num_found[t]++;
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (int t = 0; t < 8; t++) {
+    EXPECT_EQ(num_found[t], 10000);
+  }
+
+  ASSERT_EQ(buf_checkpoint(), 0);
+  EXPECT_EQ(buf_count_dirty_pages(table_id), 0);
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, CheckpointsRunsAcrossTables) {
+  init_db(64, 0, 0, log_path, logmsg_path);
+
+  const char* other_pathname = "DATA2";
+  int64_t table_ids[2] = {open_table(pathname), open_table(other_pathname)};
+
+  // Runs of consecutive pages and pages on their own, in both tables
+  std::vector<std::pair<int64_t, pagenum_t>> pages;
+  for (int64_t id : table_ids) {
+    std::vector<pagenum_t> page_nums;
+    for (int i = 0; i < 8; i++) {
+      page_nums.push_back(buf_alloc_page(id));
+    }
+    for (int i : {0, 1, 2, 4, 6}) {
+      pages.push_back({id, page_nums[i]});
+    }
+  }
+  for (size_t i = 0; i < pages.size(); i++) {
+    control_block_t* block = buf_read_page(pages[i].first, pages[i].second);
+    memset(block->frame, 'a' + i, PAGE_SIZE);
+    buf_unpin_block(block, 1);
+  }
+
+  ASSERT_EQ(buf_checkpoint(), 0);
+  EXPECT_EQ(buf_count_dirty_pages(table_ids[0]), 0);
+  EXPECT_EQ(buf_count_dirty_pages(table_ids[1]), 0);
+
+  page_t page;
+  for (size_t i = 0; i < pages.size(); i++) {
+    ASSERT_EQ(file_read_page(pages[i].first, pages[i].second, &page), 0);
+    page_t expected;
+    memset(&expected, 'a' + i, PAGE_SIZE);
+    memcpy(expected.data + PAGE_CHECKSUM_OFFSET,
+           page.data + PAGE_CHECKSUM_OFFSET, 8);
+    EXPECT_EQ(memcmp(&page, &expected, PAGE_SIZE), 0);
+  }
+
+  shutdown_db();
+  remove(pathname);
+  remove(other_pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
+TEST(BufferTest, KeepsPagesDirtyWithoutTheirCopies) {
+  buf_num_cleaners = 0;
+  file_doublewrite = 1;
+  init_db(8, 0, 0, log_path, logmsg_path);
+  ASSERT_EQ(buf_num_partitions, 1);
+
+  table_id = open_table(pathname);
+
+  std::vector<pagenum_t> page_nums;
+  for (int i = 0; i < 8; i++) {
+    page_nums.push_back(buf_alloc_page(table_id));
+  }
+  for (int i = 0; i < 8; i++) {
+    control_block_t* block = buf_read_page(table_id, page_nums[i]);
+    block->frame->data[PAGE_SIZE - 1] = 'a' + i;
+    buf_unpin_block(block, 1);
+  }
+  ASSERT_EQ(buf_checkpoint(), 0);
+
+  // The copies can't be written through a read-only descriptor
+  int doublewrite_fd = file_doublewrite_fd;
+  ASSERT_GE(doublewrite_fd, 0);
+  file_doublewrite_fd = open(DOUBLEWRITE_PATH, O_RDONLY);
+  ASSERT_GE(file_doublewrite_fd, 0);
+
+  // Every block of the partition ends up dirty, the header page's included
+  buf_unpin_block(buf_read_page(table_id, 0), 1);
+  for (int i = 0; i < 7; i++) {
+    control_block_t* block = buf_read_page(table_id, page_nums[i]);
+    ASSERT_NE(block, nullptr);
+    block->frame->data[PAGE_SIZE - 1] = 'A' + i;
+    buf_unpin_block(block, 1);
+  }
+
+  // Neither the checkpoint nor an eviction writes a page in place without its
+  // copy, and the pages stay dirty in their blocks
+  EXPECT_EQ(buf_checkpoint(), -1);
+  EXPECT_EQ(buf_count_dirty_pages(table_id), 8);
+  EXPECT_EQ(buf_read_page(table_id, page_nums[7]), nullptr);
+  EXPECT_EQ(buf_count_dirty_pages(table_id), 8);
+  page_t page;
+  for (int i = 0; i < 7; i++) {
+    buf_partition_t* partition = buf_get_partition(table_id, page_nums[i]);
+    EXPECT_EQ(partition->control_block_table.count({table_id, page_nums[i]}),
+              1);
+    ASSERT_EQ(file_read_page(table_id, page_nums[i], &page), 0);
+    EXPECT_EQ(page.data[PAGE_SIZE - 1], 'a' + i);
+  }
+
+  close(file_doublewrite_fd);
+  file_doublewrite_fd = doublewrite_fd;
+
+  control_block_t* block = buf_read_page(table_id, page_nums[7]);
+  ASSERT_NE(block, nullptr);
+  EXPECT_EQ(block->frame->data[PAGE_SIZE - 1], 'a' + 7);
+  buf_unpin_block(block, 0);
+  ASSERT_EQ(buf_checkpoint(), 0);
+  EXPECT_EQ(buf_count_dirty_pages(table_id), 0);
+  for (int i = 0; i < 7; i++) {
+    ASSERT_EQ(file_read_page(table_id, page_nums[i], &page), 0);
+    EXPECT_EQ(page.data[PAGE_SIZE - 1], 'A' + i);
+  }
+
+  shutdown_db();
+  file_doublewrite = 0;
+  buf_num_cleaners = DEFAULT_NUM_CLEANERS;
+  remove(pathname);
+  remove(DOUBLEWRITE_PATH);
+  remove(log_path);
+  remove(logmsg_path);
+}
+
 int64_t n = 1000;
 int num_buf = n / 25;
 int max_num_length = std::to_string(n - 1).length();
@@ -192,7 +1334,7 @@ TEST(DbTest_RandomSizeRandomOrder, Shutdown) {
 
 #define THREAD_NUM (100)
 
-void* trx_test(void* arg) {
+void* trx_test(void* /* arg */) {
   int trx_id;
   EXPECT_GT((trx_id = trx_begin()), 0);
 
@@ -259,3 +1401,45 @@ TEST(LogTest, Recover) {
   ASSERT_EQ(remove(log_path), 0);
   ASSERT_EQ(remove(logmsg_path), 0);
 }
+
+TEST(LogTest, FlushesUpToPageLsn) {
+  init_db(64, 0, 0, log_path, logmsg_path);
+
+  table_id = open_table(pathname);
+
+  std::string value(MIN_VAL_SIZE, 'a');
+  for (int64_t i = 0; i < 100; i++) {
+    ASSERT_EQ(db_insert(table_id, i, value.c_str(), MIN_VAL_SIZE), 0);
+  }
+  ASSERT_EQ(buf_checkpoint(), 0);
+
+  // An update leaves its record in the log buffer, and its LSN on the page
+  std::string new_value(MIN_VAL_SIZE, 'b');
+  uint16_t val_size;
+  int trx_id = trx_begin();
+  ASSERT_EQ(db_update(table_id, 50, (char*)new_value.c_str(), MIN_VAL_SIZE,
+                      &val_size, trx_id),
+            0);
+  pagenum_t leaf = db_find_leaf(table_id, db_get_root(table_id), 50);
+  control_block_t* block = buf_read_page_shared(table_id, leaf);
+  int64_t page_lsn = log_get_page_lsn(block->frame);
+  buf_unpin_block(block, 0);
+  EXPECT_GE(page_lsn, log_flushed_lsn);
+
+  // Only a record that is not durable yet costs a sync
+  uint64_t num_syncs = log_num_syncs;
+  log_flush_until(log_flushed_lsn - 1);
+  EXPECT_EQ(log_num_syncs, num_syncs);
+  log_flush_until(page_lsn);
+  EXPECT_EQ(log_num_syncs, num_syncs + 1);
+  EXPECT_GT(log_flushed_lsn, page_lsn);
+  log_flush_until(page_lsn);
+  EXPECT_EQ(log_num_syncs, num_syncs + 1);
+
+  trx_commit(trx_id);
+
+  shutdown_db();
+  remove(pathname);
+  remove(log_path);
+  remove(logmsg_path);
+}
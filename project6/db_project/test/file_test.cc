@@ -3,6 +3,7 @@
 #include <gtest/gtest.h>
 
 #include <string>
+#include <vector>
 
 /*******************************************************************************
  * The test structures stated here were written to give you and idea of what a
@@ -28,7 +29,7 @@ TEST(FileInitTest, HandlesInitialization) {
   ASSERT_TRUE(table_id >= 0);  // change the condition to your design's behavior
 
   // Check the size of the initial file
-  int num_pages = /* fetch the number of pages from the header page */ 2560;
+  int num_pages = file_read_number_of_pages(file_find_fd(table_id));
   EXPECT_EQ(num_pages, INITIAL_DB_FILE_SIZE / PAGE_SIZE)
       << "The initial number of pages does not match the requirement: "
       << num_pages;
@@ -114,6 +115,8 @@ TEST_F(FileTest, HandlesPageAllocation) {
 TEST_F(FileTest, CheckReadWriteOperation) {
   page_t* src = new page_t;
   memset(src, 'a', PAGE_SIZE);
+  // Pages are written stamped with their checksum
+  file_stamp_checksum(src);
 
   pagenum_t pagenum = file_alloc_page(table_id);
 
@@ -126,3 +129,530 @@ TEST_F(FileTest, CheckReadWriteOperation) {
 
   delete src, dest;
 }
+
+/*
+ * Tests checkpoint-driven durability
+ * 1. Write a page and check that the write did not sync the file
+ * 2. Sync the table files and check that the file was synced once
+ * 3. Check that a write syncs the file in SYNC_ON_WRITE mode
+ */
+TEST_F(FileTest, SyncsOnCheckpoint) {
+  file_sync_mode = SYNC_ON_CHECKPOINT;
+
+  page_t* src = new page_t;
+  memset(src, 'b', PAGE_SIZE);
+  file_stamp_checksum(src);
+
+  pagenum_t pagenum = file_alloc_page(table_id);
+  uint64_t num_syncs = file_num_syncs;
+  file_write_page(table_id, pagenum, src);
+  EXPECT_EQ(file_num_syncs, num_syncs);
+
+  EXPECT_EQ(file_sync_table_files(), 0);
+  EXPECT_EQ(file_num_syncs, num_syncs + 1);
+
+  file_sync_mode = SYNC_ON_WRITE;
+  file_write_page(table_id, pagenum, src);
+  EXPECT_EQ(file_num_syncs, num_syncs + 2);
+  file_sync_mode = SYNC_ON_CHECKPOINT;
+
+  page_t* dest = new page_t;
+  file_read_page(table_id, pagenum, dest);
+
+  EXPECT_EQ(memcmp(src, dest, PAGE_SIZE), 0);
+
+  delete src;
+  delete dest;
+}
+
+/*
+ * Tests growth at the high-water mark
+ * 1. Use up every page below the high-water mark and allocate one more
+ * 2. Check if the file grew by one extent and the page was not threaded
+ */
+TEST_F(FileTest, GrowsAtHighWaterMark) {
+  file_growth_policy = GROWTH_FIXED_EXTENT;
+  file_extent_size = 16;
+
+  uint64_t num_pages = file_read_number_of_pages(fd);
+  file_write_high_water_mark(fd, num_pages);
+
+  EXPECT_EQ(file_alloc_page(table_id), num_pages);
+  EXPECT_EQ(file_read_number_of_pages(fd), num_pages + 16);
+  EXPECT_EQ(file_read_high_water_mark(fd), num_pages + 1);
+  EXPECT_EQ(file_read_first_free_page_number(fd), 0);
+  EXPECT_EQ(lseek(fd, 0, SEEK_END), (num_pages + 16) * PAGE_SIZE);
+
+  file_growth_policy = GROWTH_DOUBLING;
+  file_extent_size = DEFAULT_EXTENT_SIZE;
+}
+
+/*
+ * Tests direct I/O
+ * 1. Open a file with O_DIRECT and check if a page round-trips through it
+ */
+TEST(FileDirectIoTest, CheckReadWriteOperation) {
+  std::string pathname = "DATA1";
+
+  file_direct_io = 1;
+  int64_t table_id = file_open_table_file(pathname.c_str());
+  file_direct_io = 0;
+  ASSERT_TRUE(table_id >= 0);
+
+  page_t* src = new page_t;
+  memset(src, 'c', PAGE_SIZE);
+  file_stamp_checksum(src);
+
+  pagenum_t pagenum = file_alloc_page(table_id);
+  file_write_page(table_id, pagenum, src);
+
+  page_t* dest = new page_t;
+  file_read_page(table_id, pagenum, dest);
+
+  EXPECT_EQ(memcmp(src, dest, PAGE_SIZE), 0);
+
+  delete src;
+  delete dest;
+
+  file_close_table_files();
+  ASSERT_EQ(remove(pathname.c_str()), 0);
+}
+
+/*
+ * Tests asynchronous page I/O
+ * 1. Write and read back a page through each backend and wait on futures
+ * 2. Write a batch of pages and read them back
+ */
+TEST_F(FileTest, CheckAsyncReadWriteOperation) {
+  for (int backend : {AIO_THREAD_POOL, AIO_IO_URING}) {
+    aio_backend = backend;
+    ASSERT_EQ(aio_init(), 0);
+
+    page_t* src = new page_t;
+    memset(src, 'd' + backend, PAGE_SIZE);
+    file_stamp_checksum(src);
+
+    pagenum_t pagenum = file_alloc_page(table_id);
+
+    aio_future_t written;
+    aio_future_init(&written);
+    ASSERT_EQ(file_write_page_async(table_id, pagenum, src, aio_future_complete,
+                                    &written),
+              0);
+    EXPECT_EQ(aio_future_wait(&written), PAGE_SIZE);
+
+    page_t* dest = new page_t;
+
+    aio_future_t read;
+    aio_future_init(&read);
+    ASSERT_EQ(file_read_page_async(table_id, pagenum, dest, aio_future_complete,
+                                   &read),
+              0);
+    EXPECT_EQ(aio_future_wait(&read), PAGE_SIZE);
+
+    EXPECT_EQ(memcmp(src, dest, PAGE_SIZE), 0);
+
+    // A batch of consecutive pages is written by runs
+    pagenum_t first = file_alloc_page(table_id);
+    ASSERT_EQ(file_alloc_page(table_id), first + 1);
+    const page_t* pages[] = {src, src};
+
+    aio_future_t batch_written;
+    aio_future_init(&batch_written);
+    ASSERT_EQ(file_write_pages_async(table_id, first, pages, 2,
+                                     aio_future_complete, &batch_written),
+              0);
+    EXPECT_EQ(aio_future_wait(&batch_written), 0);
+
+    for (pagenum_t pagenum : {first, first + 1}) {
+      file_read_page(table_id, pagenum, dest);
+      EXPECT_EQ(memcmp(src, dest, PAGE_SIZE), 0);
+    }
+
+    delete src;
+    delete dest;
+
+    ASSERT_EQ(aio_shutdown(), 0);
+  }
+  aio_backend = AIO_IO_URING;
+}
+
+/*
+ * Tests the table registry
+ * 1. Open more tables under arbitrary paths than may stay open at once
+ * 2. Check that every table keeps its id and its pages
+ */
+TEST(FileRegistryTest, HandlesManyTables) {
+  const int num_tables = 40;
+  file_max_open_files = 8;
+
+  std::vector<int64_t> table_ids;
+  for (int i = 0; i < num_tables; i++) {
+    std::string pathname = "table_" + std::to_string(i) + ".db";
+    int64_t table_id = file_open_table_file(pathname.c_str());
+    ASSERT_GE(table_id, 0);
+    for (int64_t other : table_ids) {
+      ASSERT_NE(table_id, other);
+    }
+    table_ids.push_back(table_id);
+
+    page_t page;
+    memset(&page, 'a' + i % 26, PAGE_SIZE);
+    file_write_page(table_id, 1, &page);
+  }
+  EXPECT_LE(num_open_files, file_max_open_files);
+
+  for (int i = 0; i < num_tables; i++) {
+    std::string pathname = "table_" + std::to_string(i) + ".db";
+    EXPECT_EQ(file_open_table_file(pathname.c_str()), table_ids[i]);
+
+    page_t page;
+    file_read_page(table_ids[i], 1, &page);
+    EXPECT_EQ(page.data[0], 'a' + i % 26);
+    EXPECT_EQ(page.data[PAGE_SIZE - 1], 'a' + i % 26);
+  }
+  EXPECT_LE(num_open_files, file_max_open_files);
+
+  // Tables named by the file prefix keep their number as the id
+  EXPECT_EQ(file_open_table_file("DATA5"), 5);
+
+  file_close_table_files();
+  file_max_open_files = DEFAULT_MAX_OPEN_FILES;
+
+  for (int i = 0; i < num_tables; i++) {
+    std::string pathname = "table_" + std::to_string(i) + ".db";
+    ASSERT_EQ(remove(pathname.c_str()), 0);
+  }
+  ASSERT_EQ(remove("DATA5"), 0);
+  remove(CATALOG_PATH);
+}
+
+/*
+ * Tests the table catalog
+ * 1. Register a table under an arbitrary path and forget it, as a restart
+ *    does
+ * 2. Check that its id finds its file again through the catalog
+ * 3. Check that an id never registered does not create a file
+ */
+TEST(FileRegistryTest, KeepsIdsInCatalog) {
+  std::string pathname = "catalog_test.db";
+  int64_t table_id = file_open_table_file(pathname.c_str());
+  ASSERT_GE(table_id, 0);
+
+  page_t page;
+  memset(&page, 'k', PAGE_SIZE);
+  file_write_page(table_id, 1, &page);
+  file_close_table_files();
+
+  table_ids.erase(pathname);
+  table_descs[table_id].pathname.clear();
+  pthread_mutex_lock(&table_desc_latch);
+  ASSERT_EQ(file_load_catalog(), 0);
+  pthread_mutex_unlock(&table_desc_latch);
+  EXPECT_EQ(table_descs[table_id].pathname, pathname);
+
+  memset(&page, 0, PAGE_SIZE);
+  ASSERT_EQ(file_read_page(table_id, 1, &page), 0);
+  EXPECT_EQ(page.data[0], 'k');
+
+  int64_t unknown_id = table_id - 1;
+  while (!table_descs[unknown_id].pathname.empty()) {
+    unknown_id--;
+  }
+  std::string unknown_path = FILE_PREFIX + std::to_string(unknown_id);
+  EXPECT_LT(file_find_fd(unknown_id), 0);
+  EXPECT_NE(access(unknown_path.c_str(), F_OK), 0);
+  EXPECT_TRUE(table_descs[unknown_id].pathname.empty());
+
+  file_close_table_files();
+  ASSERT_EQ(remove(pathname.c_str()), 0);
+  remove(CATALOG_PATH);
+}
+
+/*
+ * Tests the page codec
+ * 1. Round-trip compressible, incompressible and mixed pages
+ */
+TEST(CompressTest, HandlesRoundTrip) {
+  uint8_t src[PAGE_SIZE];
+  uint8_t compressed[PAGE_SIZE];
+  uint8_t dest[PAGE_SIZE];
+
+  memset(src, 'a', PAGE_SIZE);
+  int size = compress_block(src, PAGE_SIZE, compressed, PAGE_SIZE);
+  ASSERT_GT(size, 0);
+  EXPECT_LT(size, PAGE_SIZE / 16);
+  ASSERT_EQ(decompress_block(compressed, size, dest, PAGE_SIZE), PAGE_SIZE);
+  EXPECT_EQ(memcmp(src, dest, PAGE_SIZE), 0);
+
+  uint32_t state = 2022;
+  for (int i = 0; i < PAGE_SIZE; i++) {
+    state = state * 1103515245 + 12345;
+    src[i] = state >> 16;
+  }
+  EXPECT_EQ(compress_block(src, PAGE_SIZE, compressed, PAGE_SIZE / 2), -1);
+  size = compress_block(src, PAGE_SIZE, compressed, PAGE_SIZE);
+  if (size > 0) {
+    ASSERT_EQ(decompress_block(compressed, size, dest, PAGE_SIZE), PAGE_SIZE);
+    EXPECT_EQ(memcmp(src, dest, PAGE_SIZE), 0);
+  }
+
+  // Half random, half values repeated with small changes, like a leaf page
+  for (int i = PAGE_SIZE / 2; i < PAGE_SIZE; i++) {
+    src[i] = i % 112 == 0 ? i / 112 : 'v';
+  }
+  size = compress_block(src, PAGE_SIZE, compressed, PAGE_SIZE);
+  ASSERT_GT(size, 0);
+  ASSERT_EQ(decompress_block(compressed, size, dest, PAGE_SIZE), PAGE_SIZE);
+  EXPECT_EQ(memcmp(src, dest, PAGE_SIZE), 0);
+
+  EXPECT_EQ(decompress_block(compressed, size - 1, dest, PAGE_SIZE / 2), -1);
+}
+
+/*
+ * Tests compressed tables
+ * 1. Write pages to a compressed table and rewrite them after checkpoints
+ * 2. Reopen it and check the pages and the size of the file
+ */
+TEST(FileCompressionTest, CheckReadWriteOperation) {
+  std::string pathname = "DATA1";
+  std::string page_map_path = pathname + PAGE_MAP_SUFFIX;
+  const int num_pages = 64;
+
+  file_page_format = PAGE_FORMAT_COMPRESSED;
+  int64_t table_id = file_open_table_file(pathname.c_str());
+  file_page_format = PAGE_FORMAT_RAW;
+  ASSERT_TRUE(table_id >= 0);
+
+  page_t page;
+  for (int round = 0; round < 3; round++) {
+    for (pagenum_t i = 1; i <= num_pages; i++) {
+      memset(&page, 'a' + (i + round) % 26, PAGE_SIZE);
+      memcpy(page.data, &i, sizeof(i));
+      file_write_page(table_id, i, &page);
+    }
+    ASSERT_EQ(file_sync_table_files(), 0);
+  }
+  file_close_table_files();
+
+  table_id = file_open_table_file(pathname.c_str());
+  ASSERT_TRUE(table_id >= 0);
+  for (pagenum_t i = 1; i <= num_pages; i++) {
+    file_read_page(table_id, i, &page);
+    pagenum_t stored;
+    memcpy(&stored, page.data, sizeof(stored));
+    EXPECT_EQ(stored, i);
+    EXPECT_EQ(page.data[PAGE_SIZE - 1], 'a' + (i + 2) % 26);
+  }
+
+  // Untouched pages read as zeros
+  file_read_page(table_id, num_pages + 1, &page);
+  EXPECT_EQ(page.data[0], 0);
+
+  // Each page fits in a sector, and the third round reused the slots the
+  // second one released
+  struct stat st;
+  ASSERT_EQ(stat(pathname.c_str(), &st), 0);
+  EXPECT_LE(st.st_size, PAGE_SIZE + 2 * num_pages * SECTOR_SIZE);
+
+  file_close_table_files();
+  ASSERT_EQ(remove(pathname.c_str()), 0);
+  ASSERT_EQ(remove(page_map_path.c_str()), 0);
+}
+
+/*
+ * Tests the tablespace
+ * 1. Create more tables than a directory page holds in one tablespace file
+ * 2. Grow a table over several extents and write its pages in one batch
+ * 3. Reopen the tablespace and check the pages of every table
+ */
+TEST(FileTablespaceTest, HandlesManyTables) {
+  const int num_tables = MAX_DIRECTORY_ENTRIES + 8;
+  const int num_pages = 3 * EXTENT_SIZE;
+  space_pathname = "SPACE";
+
+  std::vector<int64_t> table_ids;
+  for (int i = 0; i < num_tables; i++) {
+    std::string pathname = "segment_" + std::to_string(i);
+    int64_t table_id = file_open_table_file(pathname.c_str());
+    ASSERT_GE(table_id, 0);
+    table_ids.push_back(table_id);
+
+    page_t page;
+    memset(&page, 'a' + i % 26, PAGE_SIZE);
+    file_write_page(table_id, 1, &page);
+  }
+
+  int64_t table_id = table_ids[0];
+  for (int i = 1; i < num_pages; i++) {
+    EXPECT_EQ(file_alloc_page(table_id), i);
+  }
+
+  std::vector<page_t> pages(num_pages - 1);
+  std::vector<const page_t*> batch;
+  for (int i = 1; i < num_pages; i++) {
+    memset(&pages[i - 1], 0, PAGE_SIZE);
+    memcpy(pages[i - 1].data, &i, sizeof(i));
+    batch.push_back(&pages[i - 1]);
+  }
+  ASSERT_EQ(file_write_pages(table_id, 1, batch.data(), num_pages - 1), 0);
+  ASSERT_EQ(file_sync_table_files(), 0);
+  file_close_table_files();
+
+  for (int i = 0; i < num_tables; i++) {
+    std::string pathname = "segment_" + std::to_string(i);
+    EXPECT_EQ(file_open_table_file(pathname.c_str()), table_ids[i]);
+    EXPECT_EQ(access(pathname.c_str(), F_OK), -1);
+    if (i == 0) {
+      continue;
+    }
+
+    page_t page;
+    file_read_page(table_ids[i], 1, &page);
+    EXPECT_EQ(page.data[0], 'a' + i % 26);
+    EXPECT_EQ(page.data[PAGE_SIZE - 1], 'a' + i % 26);
+  }
+
+  page_t page;
+  for (int i = 1; i < num_pages; i++) {
+    file_read_page(table_id, i, &page);
+    int stored;
+    memcpy(&stored, page.data, sizeof(stored));
+    EXPECT_EQ(stored, i);
+  }
+  file_read_page(table_id, 0, &page);
+  EXPECT_EQ(file_get_magic_number(&page), MAGIC_NUM);
+  EXPECT_GE(file_get_number_of_pages(&page), num_pages);
+  EXPECT_EQ(file_get_high_water_mark(&page), num_pages);
+
+  file_close_table_files();
+  space_pathname = NULL;
+  ASSERT_EQ(remove("SPACE"), 0);
+  remove(CATALOG_PATH);
+}
+
+/*
+ * Tests the checksum
+ * 1. Check the CRC32C of a known string
+ * 2. Check that the accelerated and the table-driven code agree
+ */
+TEST(ChecksumTest, HandlesKnownValues) {
+  EXPECT_EQ(checksum_crc32c(0, "123456789", 9), 0xe3069283);
+  EXPECT_EQ(checksum_crc32c(checksum_crc32c(0, "1234", 4), "56789", 5),
+            0xe3069283);
+  EXPECT_EQ(checksum_crc32c(0, "", 0), 0);
+
+  std::vector<uint8_t> data(3 * PAGE_SIZE);
+  uint32_t state = 2022;
+  for (uint8_t& byte : data) {
+    state = state * 1103515245 + 12345;
+    byte = state >> 16;
+  }
+  for (size_t size : {1, 7, 64, 4051, 4052, 3 * CHECKSUM_STRIDE + 9,
+                      (int)data.size() - 3}) {
+    EXPECT_EQ(checksum_update_hw(~0u, data.data() + 3, size),
+              checksum_update_sw(~0u, data.data() + 3, size));
+  }
+}
+
+/*
+ * Tests page checksums
+ * 1. Write a page and tear it on the disk
+ * 2. Check that reads fail with CHECKSUM_ON_READ, and with CHECKSUM_LAZY
+ *    only while recovering
+ */
+TEST(FileChecksumTest, DetectsTornPages) {
+  std::string pathname = "DATA1";
+  int64_t table_id = file_open_table_file(pathname.c_str());
+  ASSERT_TRUE(table_id >= 0);
+
+  page_t page;
+  memset(&page, 'c', PAGE_SIZE);
+  file_write_page(table_id, 1, &page);
+  EXPECT_EQ(file_read_page(table_id, 1, &page), 0);
+  EXPECT_NE(file_get_checksum(&page), 0);
+
+  // Half of the page is left from an older write
+  page_t torn;
+  memset(&torn, 'd', PAGE_SIZE / 2);
+  int fd = file_find_fd(table_id);
+  ASSERT_EQ(pwrite(fd, &torn, PAGE_SIZE / 2, PAGE_SIZE + PAGE_SIZE / 2),
+            PAGE_SIZE / 2);
+
+  uint64_t num_failures = file_num_checksum_failures;
+  EXPECT_EQ(file_read_page(table_id, 1, &page), -1);
+  EXPECT_EQ(file_num_checksum_failures, num_failures + 1);
+
+  file_checksum_mode = CHECKSUM_LAZY;
+  EXPECT_EQ(file_read_page(table_id, 1, &page), 0);
+  file_in_recovery = 1;
+  EXPECT_EQ(file_read_page(table_id, 1, &page), -1);
+  file_in_recovery = 0;
+
+  // Pages never stamped are not verified, but a stamped one is whatever its
+  // checksum
+  file_checksum_mode = CHECKSUM_OFF;
+  file_set_page_flags(&page, 0);
+  file_write_page(table_id, 2, &page);
+  file_stamp_checksum(&page);
+  file_set_checksum(&page, file_get_checksum(&page) == 0 ? 1 : 0);
+  file_write_page(table_id, 3, &page);
+  file_checksum_mode = CHECKSUM_ON_READ;
+  EXPECT_EQ(file_read_page(table_id, 2, &page), 0);
+  EXPECT_EQ(file_read_page(table_id, 3, &page), -1);
+
+  file_close_table_files();
+  ASSERT_EQ(remove(pathname.c_str()), 0);
+}
+
+/*
+ * Tests the doublewrite file
+ * 1. Write a batch of pages through the doublewrite file
+ * 2. Tear one of them in place and check that it is repaired from its copy
+ */
+TEST(FileDoublewriteTest, RepairsTornPages) {
+  std::string pathname = "DATA1";
+  const int num_pages = 4;
+
+  int64_t table_id = file_open_table_file(pathname.c_str());
+  ASSERT_TRUE(table_id >= 0);
+
+  std::vector<page_t> pages(num_pages);
+  std::vector<const page_t*> batch;
+  std::vector<int64_t> table_ids;
+  std::vector<pagenum_t> pagenums;
+  for (int i = 0; i < num_pages; i++) {
+    memset(&pages[i], 'e' + i, PAGE_SIZE);
+    file_stamp_checksum(&pages[i]);
+    batch.push_back(&pages[i]);
+    table_ids.push_back(table_id);
+    pagenums.push_back(i + 1);
+  }
+
+  ASSERT_EQ(file_begin_doublewrite(table_ids.data(), pagenums.data(),
+                                   batch.data(), num_pages),
+            0);
+  ASSERT_EQ(file_write_pages(table_id, 1, batch.data(), num_pages), 0);
+  file_end_doublewrite();
+
+  page_t torn;
+  memset(&torn, 'z', PAGE_SIZE);
+  int fd = file_find_fd(table_id);
+  ASSERT_EQ(pwrite(fd, &torn, PAGE_SIZE / 2, 2 * PAGE_SIZE + PAGE_SIZE / 2),
+            PAGE_SIZE / 2);
+
+  page_t page;
+  EXPECT_EQ(file_read_page(table_id, 2, &page), -1);
+  EXPECT_EQ(file_repair_torn_pages(), 1);
+  for (int i = 0; i < num_pages; i++) {
+    EXPECT_EQ(file_read_page(table_id, i + 1, &page), 0);
+    EXPECT_EQ(memcmp(&page, &pages[i], PAGE_SIZE), 0);
+  }
+
+  // The copies are dropped once the pages are repaired
+  EXPECT_EQ(file_repair_torn_pages(), 0);
+
+  file_close_table_files();
+  ASSERT_EQ(remove(pathname.c_str()), 0);
+  ASSERT_EQ(remove(DOUBLEWRITE_PATH), 0);
+}